@@ -0,0 +1,527 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.c
+ *
+ * Description:
+ *
+ * AF_PACKET transport (-K), see sr_afpacket.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_afpacket.h"
+#include "sr_transport.h"
+#include "vnscommand.h"
+
+#ifdef _LINUX_
+
+struct sr_afpacket_if
+{
+    char name[IFNAMSIZ];
+    int ifindex;
+    int fd;
+    uint8_t* ring;                      /* SR_AFPACKET_BLOCKS blocks */
+    unsigned int blk;                   /* next block to look at */
+    struct tpacket_block_desc* block;   /* block in hand, 0 if none */
+    uint8_t* next;                      /* next frame in it */
+    unsigned int left;                  /* frames after next, inclusive */
+    struct mmsghdr msgs[SR_AFPACKET_TX_BATCH];
+    struct iovec iov[SR_AFPACKET_TX_BATCH];
+    unsigned int nmsgs;
+    unsigned long tx_drops;
+};
+
+struct sr_afpacket
+{
+    struct sr_afpacket_if ifs[SR_AFPACKET_MAX_IFS];
+    unsigned int nifs;
+    unsigned int cur;                   /* interface read from last */
+    struct pollfd pfd[SR_AFPACKET_MAX_IFS];
+    int hwinfo_pending;
+    c_hwinfo hwinfo;                    /* first command read */
+};
+
+/* the VNS header goes into the ring's reserve in front of each frame */
+typedef char sr_afpacket_reserve_check[(SR_PKT_HEADROOM >= sizeof(c_packet_header)) ? 1 : -1];
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_lookup(..)
+ * Scope:  Global
+ *
+ * Parse an interface given as name[=ip] and look it up in the kernel.
+ * Copies the name to name (IFNAMSIZ bytes) and fills in the three
+ * VNSHWINFO entries for it at hw.  Returns its ifindex, or -1.  Also
+ * used by sr_xdp.c.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_afpacket_lookup(const char* spec, char* name, c_hw_entry* hw)
+{
+    struct ifreq ifr;
+    struct in_addr ip;
+    const char* eq;
+    size_t n;
+    int fd, ifindex;
+
+    eq = strchr(spec, '=');
+    n = eq ? (size_t)(eq - spec) : strlen(spec);
+    ip.s_addr = 0;
+    if (n == 0 || n >= IFNAMSIZ || (eq && inet_aton(eq + 1, &ip) == 0))
+    {
+        fprintf(stderr, "Bad interface: %s\n", spec);
+        return -1;
+    }
+    memset(name, 0, IFNAMSIZ);
+    memcpy(name, spec, n);
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        perror("socket(..):sr_afpacket.c");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, name);
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) != 0)
+    {
+        perror(name);
+        close(fd);
+        return -1;
+    }
+    ifindex = ifr.ifr_ifindex;
+
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) != 0 ||
+        ifr.ifr_hwaddr.sa_family != 1 /* ARPHRD_ETHER */)
+    {
+        fprintf(stderr, "%s: not an ethernet interface\n", name);
+        close(fd);
+        return -1;
+    }
+    hw[2].mKey = htonl(HWETHER);
+    memcpy(hw[2].value, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+
+    if (ip.s_addr == 0)
+    {
+        if (ioctl(fd, SIOCGIFADDR, &ifr) != 0)
+        {
+            fprintf(stderr, "%s: no IPv4 address, give one with -K %s=a.b.c.d\n",
+                    name, name);
+            close(fd);
+            return -1;
+        }
+        ip = ((struct sockaddr_in*)&(ifr.ifr_addr))->sin_addr;
+    }
+    hw[0].mKey = htonl(HWINTERFACE);
+    strcpy(hw[0].value, name);
+    hw[1].mKey = htonl(HWETHIP);
+    memcpy(hw[1].value, &(ip.s_addr), 4);
+
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0 && !(ifr.ifr_flags & IFF_UP))
+    { fprintf(stderr, "warning: %s is down\n", name); }
+    close(fd);
+
+    return ifindex;
+} /* -- sr_afpacket_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: packet_open_if(..)
+ * Scope:  Local
+ *
+ * Open the packet socket of pi and map its receive ring.
+ *
+ *---------------------------------------------------------------------*/
+
+static int packet_open_if(struct sr_afpacket_if* pi)
+{
+    struct tpacket_req3 req;
+    struct sockaddr_ll sll;
+    int v;
+
+    /* -- the packet socket and its ring -- */
+    if ((pi->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) < 0)
+    {
+        perror("socket(..):sr_afpacket.c");
+        return -1;
+    }
+
+    v = TPACKET_V3;
+    if (setsockopt(pi->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) != 0)
+    {
+        perror("PACKET_VERSION");
+        return -1;
+    }
+    v = SR_PKT_HEADROOM;
+    if (setsockopt(pi->fd, SOL_PACKET, PACKET_RESERVE, &v, sizeof(v)) != 0)
+    {
+        perror("PACKET_RESERVE");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_AFPACKET_BLOCK_SZ;
+    req.tp_block_nr = SR_AFPACKET_BLOCKS;
+    req.tp_frame_size = SR_AFPACKET_FRAME_SZ;
+    req.tp_frame_nr = SR_AFPACKET_BLOCK_SZ / SR_AFPACKET_FRAME_SZ * SR_AFPACKET_BLOCKS;
+    req.tp_retire_blk_tov = SR_AFPACKET_TOV_MS;
+    if (setsockopt(pi->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+    {
+        perror("PACKET_RX_RING");
+        return -1;
+    }
+
+    pi->ring = (uint8_t*)mmap(0, SR_AFPACKET_BLOCK_SZ * SR_AFPACKET_BLOCKS,
+                              PROT_READ | PROT_WRITE, MAP_SHARED, pi->fd, 0);
+    if (pi->ring == MAP_FAILED)
+    {
+        pi->ring = 0;
+        perror("mmap(..):sr_afpacket.c");
+        return -1;
+    }
+
+    /* -- nice to have, so failures don't matter -- */
+    v = 1;
+#ifdef PACKET_QDISC_BYPASS
+    setsockopt(pi->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &v, sizeof(v));
+#endif
+#ifdef PACKET_IGNORE_OUTGOING
+    setsockopt(pi->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &v, sizeof(v));
+#endif
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = pi->ifindex;
+    if (bind(pi->fd, (struct sockaddr*)&sll, sizeof(sll)) != 0)
+    {
+        perror(pi->name);
+        return -1;
+    }
+
+    return 0;
+} /* -- packet_open_if -- */
+
+/* Send everything queued for pi.  A frame the kernel refuses is dropped,
+   as a NIC would. */
+static void packet_tx_flush(struct sr_afpacket_if* pi)
+{
+    unsigned int done = 0;
+    int ret;
+
+    while (done < pi->nmsgs)
+    {
+        ret = sendmmsg(pi->fd, pi->msgs + done, pi->nmsgs - done, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            pi->tx_drops++;
+            done++;
+            continue;
+        }
+        done += ret;
+    }
+    pi->nmsgs = 0;
+} /* -- packet_tx_flush -- */
+
+/* Hand the block pi is done with back to the kernel. */
+static void packet_block_done(struct sr_instance* sr, struct sr_afpacket_if* pi)
+{
+    /* -- frames forwarded in place may still point into it -- */
+    sr_flush_packets(sr);
+
+    __atomic_store_n(&(pi->block->hdr.bh1.block_status), TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    pi->block = 0;
+    pi->blk = (pi->blk + 1) % SR_AFPACKET_BLOCKS;
+} /* -- packet_block_done -- */
+
+/* The next frame received on pi, as a VNSPACKET command.  0 if there is
+   none, or if a block was just finished so another interface gets a turn. */
+static unsigned char* packet_next(struct sr_instance* sr, struct sr_afpacket_if* pi,
+                                  int* len_out)
+{
+    struct tpacket_block_desc* bd;
+    struct tpacket3_hdr* h;
+    struct sockaddr_ll* sll;
+    c_packet_header* ph;
+
+    for (;;)
+    {
+        if (!pi->block)
+        {
+            bd = (struct tpacket_block_desc*)(pi->ring + pi->blk * SR_AFPACKET_BLOCK_SZ);
+            if (!(__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE) &
+                  TP_STATUS_USER))
+            { return 0; }
+            pi->block = bd;
+            pi->left = bd->hdr.bh1.num_pkts;
+            pi->next = (uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt;
+        }
+
+        if (pi->left == 0)
+        {
+            packet_block_done(sr, pi);
+            return 0;
+        }
+
+        h = (struct tpacket3_hdr*)pi->next;
+        pi->next += h->tp_next_offset;
+        pi->left--;
+
+        /* -- only whole frames that arrived on this interface -- */
+        sll = (struct sockaddr_ll*)((uint8_t*)h + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        if (sll->sll_pkttype == PACKET_OUTGOING || sll->sll_ifindex != pi->ifindex ||
+            h->tp_snaplen != h->tp_len || h->tp_mac < SR_PKT_HEADROOM)
+        { continue; }
+
+        ph = (c_packet_header*)((uint8_t*)h + h->tp_mac - sizeof(c_packet_header));
+        ph->mLen = htonl(sizeof(c_packet_header) + h->tp_snaplen);
+        ph->mType = htonl(VNSPACKET);
+        memcpy(ph->mInterfaceName, pi->name, sizeof(ph->mInterfaceName));
+
+        *len_out = sizeof(c_packet_header) + h->tp_snaplen;
+        return (unsigned char*)ph;
+    }
+} /* -- packet_next -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_read(..)
+ * Scope:  Local
+ *
+ * Read side of the transport: the VNSHWINFO built from the kernel's
+ * interfaces first, then frames from every interface's ring, a block
+ * at a time from each in turn.  Waits in poll() when every ring is
+ * empty.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned char* sr_afpacket_read(struct sr_instance* sr, int* len_out)
+{
+    struct sr_afpacket* pk = sr->afp;
+    struct sr_afpacket_if* pi;
+    unsigned char* cmd;
+    unsigned int i;
+
+    if (pk->hwinfo_pending)
+    {
+        pk->hwinfo_pending = 0;
+        *len_out = ntohl(pk->hwinfo.mLen);
+        return (unsigned char*)&(pk->hwinfo);
+    }
+
+    for (;;)
+    {
+        for (i = 0; i < pk->nifs; i++)
+        {
+            pi = &(pk->ifs[pk->cur]);
+            if ((cmd = packet_next(sr, pi, len_out)) != 0)
+            { return cmd; }
+            pk->cur = (pk->cur + 1) % pk->nifs;
+        }
+
+        /* -- about to block, same as sr_read_command -- */
+        if (sr_flush_packets(sr) != 0)
+        { return 0; }
+        if (poll(pk->pfd, pk->nifs, -1) < 0 && errno != EINTR)
+        {
+            perror("poll(..):sr_afpacket.c");
+            return 0;
+        }
+    }
+} /* -- sr_afpacket_read -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_write(..)
+ * Scope:  Local
+ *
+ * Write side of the transport: queue the frame of every VNSPACKET on
+ * the interface it names, then send each interface's frames at once.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_afpacket_write(struct sr_instance* sr, struct iovec* iov, int niov)
+{
+    struct sr_afpacket* pk = sr->afp;
+    struct sr_afpacket_if* pi;
+    c_packet_header* ph;
+    uint8_t* p;
+    size_t left;
+    unsigned int len, i;
+
+    for ( ; niov > 0; iov++, niov--)
+    {
+        p = (uint8_t*)iov->iov_base;
+        left = iov->iov_len;
+        while (left >= sizeof(c_packet_header))
+        {
+            ph = (c_packet_header*)p;
+            len = ntohl(ph->mLen);
+            assert(len >= sizeof(c_packet_header) && len <= left);
+            p += len;
+            left -= len;
+
+            for (i = 0; i < pk->nifs; i++)
+            {
+                if (strncmp(pk->ifs[i].name, ph->mInterfaceName,
+                            sizeof(ph->mInterfaceName)) == 0)
+                { break; }
+            }
+            if (i == pk->nifs || ntohl(ph->mType) != VNSPACKET)
+            { continue; }
+
+            pi = &(pk->ifs[i]);
+            if (pi->nmsgs == SR_AFPACKET_TX_BATCH)
+            { packet_tx_flush(pi); }
+            pi->iov[pi->nmsgs].iov_base = (uint8_t*)ph + sizeof(c_packet_header);
+            pi->iov[pi->nmsgs].iov_len = len - sizeof(c_packet_header);
+            memset(&(pi->msgs[pi->nmsgs]), 0, sizeof(struct mmsghdr));
+            pi->msgs[pi->nmsgs].msg_hdr.msg_iov = &(pi->iov[pi->nmsgs]);
+            pi->msgs[pi->nmsgs].msg_hdr.msg_iovlen = 1;
+            pi->nmsgs++;
+        }
+    }
+
+    for (i = 0; i < pk->nifs; i++)
+    {
+        if (pk->ifs[i].nmsgs > 0)
+        { packet_tx_flush(&(pk->ifs[i])); }
+    }
+    return 0;
+} /* -- sr_afpacket_write -- */
+
+static const struct sr_transport sr_afpacket_transport =
+{ "packet", sr_afpacket_read, sr_afpacket_write };
+
+/*---------------------------------------------------------------------
+ * Method: sr_connect_to_afpacket(..)
+ * Scope:  Global
+ *
+ * Open the Linux interfaces given as name[=ip] and make them sr's
+ * transport.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_connect_to_afpacket(struct sr_instance* sr, char** ifs, unsigned int nifs)
+{
+    struct sr_afpacket* pk;
+    struct sr_afpacket_if* pi;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(ifs);
+
+    if (nifs == 0 || nifs > SR_AFPACKET_MAX_IFS)
+    { return -1; }
+
+    if (sr->tx.buf == 0 && sr_txbatch_init(&(sr->tx)) != 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_afpacket)\n");
+        return -1;
+    }
+    if ((pk = (struct sr_afpacket*)calloc(1, sizeof(struct sr_afpacket))) == 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_afpacket)\n");
+        return -1;
+    }
+    for (i = 0; i < SR_AFPACKET_MAX_IFS; i++)
+    { pk->ifs[i].fd = -1; }
+    sr->afp = pk;
+
+    for (i = 0; i < nifs; i++)
+    {
+        pi = &(pk->ifs[i]);
+        pk->nifs++;
+
+        pi->ifindex = sr_afpacket_lookup(ifs[i], pi->name, &(pk->hwinfo.mHWInfo[3 * i]));
+        if (pi->ifindex < 0 || packet_open_if(pi) != 0)
+        { return -1; }
+        pk->pfd[i].fd = pi->fd;
+        pk->pfd[i].events = POLLIN;
+    }
+
+    pk->hwinfo.mLen = htonl(8 + 3 * nifs * sizeof(c_hw_entry));
+    pk->hwinfo.mType = htonl(VNSHWINFO);
+    pk->hwinfo_pending = 1;
+    sr->transport = &sr_afpacket_transport;
+
+    return 0;
+} /* -- sr_connect_to_afpacket -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_afpacket_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_afpacket_close(struct sr_instance* sr)
+{
+    struct sr_afpacket* pk;
+    struct sr_afpacket_if* pi;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if ((pk = sr->afp) == 0)
+    { return; }
+
+    for (i = 0; i < pk->nifs; i++)
+    {
+        pi = &(pk->ifs[i]);
+        if (pi->tx_drops)
+        { fprintf(stderr, "%s: %lu frames not sent\n", pi->name, pi->tx_drops); }
+        if (pi->ring)
+        { munmap(pi->ring, SR_AFPACKET_BLOCK_SZ * SR_AFPACKET_BLOCKS); }
+        if (pi->fd >= 0)
+        { close(pi->fd); }
+    }
+
+    free(pk);
+    sr->afp = 0;
+} /* -- sr_afpacket_close -- */
+
+#else /* -- no AF_PACKET -- */
+
+int sr_afpacket_lookup(const char* spec, char* name, c_hw_entry* hw)
+{
+    (void)spec;
+    (void)name;
+    (void)hw;
+    return -1;
+} /* -- sr_afpacket_lookup -- */
+
+int sr_connect_to_afpacket(struct sr_instance* sr, char** ifs, unsigned int nifs)
+{
+    (void)sr;
+    (void)ifs;
+    (void)nifs;
+    fprintf(stderr, "-K needs Linux\n");
+    return -1;
+} /* -- sr_connect_to_afpacket -- */
+
+void sr_afpacket_close(struct sr_instance* sr)
+{
+    (void)sr;
+} /* -- sr_afpacket_close -- */
+
+#endif /* _LINUX_ */
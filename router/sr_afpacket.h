@@ -0,0 +1,51 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_afpacket.h
+ *
+ * Description:
+ *
+ * Linux AF_PACKET transport (-K ifname[=ip], once per interface): instead
+ * of VNS, every router interface is a real Linux interface of the same
+ * name, so rtable names Linux interfaces.  A veth pair per interface is
+ * enough to test with:
+ *
+ *   ip link add eth1 type veth peer name h1
+ *   ip link set eth1 up; ip link set h1 up
+ *   ethtool -K h1 tx off           (frames sent from h1 get full checksums)
+ *   ./sr -K eth1=10.0.1.1 -K eth2=172.64.3.1 -r rtable
+ *
+ * Each interface's MAC, and its IPv4 address unless one is given, come
+ * from the kernel and are handed to the router as if VNS had sent them
+ * in a VNSHWINFO.  An address given with -K is best left off the Linux
+ * interface, or the kernel answers ARP and pings for it too.
+ *
+ * Frames are received through a TPACKET_V3 ring per interface, read in
+ * place.  The ring leaves SR_PKT_HEADROOM bytes in front of every frame,
+ * where a VNS packet header is written, so the rest of sr_vns_comm.c sees
+ * the same commands it would get from a server and frames can still be
+ * forwarded in place.  A block goes back to the kernel once the frames
+ * read from it are flushed.  Frames are sent with one sendmmsg() per
+ * interface per flush, bypassing the qdisc where the kernel allows.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_AFPACKET_H
+#define SR_AFPACKET_H
+
+#define SR_AFPACKET_MAX_IFS   16
+#define SR_AFPACKET_BLOCK_SZ  (256 * 1024)
+#define SR_AFPACKET_BLOCKS    16          /* per interface */
+#define SR_AFPACKET_FRAME_SZ  2048        /* largest frame received, headers
+                                           included */
+#define SR_AFPACKET_TOV_MS    1           /* a partly filled block is handed
+                                           over after this long */
+#define SR_AFPACKET_TX_BATCH  64          /* frames per sendmmsg() */
+
+#include "vnscommand.h"
+
+struct sr_instance;
+
+int  sr_connect_to_afpacket(struct sr_instance* sr, char** ifs, unsigned int nifs);
+void sr_afpacket_close(struct sr_instance* sr);
+int  sr_afpacket_lookup(const char* spec, char* name, c_hw_entry* hw);
+
+#endif /* -- SR_AFPACKET_H -- */
@@ -11,6 +11,13 @@
 #include "sr_if.h"
 #include "sr_protocol.h"
 #include "sr_utils.h"
+#include "sr_pool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+
+/* queue entries for packets waiting on ARP come from their own pool */
+static struct sr_pool arpq_pool =
+    SR_POOL_INITIALIZER(SR_POOL_ARPQ, sizeof(struct sr_packet), SR_PKTBUF_MAX);
 
 /* 	Function that handles incoming ARP messages
  * 	Depending on whether it's a reply or a request, handle it differently.
@@ -37,10 +44,10 @@ void handle_arpIncomingMessage(uint8_t **packet, struct sr_instance *sr, unsigne
 				/* Change ethernet addresses */
 				struct sr_ethernet_hdr* pendingEtherHeader = (struct sr_ethernet_hdr*)pendingPkt->buf;
 				memcpy(pendingEtherHeader->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-				struct sr_if* pendingIface = sr_get_interface(sr, pendingPkt->iface);
-				memcpy(pendingEtherHeader->ether_shost, pendingIface->addr, ETHER_ADDR_LEN);
+				memcpy(pendingEtherHeader->ether_shost, pendingPkt->iface->addr, ETHER_ADDR_LEN);
 					
-				sr_send_packet(sr, pendingPkt->buf, pendingPkt->len, pendingPkt->iface);
+				/* The batch keeps the buffer alive after the request is destroyed */
+				sr_send_pktbuf(sr, pendingPkt->buf, pendingPkt->len, pendingPkt->iface);
 				pendingPkt = pendingPkt->next;
 			}
 			
@@ -54,7 +61,12 @@ void handle_arpIncomingMessage(uint8_t **packet, struct sr_instance *sr, unsigne
 			if (currIface->ip == arp_hdr->ar_tip) {
 				/* Create ARP reply packet (encapsulate in ethernet frame) and send to source of ARP request */
 				struct sr_ethernet_hdr *ether_hdr = (struct sr_ethernet_hdr*)*packet;
-				uint8_t *new_packet = (uint8_t *)malloc(sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr));
+				unsigned int new_pkt_len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr);
+				uint8_t *new_packet = sr_pktbuf_alloc(new_pkt_len);
+				if (new_packet == NULL) {
+					sr_log(SR_LOG_WARN, "out of packet buffers, ARP reply dropped\n");
+					break;
+				}
 				struct sr_ethernet_hdr *new_ether_hdr = (struct sr_ethernet_hdr*)new_packet;
 				struct sr_arp_hdr *new_arp_hdr = (struct sr_arp_hdr*)(new_packet + sizeof(struct sr_ethernet_hdr));
 
@@ -70,7 +82,8 @@ void handle_arpIncomingMessage(uint8_t **packet, struct sr_instance *sr, unsigne
 				memcpy(new_arp_hdr->ar_tha, arp_hdr->ar_sha, ETHER_ADDR_LEN);
 				memcpy(new_arp_hdr->ar_sha, currIface->addr, ETHER_ADDR_LEN);
 
-				sr_send_packet(sr, new_packet, len, currIface->name);
+				sr_send_pktbuf(sr, new_packet, new_pkt_len, currIface);
+				sr_pktbuf_release(new_packet);
 				break;
 			}
 			currIface = currIface->next;
@@ -109,51 +122,60 @@ void handle_arpreq(struct sr_instance *sr, struct sr_arpreq* req){
 			packet = req->packets;			
 			while (packet != NULL) {
 				/* Send type 3 code 1 ICMP (Host Unreachable) */
+				sr_stats_drop(SR_DROP_ARP_TIMEOUT);
 				ip_hdr = (struct sr_ip_hdr*)(packet->buf + sizeof(struct sr_ethernet_hdr));
 				returnIface = longestPrefixMatch(sr, ip_hdr->ip_src);
 				if (returnIface != NULL){
-					returnICMP = create_icmpMessage(sr, packet->buf, packet->len, 3, 1, returnIface->name);
-					returnIP = (struct sr_ip_hdr*)(returnICMP + sizeof(struct sr_ethernet_hdr));
-					returnIP->ip_src = returnIface->ip;
-					sr_send_packet(sr, returnICMP, 70, returnIface->name);
-					free(returnICMP);
+					returnICMP = create_icmpMessage(sr, packet->buf, packet->len, 3, 1, returnIface);
+					if (returnICMP != NULL) {
+						returnIP = (struct sr_ip_hdr*)(returnICMP + sizeof(struct sr_ethernet_hdr));
+						returnIP->ip_src = returnIface->ip;
+						sr_send_pktbuf(sr, returnICMP, 70, returnIface);
+						sr_pktbuf_release(returnICMP);
+					}
 				}
 				packet = packet->next;
 			}
 			/* Destroy the request afterwards */
 			sr_arpreq_destroy(cache, req);
 		} else {
-			/* BROADCAST ARP request */
-			uint8_t* broadcast_packet = malloc(sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr));
+			/* BROADCAST ARP request, one buffer per interface since each
+			   one stays referenced by the transmit batch until it is sent */
 			unsigned int new_pkt_len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr);
-			struct sr_ethernet_hdr* new_ether_hdr = (struct sr_ethernet_hdr*)broadcast_packet;
-			struct sr_arp_hdr* new_arp_hdr = (struct sr_arp_hdr*)(broadcast_packet + sizeof(struct sr_ethernet_hdr));
-			memset(&new_ether_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
-			new_ether_hdr->ether_type = ntohs(ethertype_arp);
 			
 			currIface = sr->if_list;
 			
-			new_arp_hdr->ar_hrd = ntohs(arp_hrd_ethernet);
-			new_arp_hdr->ar_pro = ntohs(ethertype_ip);
-			new_arp_hdr->ar_hln = ETHER_ADDR_LEN;
-			new_arp_hdr->ar_pln = 4; 
-			new_arp_hdr->ar_op =  ntohs(arp_op_request);
-			memset(&new_arp_hdr->ar_tha, 0, ETHER_ADDR_LEN);
-			new_arp_hdr->ar_tip = req->ip;		
-			
 			while (currIface != NULL) {
+				uint8_t* broadcast_packet = sr_pktbuf_alloc(new_pkt_len);
+				if (broadcast_packet == NULL) {
+					sr_log(SR_LOG_WARN, "out of packet buffers, ARP request dropped\n");
+					break;
+				}
+				struct sr_ethernet_hdr* new_ether_hdr = (struct sr_ethernet_hdr*)broadcast_packet;
+				struct sr_arp_hdr* new_arp_hdr = (struct sr_arp_hdr*)(broadcast_packet + sizeof(struct sr_ethernet_hdr));
+				memset(&new_ether_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+				new_ether_hdr->ether_type = ntohs(ethertype_arp);
+				
+				new_arp_hdr->ar_hrd = ntohs(arp_hrd_ethernet);
+				new_arp_hdr->ar_pro = ntohs(ethertype_ip);
+				new_arp_hdr->ar_hln = ETHER_ADDR_LEN;
+				new_arp_hdr->ar_pln = 4; 
+				new_arp_hdr->ar_op =  ntohs(arp_op_request);
+				memset(&new_arp_hdr->ar_tha, 0, ETHER_ADDR_LEN);
+				new_arp_hdr->ar_tip = req->ip;		
+				
 				memcpy(&new_ether_hdr->ether_shost, currIface->addr, ETHER_ADDR_LEN);
 				memcpy(&new_arp_hdr->ar_sha, currIface->addr, ETHER_ADDR_LEN);
 				new_arp_hdr->ar_sip = currIface->ip;
 
-				sr_send_packet(sr, broadcast_packet, new_pkt_len, currIface->name);
+				sr_send_pktbuf(sr, broadcast_packet, new_pkt_len, currIface);
+				sr_pktbuf_release(broadcast_packet);
 
 				currIface = currIface->next;
 			}
 			now = time(NULL);
 			req->sent = now;
 			req->times_sent++;
-			free(broadcast_packet);
 		}
 	}
 }
@@ -181,30 +203,193 @@ void sr_arpcache_sweepreqs(struct sr_instance *sr) {
 
 /* You should not need to touch the rest of this code. */
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+/* Hash table internals. All of these must be called with cache->lock held,
+   and anything that changes a slot must be bracketed by
+   arpcache_write_begin/end so that lock-free readers retry. */
 
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+static void arpcache_write_begin(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELEASE);
+}
+
+static unsigned int arpcache_home(const struct sr_arptable *t, uint32_t ip) {
+    /* Mix all four octets into the low bits so that neighbours on one
+       subnet (differing only in the last octet) spread over the table */
+    uint32_t h = ip;
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    h ^= h >> 16;
+    return (unsigned int)h & (t->nslots - 1);
+}
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+static struct sr_arptable *arptable_alloc(unsigned int nslots) {
+    struct sr_arptable *t = (struct sr_arptable *) calloc(1,
+            sizeof(struct sr_arptable) + nslots * sizeof(struct sr_arpentry));
+    if (t) {
+        t->nslots = nslots;
+        t->entries = (struct sr_arpentry *)(t + 1);
+    }
+    return t;
+}
+
+/* Returns the slot holding ip, or -1 */
+static int arpcache_find(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arptable *t = cache->table;
+    unsigned int mask = t->nslots - 1;
+    unsigned int i = arpcache_home(t, ip);
+
+    while (t->entries[i].valid) {
+        if (t->entries[i].ip == ip) {
+            return (int)i;
         }
+        i = (i + 1) & mask;
     }
+    return -1;
+}
 
-    /* Must return a copy b/c another thread could jump in and modify
-       table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+/* Empties slot i, shifting later members of the probe run back so that
+   lookups never need tombstones. */
+static void arpcache_delete_slot(struct sr_arpcache *cache, unsigned int i) {
+    struct sr_arptable *t = cache->table;
+    unsigned int mask = t->nslots - 1;
+    unsigned int j = i, k;
+
+    while (1) {
+        j = (j + 1) & mask;
+        if (!t->entries[j].valid) {
+            break;
+        }
+        k = arpcache_home(t, t->entries[j].ip);
+        /* Move j back into the hole unless its home lies in (i, j] */
+        if ((i <= j) ? (k <= i || k > j) : (k <= i && k > j)) {
+            t->entries[i] = t->entries[j];
+            i = j;
+        }
     }
 
-    pthread_mutex_unlock(&(cache->lock));
+    t->entries[i].valid = 0;
+    cache->count--;
+}
+
+/* Places an entry for an IP that is known not to be in the table */
+static struct sr_arpentry *arptable_place(struct sr_arptable *t, uint32_t ip) {
+    unsigned int mask = t->nslots - 1;
+    unsigned int i = arpcache_home(t, ip);
+
+    while (t->entries[i].valid) {
+        i = (i + 1) & mask;
+    }
+    t->entries[i].ip = ip;
+    t->entries[i].valid = 1;
+    __atomic_store_n(&(t->entries[i].referenced), 0, __ATOMIC_RELAXED);
+    return &(t->entries[i]);
+}
+
+/* Builds a bigger table off to the side and publishes it. Readers may
+   still be probing the old one, so it is kept on the retired list until
+   the cache is destroyed; since tables only double, the retired tables
+   never add up to more than the live one. */
+static int arpcache_resize(struct sr_arpcache *cache, unsigned int nslots) {
+    struct sr_arptable *old = cache->table;
+    struct sr_arptable *t = arptable_alloc(nslots);
+    struct sr_arpentry *e;
+    unsigned int i;
+
+    if (!t) {
+        return -1;
+    }
+
+    for (i = 0; i < old->nslots; i++) {
+        if (old->entries[i].valid) {
+            e = arptable_place(t, old->entries[i].ip);
+            memcpy(e->mac, old->entries[i].mac, ETHER_ADDR_LEN);
+            e->added = old->entries[i].added;
+            e->referenced = __atomic_load_n(&(old->entries[i].referenced), __ATOMIC_RELAXED);
+        }
+    }
+
+    t->retired = old;
+    __atomic_store_n(&(cache->table), t, __ATOMIC_RELEASE);
+    cache->hand = 0;
+    return 0;
+}
+
+/* CLOCK: skip (and clear) recently referenced entries, evict the first
+   entry that has not been used since the hand last passed it. */
+static void arpcache_evict(struct sr_arpcache *cache) {
+    struct sr_arptable *t = cache->table;
+    unsigned int mask = t->nslots - 1;
+    struct sr_arpentry *e;
+
+    while (cache->count > 0) {
+        e = &(t->entries[cache->hand]);
+        if (e->valid) {
+            if (!__atomic_load_n(&(e->referenced), __ATOMIC_RELAXED)) {
+                arpcache_delete_slot(cache, cache->hand);
+                cache->evictions++;
+                return;
+            }
+            __atomic_store_n(&(e->referenced), 0, __ATOMIC_RELAXED);
+        }
+        cache->hand = (cache->hand + 1) & mask;
+    }
+}
+
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   On a hit the MAC is copied into mac and 1 is returned, otherwise 0.
+
+   This is the forwarding fast path: it takes no lock and allocates nothing.
+   Writers bump cache->seq to an odd value while they change slots, so a
+   reader that overlaps a write (or a table swap) simply retries. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       unsigned char mac[ETHER_ADDR_LEN]) {
+    const struct sr_arptable *t;
+    struct sr_arpentry *e;
+    unsigned int seq, mask, i, probes;
+    int found;
+
+    do {
+        seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
 
-    return copy;
+        t = __atomic_load_n(&(cache->table), __ATOMIC_ACQUIRE);
+        mask = t->nslots - 1;
+        i = arpcache_home(t, ip);
+        found = 0;
+
+        /* bounded in case a concurrent write leaves a torn probe run */
+        for (probes = 0; probes < t->nslots && t->entries[i].valid; probes++) {
+            e = &(t->entries[i]);
+            if (e->ip == ip) {
+                memcpy(mac, e->mac, ETHER_ADDR_LEN);
+                /* other readers and the CLOCK hand touch this bit too */
+                if (!__atomic_load_n(&(e->referenced), __ATOMIC_RELAXED)) {
+                    __atomic_store_n(&(e->referenced), 1, __ATOMIC_RELAXED);
+                }
+                found = 1;
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+             __atomic_load_n(&(cache->seq), __ATOMIC_RELAXED) != seq);
+
+    if (found) {
+        __atomic_fetch_add(&(cache->hits), 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&(cache->misses), 1, __ATOMIC_RELAXED);
+    }
+
+    return found;
 }
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
@@ -217,7 +402,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       struct sr_if *iface)
 {
     pthread_mutex_lock(&(cache->lock));
 
@@ -238,15 +423,21 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
 
     /* Add the packet to the list of packets for this request */
     if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
-
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+        struct sr_packet *new_pkt = (struct sr_packet *)sr_pool_get(&arpq_pool);
+        uint8_t *buf = sr_pktbuf_alloc(packet_len);
+
+        if (new_pkt && buf) {
+            memcpy(buf, packet, packet_len);
+            new_pkt->buf = buf;
+            new_pkt->len = packet_len;
+            new_pkt->iface = iface;
+            new_pkt->next = req->packets;
+            req->packets = new_pkt;
+        } else {
+            sr_pool_put(new_pkt);
+            sr_pktbuf_release(buf);
+            sr_stats_drop(SR_DROP_NO_BUFFER);
+        }
     }
 
     pthread_mutex_unlock(&(cache->lock));
@@ -257,7 +448,9 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping in the cache, and marks it valid. If the
+      IP is already cached its MAC and timestamp are refreshed; if the cache
+      is at capacity another entry is evicted. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
                                      uint32_t ip)
@@ -265,6 +458,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
     pthread_mutex_lock(&(cache->lock));
 
     struct sr_arpreq *req, *prev = NULL, *next = NULL;
+    struct sr_arpentry *entry;
     for (req = cache->requests; req != NULL; req = req->next) {
         if (req->ip == ip) {
             if (prev) {
@@ -281,18 +475,31 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
         prev = req;
     }
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
+    int i = arpcache_find(cache, ip);
+
+    arpcache_write_begin(cache);
+
+    if (i >= 0) {
+        entry = &(cache->table->entries[i]);
+    } else {
+        if (cache->count >= cache->capacity) {
+            arpcache_evict(cache);
+        } else if (2 * (cache->count + 1) > cache->table->nslots &&
+                   arpcache_resize(cache, 2 * cache->table->nslots) != 0) {
+            /* A fuller table would slow probes down, and a full one would
+               never end them: make room as if at capacity instead */
+            sr_log(SR_LOG_WARN, "ARP cache could not grow past %u slots, evicting\n",
+                   cache->table->nslots);
+            arpcache_evict(cache);
+        }
+        entry = arptable_place(cache->table, ip);
+        cache->count++;
     }
 
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
-    }
+    memcpy(entry->mac, mac, 6);
+    entry->added = time(NULL);
+
+    arpcache_write_end(cache);
 
     pthread_mutex_unlock(&(cache->lock));
 
@@ -326,11 +533,8 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
 
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+            sr_pktbuf_release(pkt->buf);
+            sr_pool_put(pkt);
         }
 
         free(entry);
@@ -341,26 +545,90 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache) {
+    pthread_mutex_lock(&(cache->lock));
+
     fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
 
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        struct sr_arpentry *cur = &(cache->entries[i]);
+    unsigned int i;
+    for (i = 0; i < cache->table->nslots; i++) {
+        struct sr_arpentry *cur = &(cache->table->entries[i]);
         unsigned char *mac = cur->mac;
+        if (!cur->valid)
+            continue;
         fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
     }
 
-    fprintf(stderr, "\n");
+    fprintf(stderr, "\n%u/%u entries, %u slots, %lu hits, %lu misses, %lu evictions\n\n",
+            cache->count, cache->capacity, cache->table->nslots,
+            cache->hits, cache->misses, cache->evictions);
+
+    pthread_mutex_unlock(&(cache->lock));
 }
 
-/* Initialize table + table lock. Returns 0 on success. */
-int sr_arpcache_init(struct sr_arpcache *cache) {
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
+/* Copies up to max valid entries into out, taking no lock: like a lookup
+   it reads under the seq counter and starts over if a writer was active
+   meanwhile. Returns the number of entries copied. */
+unsigned int sr_arpcache_snapshot(struct sr_arpcache *cache,
+                                  struct sr_arpentry *out, unsigned int max) {
+    const struct sr_arptable *t;
+    unsigned int seq, i, n;
+
+    do {
+        seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
 
-    /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
+        t = __atomic_load_n(&(cache->table), __ATOMIC_ACQUIRE);
+        n = 0;
+        for (i = 0; i < t->nslots && n < max; i++) {
+            if (t->entries[i].valid) {
+                out[n++] = t->entries[i];
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) ||
+             __atomic_load_n(&(cache->seq), __ATOMIC_RELAXED) != seq);
+
+    return n;
+}
+
+/* Forgets every IP->MAC mapping; queued requests are left alone. Returns
+   the number of entries removed. */
+unsigned int sr_arpcache_flush(struct sr_arpcache *cache) {
+    struct sr_arptable *t;
+    unsigned int i, n;
+
+    pthread_mutex_lock(&(cache->lock));
+
+    t = cache->table;
+    n = cache->count;
+    arpcache_write_begin(cache);
+    for (i = 0; i < t->nslots; i++) {
+        t->entries[i].valid = 0;
+    }
+    cache->count = 0;
+    cache->hand = 0;
+    arpcache_write_end(cache);
+
+    pthread_mutex_unlock(&(cache->lock));
+    return n;
+}
+
+/* Initialize table + table lock. Returns 0 on success. */
+int sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity) {
+    /* Start small, the table doubles as neighbours are learned */
+    cache->capacity = capacity ? capacity : SR_ARPCACHE_SZ;
+    cache->table = arptable_alloc(SR_ARPCACHE_MIN_SLOTS);
+    if (!cache->table)
+        return -1;
+    cache->seq = 0;
+    cache->count = 0;
+    cache->hand = 0;
+    cache->hits = cache->misses = cache->evictions = 0;
     cache->requests = NULL;
 
     /* Acquire mutex lock */
@@ -373,6 +641,13 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    struct sr_arptable *t, *retired;
+
+    for (t = cache->table; t; t = retired) {
+        retired = t->retired;
+        free(t);
+    }
+    cache->table = NULL;
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
@@ -384,21 +659,37 @@ void *sr_arpcache_timeout(void *sr_ptr) {
 
     while (1) {
         sleep(1.0);
+        if (__atomic_load_n(&(sr->sweep_stop), __ATOMIC_ACQUIRE)) {
+            break;
+        }
 
         pthread_mutex_lock(&(cache->lock));
 
         time_t curtime = time(NULL);
 
-        int i;
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
+        /* Deleting shifts later entries back into slot i, so only advance
+           past slots that are kept. The lock keeps other writers out of
+           the scan; only the deletes themselves make readers retry. */
+        struct sr_arptable *t = cache->table;
+        unsigned int i = 0;
+        while (i < t->nslots) {
+            if ((t->entries[i].valid) && (difftime(curtime,t->entries[i].added) > SR_ARPCACHE_TO)) {
+                arpcache_write_begin(cache);
+                arpcache_delete_slot(cache, i);
+                arpcache_write_end(cache);
+            } else {
+                i++;
             }
         }
 
+        /* Resending requests is slow, keep it outside the write section so
+           lookups are not held up by it. */
         sr_arpcache_sweepreqs(sr);
 
         pthread_mutex_unlock(&(cache->lock));
+
+        /* Push out the ARP requests and ICMP errors sent above */
+        sr_flush_packets(sr);
     }
 
     return NULL;
@@ -9,11 +9,10 @@
    --
 
    # When sending packet to next_hop_ip
-   entry = arpcache_lookup(next_hop_ip)
+   found = arpcache_lookup(next_hop_ip, mac)
 
-   if entry:
-       use next_hop_ip->mac mapping in entry to send the packet
-       free entry
+   if found:
+       use next_hop_ip->mac mapping to send the packet
    else:
        req = arpcache_queuereq(next_hop_ip, packet, len)
        handle_arpreq(req)
@@ -71,13 +70,15 @@
 #include <pthread.h>
 #include "sr_if.h"
 
-#define SR_ARPCACHE_SZ    100  
+#define SR_ARPCACHE_SZ    1024  /* default capacity, see -a in sr_main.c */
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_MIN_SLOTS 16
 
 struct sr_packet {
-    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
+    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty
+                                   (a pool buffer, see sr_pool.h) */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    struct sr_if *iface;        /* The outgoing interface */
     struct sr_packet *next;
 };
 
@@ -86,6 +87,8 @@ struct sr_arpentry {
     uint32_t ip;                /* IP addr in network byte order */
     time_t added;         
     int valid;
+    int referenced;             /* CLOCK bit, set on every lookup hit;
+                                   read and written with __atomic */
 };
 
 struct sr_arpreq {
@@ -99,22 +102,45 @@ struct sr_arpreq {
     struct sr_arpreq *next;
 };
 
+/* The entries are an open addressed (linear probing) hash table keyed on
+   IP. The table doubles while it is more than half full, up to twice the
+   capacity; once capacity entries are held, inserting a new IP evicts an
+   entry chosen by the CLOCK algorithm.
+
+   Lookups take no lock: they read the table under the seq counter and
+   retry if a writer (who always holds lock) was active meanwhile. */
+struct sr_arptable {
+    unsigned int nslots;        /* power of two */
+    struct sr_arpentry *entries;
+    struct sr_arptable *retired; /* previous (smaller) table */
+};
+
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_arptable *table;
+    unsigned int seq;           /* odd while a writer is changing table */
+    unsigned int count;         /* valid entries */
+    unsigned int capacity;      /* max valid entries before eviction */
+    unsigned int hand;          /* CLOCK hand */
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
     struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
 };
 
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   Copies the MAC out and returns 1 on a hit, returns 0 otherwise. Never
+   blocks and never allocates. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       unsigned char mac[ETHER_ADDR_LEN]);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
+   that corresponds to this ARP request. The packet is copied into a pool
+   buffer, so the caller keeps ownership of the packet argument. If the
+   pool is exhausted the packet is dropped but the request is still queued.
 
    A pointer to the ARP request is returned; it should be freed. The caller
    can remove the ARP request from the queue by calling sr_arpreq_destroy. */
@@ -122,7 +148,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         struct sr_if *iface);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -139,12 +165,20 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
+/* Copies up to max valid entries into out without blocking the forwarding
+   path. Returns the number copied. */
+unsigned int sr_arpcache_snapshot(struct sr_arpcache *cache,
+                                  struct sr_arpentry *out, unsigned int max);
+
+/* Removes every IP->MAC mapping. Returns the number removed. */
+unsigned int sr_arpcache_flush(struct sr_arpcache *cache);
+
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
    a destructor, and a cleanup thread times out cache entries every 15
    seconds. */
 
-int   sr_arpcache_init(struct sr_arpcache *cache);
+int   sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 
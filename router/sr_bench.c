@@ -0,0 +1,645 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * Offline benchmark of the whole forwarding path, no VNS server, Mininet
+ * or POX needed.  Loads a routing table, builds the interface list from an
+ * IP_CONFIG file with the same calls sr_handle_hwinfo makes for VNSHWINFO,
+ * and replays the inbound frames of a capture through sr_handlepacket as
+ * fast as it can.  This file stands in for sr_vns_comm.c: whatever the
+ * router sends is counted and thrown away.  Reports packets/sec,
+ * ns/packet and allocator calls per packet.
+ *
+ *   make sr_bench && ./sr_bench -f capture [-r rtable] [-i IP_CONFIG]
+ *                               [-n passes] [-a] [-N] [-P]
+ *
+ * The capture is either a classic pcap or the pcapng written by sr -l.
+ * pcapng frames arrive on the interface named in their capture's
+ * interface block, and frames marked outbound are skipped.  Classic pcap
+ * has neither, so every frame is replayed, arriving on the interface of
+ * the route back to its sender.
+ *
+ * One untimed pass warms up the pools, the ARP cache and NAT, then the
+ * capture is replayed -n times (by default, enough passes for a million
+ * frames).  Before every pass each next hop in the routing table and
+ * each destination in the capture is put in the ARP cache with a made-up
+ * MAC.  Give -a to leave that to ARP replies in the capture instead.
+ * -N turns on NAT as sr -n does, -P adds the per-stage latency table.
+ *
+ * Allocator calls are counted by wrapping malloc, calloc, realloc and
+ * posix_memalign at link time (see the sr_bench target in the Makefile).
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_utils.h"
+#include "sr_arpcache.h"
+#include "sr_nat.h"
+#include "sr_pool.h"
+#include "sr_cksum.h"
+#include "sr_stats.h"
+#include "sr_log.h"
+#include "sr_lat.h"
+
+#define DEFAULT_RTABLE   "rtable"
+#define DEFAULT_IPCONFIG "../IP_CONFIG"
+#define DEFAULT_FRAMES   1000000    /* frames replayed when -n is not given */
+
+#define PCAP_MAGIC_US    0xa1b2c3d4
+#define PCAP_MAGIC_NS    0xa1b23c4d
+#define PCAP_LINKTYPE_ETH 1
+#define PCAPNG_SHB       0x0A0D0D0A
+#define PCAPNG_IDB       0x00000001
+#define PCAPNG_SPB       0x00000003
+#define PCAPNG_EPB       0x00000006
+#define PCAPNG_BOM       0x1A2B3C4D
+#define PCAPNG_MAX_IFS   64
+
+struct bench_frame
+{
+    const uint8_t* data;    /* into the capture, never written */
+    unsigned int len;
+    struct sr_if* iface;    /* arrives on */
+};
+
+static struct bench_frame* frames;
+static unsigned int nframes, maxframes;
+
+/* -- allocator calls, counted by the __wrap_ functions below -- */
+static unsigned long bench_allocs;
+
+/* -- frames the router sent -- */
+static unsigned long sink_frames, sink_bytes;
+
+/*-----------------------------------------------------------------------------
+ * Allocator wrappers, linked with -Wl,--wrap=<name>
+ *---------------------------------------------------------------------------*/
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+int   __real_posix_memalign(void** p, size_t align, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* p, size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(p, size);
+}
+
+int __wrap_posix_memalign(void** p, size_t align, size_t size)
+{
+    __atomic_fetch_add(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __real_posix_memalign(p, align, size);
+}
+
+/*-----------------------------------------------------------------------------
+ * The sr_vns_comm.c transmit API, sending to nowhere
+ *---------------------------------------------------------------------------*/
+
+static int sink(struct sr_if* iface, unsigned int len)
+{
+    if(len < sizeof(struct sr_ethernet_hdr) || !iface)
+    { return -1; }
+
+    sr_stats_tx(iface->idx, len);
+    __atomic_fetch_add(&sink_frames, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sink_bytes, len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   struct sr_if* iface)
+{ return sink(iface, len); }
+
+int sr_send_packet_inplace(struct sr_instance* sr, uint8_t* buf,
+                           unsigned int len, struct sr_if* iface)
+{ return sink(iface, len); }
+
+int sr_send_pktbuf(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   struct sr_if* iface)
+{ return sink(iface, len); }
+
+int sr_flush_packets(struct sr_instance* sr)
+{ return 0; }
+
+int sr_txbatch_init(struct sr_txbatch* tx)
+{
+    memset(tx, 0, sizeof(struct sr_txbatch));
+    return 0;
+}
+
+void sr_txbatch_free(struct sr_txbatch* tx)
+{ }
+
+void sr_tx_bind(struct sr_txbatch* tx)
+{ }
+
+/*-----------------------------------------------------------------------------
+ * Setup
+ *---------------------------------------------------------------------------*/
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* made-up, locally administered MAC for a neighbour */
+static void neighbour_mac(uint32_t ip, unsigned char mac[ETHER_ADDR_LEN])
+{
+    mac[0] = 0x02;
+    mac[1] = 0xbe;
+    memcpy(mac + 2, &ip, 4);
+}
+
+/* Router interfaces are the sw0-<name> lines of IP_CONFIG. */
+static int load_interfaces(struct sr_instance* sr, const char* path)
+{
+    FILE* fp;
+    char line[256], name[64], ip[64];
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct in_addr addr;
+    int n = 0;
+
+    if((fp = fopen(path, "r")) == 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, "%63s %63s", name, ip) != 2 ||
+           strncmp(name, "sw0-", 4) != 0 || inet_aton(ip, &addr) == 0)
+        { continue; }
+
+        memset(mac, 0, sizeof(mac));
+        mac[0] = 0x02;
+        mac[5] = (unsigned char)(n + 1);
+
+        sr_add_interface(sr, name + 4);
+        sr_set_ether_addr(sr, mac);
+        sr_set_ether_ip(sr, addr.s_addr);
+        n++;
+    }
+    fclose(fp);
+
+    if(n == 0)
+    {
+        fprintf(stderr, "%s: no sw0-* interfaces\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t rd32(const uint8_t* p, int swap)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t rd16(const uint8_t* p, int swap)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return swap ? (uint16_t)(v << 8 | v >> 8) : v;
+}
+
+/* The interface of the route back to whoever sent the frame. */
+static struct sr_if* guess_iface(struct sr_instance* sr, const uint8_t* f,
+                                 unsigned int len)
+{
+    const struct sr_ethernet_hdr* e_hdr = (const struct sr_ethernet_hdr*)f;
+    const uint8_t* l3 = f + sizeof(struct sr_ethernet_hdr);
+    struct sr_if* iface = 0;
+
+    if(e_hdr->ether_type == htons(ethertype_ip) &&
+       len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr))
+    { iface = longestPrefixMatch(sr, ((const struct sr_ip_hdr*)l3)->ip_src); }
+    else if(e_hdr->ether_type == htons(ethertype_arp) &&
+            len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr))
+    { iface = longestPrefixMatch(sr, ((const struct sr_arp_hdr*)l3)->ar_sip); }
+
+    return iface ? iface : sr->if_list;
+}
+
+static int add_frame(struct sr_instance* sr, const uint8_t* f,
+                     unsigned int len, struct sr_if* iface)
+{
+    struct bench_frame* more;
+
+    if(len < sizeof(struct sr_ethernet_hdr) || len > SR_PKTBUF_SZ)
+    { return 0; }
+
+    if(nframes == maxframes)
+    {
+        maxframes = maxframes ? 2 * maxframes : 1024;
+        more = (struct bench_frame*)realloc(frames,
+                                            maxframes * sizeof(struct bench_frame));
+        if(!more)
+        { return -1; }
+        frames = more;
+    }
+
+    frames[nframes].data = f;
+    frames[nframes].len = len;
+    frames[nframes].iface = iface ? iface : guess_iface(sr, f, len);
+    nframes++;
+    return 0;
+}
+
+static int parse_pcap(struct sr_instance* sr, const uint8_t* p, size_t n)
+{
+    size_t off = 24;
+    uint32_t magic = rd32(p, 0);
+    int swap = (magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+                magic == __builtin_bswap32(PCAP_MAGIC_NS));
+    unsigned int caplen, len;
+
+    if(rd32(p + 20, swap) != PCAP_LINKTYPE_ETH)
+    {
+        fprintf(stderr, "not an ethernet capture\n");
+        return -1;
+    }
+
+    while(off + 16 <= n)
+    {
+        caplen = rd32(p + off + 8, swap);
+        len = rd32(p + off + 12, swap);
+        off += 16;
+        if(caplen > n - off)
+        { break; }
+        if(caplen == len && add_frame(sr, p + off, caplen, 0) != 0)
+        { return -1; }
+        off += caplen;
+    }
+    return 0;
+}
+
+static int parse_pcapng(struct sr_instance* sr, const uint8_t* p, size_t n)
+{
+    struct sr_if* ifs[PCAPNG_MAX_IFS];
+    unsigned int nifs = 0;
+    size_t off = 0, o, end;
+    uint32_t type, blen, caplen, len, flags;
+    uint16_t code, olen;
+    char name[sr_IFACE_NAMELEN + 1];
+    int swap = 0;
+
+    while(off + 12 <= n)
+    {
+        type = rd32(p + off, swap);
+        if(type == PCAPNG_SHB)
+        {
+            /* -- every section has its own byte order and interfaces -- */
+            swap = rd32(p + off + 8, 0) != PCAPNG_BOM;
+            nifs = 0;
+        }
+        blen = rd32(p + off + 4, swap);
+        if(blen < 12 || blen % 4 || blen > n - off)
+        { break; }
+        end = off + blen - 4;
+
+        if(type == PCAPNG_IDB && nifs < PCAPNG_MAX_IFS)
+        {
+            ifs[nifs] = 0;
+            for(o = off + 16; o + 4 <= end; o += 4 + ((olen + 3) & ~3u))
+            {
+                code = rd16(p + o, swap);
+                olen = rd16(p + o + 2, swap);
+                if(code == 0 || o + 4 + olen > end)
+                { break; }
+                if(code == 2)   /* if_name */
+                {
+                    memset(name, 0, sizeof(name));
+                    memcpy(name, p + o + 4, olen < sr_IFACE_NAMELEN ? olen : sr_IFACE_NAMELEN);
+                    ifs[nifs] = sr_get_interface(sr, name);
+                }
+            }
+            nifs++;
+        }
+        else if(type == PCAPNG_EPB && off + 28 <= end)
+        {
+            caplen = rd32(p + off + 20, swap);
+            len = rd32(p + off + 24, swap);
+            flags = 0;
+            if(caplen <= end - off - 28)
+            {
+                for(o = off + 28 + ((caplen + 3) & ~3u); o + 4 <= end;
+                    o += 4 + ((olen + 3) & ~3u))
+                {
+                    code = rd16(p + o, swap);
+                    olen = rd16(p + o + 2, swap);
+                    if(code == 0 || o + 4 + olen > end)
+                    { break; }
+                    if(code == 2 && olen == 4)  /* epb_flags */
+                    { flags = rd32(p + o + 4, swap); }
+                }
+
+                /* -- direction 2 is outbound, the router's own frames -- */
+                if(caplen == len && (flags & 3) != 2 &&
+                   add_frame(sr, p + off + 28, caplen,
+                             rd32(p + off + 8, swap) < nifs ?
+                             ifs[rd32(p + off + 8, swap)] : 0) != 0)
+                { return -1; }
+            }
+        }
+        else if(type == PCAPNG_SPB && off + 12 <= end)
+        {
+            len = rd32(p + off + 8, swap);
+            if(len <= end - off - 12 &&
+               add_frame(sr, p + off + 12, len, nifs ? ifs[0] : 0) != 0)
+            { return -1; }
+        }
+
+        off += blen;
+    }
+    return 0;
+}
+
+static uint8_t* load_capture(struct sr_instance* sr, const char* path)
+{
+    FILE* fp;
+    uint8_t* p;
+    long n;
+    uint32_t magic;
+    int rc = -1;
+
+    if((fp = fopen(path, "rb")) == 0)
+    {
+        perror(path);
+        return 0;
+    }
+    fseek(fp, 0, SEEK_END);
+    n = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    p = (uint8_t*)malloc(n > 0 ? n : 1);
+    if(!p || n < 24 || fread(p, 1, n, fp) != (size_t)n)
+    {
+        fprintf(stderr, "%s: cannot read capture\n", path);
+        fclose(fp);
+        free(p);
+        return 0;
+    }
+    fclose(fp);
+
+    magic = rd32(p, 0);
+    if(magic == PCAPNG_SHB)
+    { rc = parse_pcapng(sr, p, n); }
+    else if(magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS ||
+            magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+            magic == __builtin_bswap32(PCAP_MAGIC_NS))
+    { rc = parse_pcap(sr, p, n); }
+    else
+    { fprintf(stderr, "%s: not a pcap or pcapng file\n", path); }
+
+    if(rc != 0 || nframes == 0)
+    {
+        if(rc == 0)
+        { fprintf(stderr, "%s: no frames to replay\n", path); }
+        free(p);
+        return 0;
+    }
+    return p;
+}
+
+static void seed_arp(struct sr_instance* sr, uint32_t ip)
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct sr_arpreq* req;
+
+    neighbour_mac(ip, mac);
+    if((req = sr_arpcache_insert(&(sr->cache), mac, ip)) != 0)
+    { sr_arpreq_destroy(&(sr->cache), req); }
+}
+
+/* Next hops and the destinations in the capture, unless they are ours. */
+static void seed_arp_all(struct sr_instance* sr)
+{
+    const struct sr_ip_hdr* ip_hdr;
+    struct sr_rt* rt;
+    struct sr_if* iface;
+    unsigned int i;
+
+    for(rt = sr->routing_table; rt; rt = rt->next)
+    { seed_arp(sr, rt->gw.s_addr); }
+
+    for(i = 0; i < nframes; i++)
+    {
+        if(frames[i].len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) ||
+           ((const struct sr_ethernet_hdr*)frames[i].data)->ether_type !=
+           htons(ethertype_ip))
+        { continue; }
+        ip_hdr = (const struct sr_ip_hdr*)(frames[i].data +
+                                           sizeof(struct sr_ethernet_hdr));
+        for(iface = sr->if_list; iface; iface = iface->next)
+        {
+            if(iface->ip == ip_hdr->ip_dst)
+            { break; }
+        }
+        if(!iface)
+        { seed_arp(sr, ip_hdr->ip_dst); }
+    }
+}
+
+/* Replay every frame once, the way sr_read_from_server hands them over. */
+static void replay(struct sr_instance* sr, uint8_t* rxbuf)
+{
+    uint8_t* buf = rxbuf + SR_PKT_HEADROOM;
+    unsigned int i;
+    sr_lat_t t = 0;
+
+    for(i = 0; i < nframes; i++)
+    {
+        memcpy(buf, frames[i].data, frames[i].len);
+        sr_stats_rx(frames[i].iface->idx, frames[i].len);
+        SR_LAT_BEGIN(t);
+        sr_handlepacket(sr, buf, frames[i].len, frames[i].iface);
+        SR_LAT_END(SR_LAT_HANDLE, t);
+    }
+    sr_flush_packets(sr);
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s -f capture [-r rtable] [-i IP_CONFIG] "
+            "[-n passes] [-a] [-N] [-P]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    struct sr_instance sr;
+    struct sr_stats st0, st1;
+    struct sr_rt* rt;
+    char* capture = 0;
+    char* rtable = DEFAULT_RTABLE;
+    char* ipconfig = DEFAULT_IPCONFIG;
+    unsigned int passes = 0, i;
+    int seed = 1, nat = 0, latency = 0, c;
+    unsigned long allocs, sent, frames_run, drops;
+    uint8_t* file;
+    uint8_t* rxbuf;
+    double t0, secs;
+
+    while((c = getopt(argc, argv, "hf:r:i:n:aNP")) != -1)
+    {
+        switch(c)
+        {
+            case 'f': capture = optarg; break;
+            case 'r': rtable = optarg; break;
+            case 'i': ipconfig = optarg; break;
+            case 'n': passes = atoi(optarg); break;
+            case 'a': seed = 0; break;
+            case 'N': nat = 1; break;
+            case 'P': latency = 1; break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if(!capture)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sr_cksum_init();
+    if(sr_log_start() != 0)
+    {
+        fprintf(stderr, "Error starting the log thread\n");
+        return 1;
+    }
+
+    /* -- what sr_main does, less the server -- */
+    memset(&sr, 0, sizeof(sr));
+    sr.sockfd = -1;
+    pthread_mutex_init(&(sr.tx_wlock), 0);
+    pthread_mutex_init(&(sr.rt_lock), 0);
+    sr.arpcache_size = SR_ARPCACHE_SZ;
+
+    if(load_interfaces(&sr, ipconfig) != 0)
+    { return 1; }
+    if(sr_load_rt(&sr, rtable) != 0)
+    {
+        fprintf(stderr, "Error setting up routing table from file %s\n", rtable);
+        return 1;
+    }
+    sr_rt_resolve_interfaces(&sr);
+    for(rt = sr.routing_table; rt; rt = rt->next)
+    {
+        if(!rt->ifp)
+        {
+            fprintf(stderr, "Routing table not consistent with %s\n", ipconfig);
+            return 1;
+        }
+    }
+    sr_init(&sr);
+
+    if(nat)
+    {
+        sr.nat_enabled = 1;
+        sr.nat.ICMP_timeout = 60;
+        sr.nat.TCP_established_timeout = 7440;
+        sr.nat.TCP_transitory_timeout = 300;
+        if(sr_nat_init(&(sr.nat)) != 0)
+        {
+            fprintf(stderr, "Error setting up NAT\n");
+            return 1;
+        }
+    }
+
+    if((file = load_capture(&sr, capture)) == 0)
+    { return 1; }
+    if(passes == 0)
+    { passes = nframes < DEFAULT_FRAMES ? DEFAULT_FRAMES / nframes : 1; }
+
+    rxbuf = (uint8_t*)malloc(SR_PKT_HEADROOM + SR_PKTBUF_SZ);
+    if(!rxbuf)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* -- warm up, then time the same thing passes times -- */
+    if(seed)
+    { seed_arp_all(&sr); }
+    replay(&sr, rxbuf);
+
+    if(latency && sr_lat_init() != 0)
+    {
+        fprintf(stderr, "Error calibrating the latency clock\n");
+        return 1;
+    }
+
+    secs = 0;
+    allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED);
+    sent = __atomic_load_n(&sink_frames, __ATOMIC_RELAXED);
+    sr_stats_snapshot(&st0);
+    for(i = 0; i < passes; i++)
+    {
+        if(seed)
+        { seed_arp_all(&sr); }
+        t0 = now_sec();
+        replay(&sr, rxbuf);
+        secs += now_sec() - t0;
+    }
+    sr_stats_snapshot(&st1);
+    allocs = __atomic_load_n(&bench_allocs, __ATOMIC_RELAXED) - allocs;
+    sent = __atomic_load_n(&sink_frames, __ATOMIC_RELAXED) - sent;
+
+    drops = 0;
+    for(i = SR_DROP_NONE + 1; i < SR_DROP_NREASONS; i++)
+    { drops += st1.drops[i] - st0.drops[i]; }
+    frames_run = (unsigned long)nframes * passes;
+
+    printf("%u frames x %u passes in %.3f s\n", nframes, passes, secs);
+    printf("%12.0f packets/sec\n", frames_run / secs);
+    printf("%12.1f ns/packet\n", secs * 1e9 / frames_run);
+    printf("%12.3f allocations/packet\n", (double)allocs / frames_run);
+    printf("%12.3f sent/packet, %.3f dropped/packet\n",
+           (double)sent / frames_run, (double)drops / frames_run);
+    if(drops)
+    {
+        for(i = SR_DROP_NONE + 1; i < SR_DROP_NREASONS; i++)
+        {
+            if(st1.drops[i] != st0.drops[i])
+            { printf("%12lu %s\n", st1.drops[i] - st0.drops[i], sr_stats_drop_name(i)); }
+        }
+    }
+    if(latency)
+    { sr_lat_print(stdout); }
+
+    sr_log_stop();
+    free(rxbuf);
+    free(file);
+    free(frames);
+    return 0;
+} /* -- main -- */
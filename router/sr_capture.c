@@ -0,0 +1,540 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.c
+ *
+ * Description:
+ *
+ * Capture ring and pcapng writer thread, see sr_capture.h.
+ *
+ * The ring is the same multi producer, single consumer queue as the log
+ * ring (sr_log.c): a slot's seq is lap when it is free for position pos
+ * (lap being pos rounded down to a multiple of nslots), lap + 1 once the
+ * block for pos is in it and lap + nslots once the writer has copied it
+ * out.  Producers build complete pcapng blocks, so all the writer does is
+ * copy them into the file.
+ *
+ * Blocks are written in host byte order, which the section header's
+ * byte order magic tells readers about.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "sr_capture.h"
+
+#define PCAPNG_SHB          0x0A0D0D0A  /* section header block */
+#define PCAPNG_IDB          0x00000001  /* interface description block */
+#define PCAPNG_EPB          0x00000006  /* enhanced packet block */
+#define PCAPNG_BOM          0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETH 1
+
+#define PCAPNG_OPT_END      0
+#define PCAPNG_IF_NAME      2
+#define PCAPNG_IF_TSRESOL   9
+#define PCAPNG_EPB_FLAGS    2
+
+#define PAD4(n) (((n) + 3) & ~3u)
+
+#define SR_CAP_SHB_LEN   28
+#define SR_CAP_EPB_LEN   44     /* without the frame */
+#define SR_CAP_IDB_MAX   (20 + 4 + PAD4(32) + 8 + 4 + 4)
+#define SR_CAP_STDOUT_SZ (1024 * 1024)
+
+struct sr_cap_slot
+{
+    unsigned int seq;
+    unsigned int len;           /* bytes of the block that follows */
+};
+
+struct sr_capture
+{
+    unsigned char* ring;
+    unsigned int nslots;        /* power of 2 */
+    unsigned int stride;        /* bytes per slot */
+    unsigned int snaplen;
+    unsigned int tail;          /* next position to claim */
+    unsigned long drops;        /* ring full */
+
+    /* -- writer thread only -- */
+    unsigned int head;
+    int fd;
+    char* fname;
+    unsigned int nfiles;        /* files opened so far */
+    unsigned char* map;         /* the file, or a buffer for stdout */
+    size_t mapsz;
+    size_t used;
+    size_t hdrlen;              /* section and interface blocks */
+    time_t opened;
+    unsigned long rotate_bytes;
+    unsigned int rotate_secs;
+    unsigned char idb[SR_CAP_MAX_IFS][SR_CAP_IDB_MAX]; /* for each new file */
+    unsigned int idblen[SR_CAP_MAX_IFS];
+    unsigned int nifs;
+
+    int stopping;
+    pthread_t thread;
+};
+
+#define cap_slot(cap, pos) \
+    ((struct sr_cap_slot*)((cap)->ring + \
+                           ((pos) & ((cap)->nslots - 1)) * (cap)->stride))
+
+static void put16(unsigned char* p, uint16_t v) { memcpy(p, &v, 2); }
+static void put32(unsigned char* p, uint32_t v) { memcpy(p, &v, 4); }
+
+/* write() all of buf, retrying after partial writes */
+static int cap_write(int fd, const unsigned char* buf, size_t len)
+{
+    ssize_t w;
+
+    while (len > 0)
+    {
+        w = write(fd, buf, len);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            return -1;
+        }
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+/* Size the file to mapsz and map it */
+static int cap_map(struct sr_capture* cap)
+{
+    if (ftruncate(cap->fd, cap->mapsz) != 0)
+    { return -1; }
+    cap->map = (unsigned char*)mmap(0, cap->mapsz, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, cap->fd, 0);
+    if (cap->map == MAP_FAILED)
+    {
+        cap->map = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/* Finish the current file: cut it to what was written.  For stdout,
+   write out the buffer. */
+static void cap_close_file(struct sr_capture* cap)
+{
+    if (cap->fd == 1)
+    {
+        if (cap->map && cap_write(1, cap->map, cap->used) != 0)
+        { perror("sr_capture: write"); }
+        cap->used = 0;
+        return;
+    }
+
+    if (cap->map)
+    { munmap(cap->map, cap->mapsz); }
+    if (cap->fd >= 0)
+    {
+        if (ftruncate(cap->fd, cap->used) != 0)
+        { perror("sr_capture: ftruncate"); }
+        close(cap->fd);
+    }
+    cap->map = 0;
+    cap->fd = -1;
+}
+
+static int cap_put(struct sr_capture* cap, const unsigned char* block,
+                   unsigned int len);
+
+/* Start the next file of the capture: section header, then interfaces */
+static int cap_open_file(struct sr_capture* cap)
+{
+    unsigned char shb[SR_CAP_SHB_LEN];
+    char* name;
+    unsigned int i;
+
+    if (strcmp(cap->fname, "-") == 0)
+    {
+        cap->fd = 1;
+        cap->mapsz = SR_CAP_STDOUT_SZ;
+        cap->map = (unsigned char*)malloc(cap->mapsz);
+        if (!cap->map)
+        { return -1; }
+    }
+    else
+    {
+        name = (char*)malloc(strlen(cap->fname) + 16);
+        if (!name)
+        { return -1; }
+        if (cap->nfiles == 0)
+        { strcpy(name, cap->fname); }
+        else
+        { sprintf(name, "%s.%u", cap->fname, cap->nfiles); }
+
+        cap->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (cap->fd < 0)
+        {
+            fprintf(stderr, "sr_capture: can't open %s\n", name);
+            free(name);
+            return -1;
+        }
+        free(name);
+
+        cap->mapsz = cap->rotate_bytes ? cap->rotate_bytes : SR_CAP_FILE_SZ;
+        if (cap->mapsz < 64 * 1024)
+        { cap->mapsz = 64 * 1024; }
+        if (cap_map(cap) != 0)
+        {
+            perror("sr_capture: mmap");
+            close(cap->fd);
+            cap->fd = -1;
+            return -1;
+        }
+    }
+    cap->nfiles++;
+    cap->used = 0;
+    cap->hdrlen = (size_t)-1;   /* grow rather than rotate while in here */
+    cap->opened = time(0);
+
+    put32(shb + 0, PCAPNG_SHB);
+    put32(shb + 4, SR_CAP_SHB_LEN);
+    put32(shb + 8, PCAPNG_BOM);
+    put16(shb + 12, 1);                 /* version 1.0 */
+    put16(shb + 14, 0);
+    put32(shb + 16, 0xffffffff);        /* section length unknown */
+    put32(shb + 20, 0xffffffff);
+    put32(shb + 24, SR_CAP_SHB_LEN);
+    if (cap_put(cap, shb, SR_CAP_SHB_LEN) != 0)
+    { return -1; }
+
+    for (i = 0; i < cap->nifs; i++)
+    {
+        if (cap_put(cap, cap->idb[i], cap->idblen[i]) != 0)
+        { return -1; }
+    }
+
+    cap->hdrlen = cap->used;
+    return 0;
+}
+
+/* Make room for len more bytes: flush stdout, or rotate, or map more */
+static unsigned char* cap_reserve(struct sr_capture* cap, unsigned int len)
+{
+    if (!cap->map)
+    { return 0; }
+    if (cap->used + len <= cap->mapsz)
+    { return cap->map + cap->used; }
+
+    if (cap->fd == 1)
+    {
+        cap_close_file(cap);
+    }
+    else if (cap->rotate_bytes && cap->used > cap->hdrlen)
+    {
+        cap_close_file(cap);
+        if (cap_open_file(cap) != 0)
+        { return 0; }
+    }
+    else
+    {
+        munmap(cap->map, cap->mapsz);
+        cap->mapsz += SR_CAP_FILE_SZ;
+        if (cap_map(cap) != 0)
+        {
+            perror("sr_capture: mmap");
+            return 0;
+        }
+    }
+
+    return cap->used + len <= cap->mapsz ? cap->map + cap->used : 0;
+}
+
+static int cap_put(struct sr_capture* cap, const unsigned char* block,
+                   unsigned int len)
+{
+    unsigned char* p = cap_reserve(cap, len);
+
+    if (!p)
+    { return -1; }
+    memcpy(p, block, len);
+    cap->used += len;
+    return 0;
+}
+
+static void cap_write_block(struct sr_capture* cap, const unsigned char* block,
+                            unsigned int len)
+{
+    uint32_t type;
+
+    memcpy(&type, block, 4);
+    if (type == PCAPNG_IDB && cap->nifs < SR_CAP_MAX_IFS)
+    {
+        /* -- remembered, to describe the interfaces again after rotating -- */
+        memcpy(cap->idb[cap->nifs], block, len);
+        cap->idblen[cap->nifs] = len;
+        cap->nifs++;
+    }
+
+    cap_put(cap, block, len);
+}
+
+static void* cap_main(void* arg)
+{
+    struct sr_capture* cap = (struct sr_capture*)arg;
+    struct sr_cap_slot* slot;
+    struct timespec idle;
+    unsigned int lap;
+    int n, stopping;
+
+    idle.tv_sec = 0;
+    idle.tv_nsec = 1000 * 1000;
+
+    for (;;)
+    {
+        stopping = __atomic_load_n(&(cap->stopping), __ATOMIC_ACQUIRE);
+
+        /* -- copy out a run of finished blocks, freeing each slot -- */
+        for (n = 0; ; n++, cap->head++)
+        {
+            slot = cap_slot(cap, cap->head);
+            lap = cap->head & ~(cap->nslots - 1);
+            if (__atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE) != lap + 1)
+            { break; }
+
+            cap_write_block(cap, (unsigned char*)(slot + 1), slot->len);
+            __atomic_store_n(&(slot->seq), lap + cap->nslots, __ATOMIC_RELEASE);
+        }
+
+        if (n > 0)
+        {
+            if (cap->rotate_secs && cap->fd > 1 && cap->used > cap->hdrlen &&
+                time(0) - cap->opened >= (time_t)cap->rotate_secs)
+            {
+                cap_close_file(cap);
+                cap_open_file(cap);
+            }
+            continue;
+        }
+
+        if (stopping)
+        { break; }
+        if (cap->fd == 1 && cap->used > 0)
+        { cap_close_file(cap); }    /* flushes stdout */
+        nanosleep(&idle, 0);
+    }
+
+    return 0;
+}
+
+/* Claim the next slot of the ring, or return 0 if it is full */
+static struct sr_cap_slot* cap_claim(struct sr_capture* cap, unsigned int* lap)
+{
+    struct sr_cap_slot* slot;
+    unsigned int pos, seq;
+
+    pos = __atomic_load_n(&(cap->tail), __ATOMIC_RELAXED);
+    for (;;)
+    {
+        slot = cap_slot(cap, pos);
+        *lap = pos & ~(cap->nslots - 1);
+        seq = __atomic_load_n(&(slot->seq), __ATOMIC_ACQUIRE);
+        if ((int)(seq - *lap) == 0)
+        {
+            if (__atomic_compare_exchange_n(&(cap->tail), &pos, pos + 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { return slot; }
+        }
+        else if ((int)(seq - *lap) < 0)
+        {
+            /* -- full, the writer is a lap behind -- */
+            __atomic_fetch_add(&(cap->drops), 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        else
+        {
+            pos = __atomic_load_n(&(cap->tail), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope:  Global
+ *
+ * Create fname (or use stdout for "-") and start the writer thread.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_capture* sr_capture_open(const char* fname, unsigned int snaplen,
+                                   unsigned long rotate_bytes,
+                                   unsigned int rotate_secs)
+{
+    struct sr_capture* cap;
+    unsigned int want;
+
+    cap = (struct sr_capture*)calloc(1, sizeof(struct sr_capture));
+    if (!cap)
+    { return 0; }
+
+    cap->snaplen = snaplen < SR_CAP_SNAP_MAX ? snaplen : SR_CAP_SNAP_MAX;
+    cap->stride = sizeof(struct sr_cap_slot) + SR_CAP_EPB_LEN + PAD4(cap->snaplen);
+    if (cap->stride < sizeof(struct sr_cap_slot) + SR_CAP_IDB_MAX)
+    { cap->stride = sizeof(struct sr_cap_slot) + SR_CAP_IDB_MAX; }
+    cap->stride = (cap->stride + 7) & ~7u;
+    want = SR_CAP_RING_BYTES / cap->stride;
+    for (cap->nslots = 64; cap->nslots * 2 <= want; cap->nslots *= 2);
+    cap->rotate_bytes = rotate_bytes;
+    cap->rotate_secs = rotate_secs;
+    cap->fd = -1;
+
+    cap->ring = (unsigned char*)calloc(cap->nslots, cap->stride);
+    cap->fname = (char*)malloc(strlen(fname) + 1);
+    if (!cap->ring || !cap->fname)
+    { goto fail; }
+    strcpy(cap->fname, fname);
+
+    if (cap_open_file(cap) != 0)
+    { goto fail; }
+
+    if (pthread_create(&(cap->thread), 0, cap_main, cap) != 0)
+    { goto fail; }
+
+    return cap;
+
+fail:
+    if (cap->fd == 1)
+    { free(cap->map); }
+    else
+    { cap_close_file(cap); }
+    free(cap->ring);
+    free(cap->fname);
+    free(cap);
+    return 0;
+} /* -- sr_capture_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_add_interface(..)
+ * Scope:  Global
+ *
+ * Describe interface idx to the capture.  Interfaces must be added in
+ * order of idx, from 0, before any of their frames are captured.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_capture_add_interface(struct sr_capture* cap, unsigned int idx,
+                             const char* name)
+{
+    struct sr_cap_slot* slot;
+    unsigned char* b;
+    unsigned int lap, nlen, o;
+
+    if (idx >= SR_CAP_MAX_IFS || (slot = cap_claim(cap, &lap)) == 0)
+    { return -1; }
+
+    nlen = strlen(name);
+    if (nlen > 32)
+    { nlen = 32; }
+
+    b = (unsigned char*)(slot + 1);
+    memset(b, 0, SR_CAP_IDB_MAX);
+    put32(b + 0, PCAPNG_IDB);
+    put16(b + 8, PCAPNG_LINKTYPE_ETH);
+    put32(b + 12, cap->snaplen);
+    o = 16;
+    put16(b + o, PCAPNG_IF_NAME);
+    put16(b + o + 2, nlen);
+    memcpy(b + o + 4, name, nlen);
+    o += 4 + PAD4(nlen);
+    put16(b + o, PCAPNG_IF_TSRESOL);
+    put16(b + o + 2, 1);
+    b[o + 4] = 9;                       /* 10^-9 s */
+    o += 8;
+    put32(b + o, PCAPNG_OPT_END);
+    o += 4;
+    put32(b + o, o + 4);
+    put32(b + 4, o + 4);
+
+    slot->len = o + 4;
+    __atomic_store_n(&(slot->seq), lap + 1, __ATOMIC_RELEASE);
+    return 0;
+} /* -- sr_capture_add_interface -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope:  Global
+ *
+ * Queue a frame sent or received (dir) on interface ifidx for the
+ * capture.  Safe to call from any thread.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, unsigned int ifidx, int dir)
+{
+    struct sr_cap_slot* slot;
+    struct timespec ts;
+    unsigned char* b;
+    unsigned int lap, caplen, blen, o;
+    uint64_t ns;
+
+    if ((slot = cap_claim(cap, &lap)) == 0)
+    { return; }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    caplen = len < cap->snaplen ? len : cap->snaplen;
+    blen = SR_CAP_EPB_LEN + PAD4(caplen);
+
+    b = (unsigned char*)(slot + 1);
+    put32(b + 0, PCAPNG_EPB);
+    put32(b + 4, blen);
+    put32(b + 8, ifidx);
+    put32(b + 12, (uint32_t)(ns >> 32));
+    put32(b + 16, (uint32_t)ns);
+    put32(b + 20, caplen);
+    put32(b + 24, len);
+    memcpy(b + 28, buf, caplen);
+    memset(b + 28 + caplen, 0, PAD4(caplen) - caplen);
+    o = 28 + PAD4(caplen);
+    put16(b + o, PCAPNG_EPB_FLAGS);
+    put16(b + o + 2, 4);
+    put32(b + o + 4, dir);
+    put32(b + o + 8, PCAPNG_OPT_END);
+    put32(b + o + 12, blen);
+
+    slot->len = blen;
+    __atomic_store_n(&(slot->seq), lap + 1, __ATOMIC_RELEASE);
+} /* -- sr_capture_packet -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope:  Global
+ *
+ * Write out what is queued, stop the writer and close the file.  No
+ * thread may be capturing any more.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_capture* cap)
+{
+    if (!cap)
+    { return; }
+
+    __atomic_store_n(&(cap->stopping), 1, __ATOMIC_RELEASE);
+    pthread_join(cap->thread, 0);
+
+    if (cap->drops)
+    { fprintf(stderr, "capture ring full, %lu frames not logged\n", cap->drops); }
+
+    cap_close_file(cap);
+    if (cap->fd == 1)
+    { free(cap->map); }
+    free(cap->ring);
+    free(cap->fname);
+    free(cap);
+} /* -- sr_capture_close -- */
@@ -0,0 +1,58 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_capture.h
+ *
+ * Description:
+ *
+ * Asynchronous pcapng writer behind -l.  The thread that sends or receives
+ * a frame only builds its Enhanced Packet Block (up to snaplen bytes of
+ * frame, nanosecond timestamp, interface and direction) in a slot of a
+ * lock-free ring; a writer thread copies runs of finished blocks into the
+ * capture file, which is mmap'd and sized ahead.  If the writer falls a
+ * whole ring behind, frames are dropped from the capture, and counted,
+ * rather than slowing down forwarding.
+ *
+ * Each interface gets an Interface Description Block when it is added
+ * (sr_add_interface); its sr_if.idx is the interface ID in the blocks of
+ * its frames.
+ *
+ * The capture can be rotated once a file reaches a size or age: the
+ * first file has the name given, the following ones get .1, .2, ...
+ * appended and start again with the section header and interface blocks.
+ * A capture to "-", stdout, is written through a buffer, not mmap'd, and
+ * never rotated.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_CAP_RING_BYTES (16 * 1024 * 1024) /* sizes the ring for snaplen */
+#define SR_CAP_SNAP_MAX   9018  /* a jumbo frame; caps snaplen so the ring
+                                   never gets too few slots */
+#define SR_CAP_FILE_SZ    (64 * 1024 * 1024) /* file size mapped at a time */
+#define SR_CAP_MAX_IFS    64
+
+#define SR_CAP_IN  1            /* epb_flags direction */
+#define SR_CAP_OUT 2
+
+struct sr_capture;
+
+/* rotate_bytes and rotate_secs of 0 mean never rotate on that account */
+struct sr_capture* sr_capture_open(const char* fname, unsigned int snaplen,
+                                   unsigned long rotate_bytes,
+                                   unsigned int rotate_secs);
+int  sr_capture_add_interface(struct sr_capture* cap, unsigned int idx,
+                              const char* name);
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, unsigned int ifidx, int dir);
+void sr_capture_close(struct sr_capture* cap);
+
+#endif /* -- SR_CAPTURE_H -- */
@@ -0,0 +1,187 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum.c
+ *
+ * Description:
+ *
+ * Internet checksum kernels and their runtime selection, see sr_cksum.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "sr_cksum.h"
+
+#ifdef SR_CKSUM_X86
+#include <immintrin.h>
+#endif
+
+sr_cksum_fn sr_cksum_impl = sr_cksum_scalar;
+
+/*---------------------------------------------------------------------
+ * Method: sr_cksum_scalar(..)
+ * Scope:  Global
+ *
+ * One big endian 16-bit word per iteration.  This is the reference the
+ * other kernels must agree with.
+ *
+ *---------------------------------------------------------------------*/
+
+uint16_t sr_cksum_scalar(const void* _data, int len)
+{
+    const uint8_t* data = _data;
+    uint32_t sum;
+
+    for (sum = 0; len >= 2; data += 2, len -= 2)
+    { sum += data[0] << 8 | data[1]; }
+    if (len > 0)
+    { sum += data[0] << 8; }
+    while (sum > 0xffff)
+    { sum = (sum >> 16) + (sum & 0xffff); }
+    sum = htons(~sum);
+    return sum ? sum : 0xffff;
+} /* -- sr_cksum_scalar -- */
+
+#ifdef SR_CKSUM_X86
+
+/* Add in the last few bytes (p is 16-byte aligned relative to the start
+   of the data) and turn a little endian sum into what the scalar kernel
+   returns.  x86 is little endian, so htons(~swap(s)) is just ~s. */
+static uint16_t cksum_finish(uint64_t acc, const uint8_t* p, int len)
+{
+    uint32_t w32;
+    uint16_t w16;
+
+    for ( ; len >= 4; p += 4, len -= 4)
+    {
+        memcpy(&w32, p, 4);
+        acc += w32;
+    }
+    if (len >= 2)
+    {
+        memcpy(&w16, p, 2);
+        acc += w16;
+        p += 2;
+        len -= 2;
+    }
+    if (len > 0)
+    { acc += p[0]; }
+
+    acc = (acc >> 32) + (acc & 0xffffffff);
+    acc = (acc >> 32) + (acc & 0xffffffff);
+    acc = (acc >> 16) + (acc & 0xffff);
+    acc = (acc >> 16) + (acc & 0xffff);
+    acc = (acc >> 16) + (acc & 0xffff);
+
+    w16 = ~(uint16_t)acc;
+    return w16 ? w16 : 0xffff;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_cksum_sse2(..)
+ * Scope:  Global
+ *
+ * 32 bytes per iteration: each 16-byte load is split into 32-bit words
+ * and added to two pairs of 64-bit lanes, so nothing can carry out.
+ *
+ *---------------------------------------------------------------------*/
+
+__attribute__((target("sse2")))
+uint16_t sr_cksum_sse2(const void* data, int len)
+{
+    const uint8_t* p = data;
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero, acc1 = zero;
+    __m128i v;
+    uint64_t lanes[2];
+
+    for ( ; len >= 32; p += 32, len -= 32)
+    {
+        v = _mm_loadu_si128((const __m128i*)p);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        v = _mm_loadu_si128((const __m128i*)(p + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+    }
+    if (len >= 16)
+    {
+        v = _mm_loadu_si128((const __m128i*)p);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v, zero));
+        p += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    return cksum_finish(lanes[0] + lanes[1], p, len);
+} /* -- sr_cksum_sse2 -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cksum_avx2(..)
+ * Scope:  Global
+ *
+ * Same as the SSE2 kernel with 32-byte vectors, 64 bytes per iteration.
+ *
+ *---------------------------------------------------------------------*/
+
+__attribute__((target("avx2")))
+uint16_t sr_cksum_avx2(const void* data, int len)
+{
+    const uint8_t* p = data;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero;
+    __m256i v;
+    __m128i acc;
+    uint64_t lanes[2];
+
+    for ( ; len >= 64; p += 64, len -= 64)
+    {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+        v = _mm256_loadu_si256((const __m256i*)(p + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+    }
+    for ( ; len >= 32; p += 32, len -= 32)
+    {
+        v = _mm256_loadu_si256((const __m256i*)p);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+    }
+
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    acc = _mm_add_epi64(_mm256_castsi256_si128(acc0),
+                        _mm256_extracti128_si256(acc0, 1));
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return cksum_finish(lanes[0] + lanes[1], p, len);
+} /* -- sr_cksum_avx2 -- */
+
+#endif /* SR_CKSUM_X86 */
+
+/*---------------------------------------------------------------------
+ * Method: sr_cksum_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+const char* sr_cksum_init(void)
+{
+#ifdef SR_CKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        sr_cksum_impl = sr_cksum_avx2;
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        sr_cksum_impl = sr_cksum_sse2;
+        return "sse2";
+    }
+#endif
+    sr_cksum_impl = sr_cksum_scalar;
+    return "scalar";
+} /* -- sr_cksum_init -- */
@@ -0,0 +1,44 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum.h
+ *
+ * Description:
+ *
+ * Internet checksum (RFC 1071) kernels.  cksum() (sr_utils.h) calls
+ * whichever one sr_cksum_init picked for this CPU: AVX2 or SSE2 on x86,
+ * the byte at a time loop elsewhere.  All of them return exactly what the
+ * scalar one does, including 0xffff for a zero sum.
+ *
+ * The vector kernels add the data as little endian 32-bit words into
+ * 64-bit lanes and byte swap at the end; the one's complement sum does
+ * not care about word size or byte order (RFC 1071 section 2).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CKSUM_H
+#define SR_CKSUM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+typedef uint16_t (*sr_cksum_fn)(const void* data, int len);
+
+/* Pick the kernel for this CPU; call once before starting any threads.
+   Returns the name of the kernel chosen. */
+const char* sr_cksum_init(void);
+
+extern sr_cksum_fn sr_cksum_impl;
+
+uint16_t sr_cksum_scalar(const void* data, int len);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CKSUM_X86
+uint16_t sr_cksum_sse2(const void* data, int len);
+uint16_t sr_cksum_avx2(const void* data, int len);
+#endif
+
+#endif /* -- SR_CKSUM_H -- */
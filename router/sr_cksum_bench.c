@@ -0,0 +1,153 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_cksum_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmark for the checksum kernels (sr_cksum.c).  Every kernel the
+ * CPU supports is first checked against the scalar one for all lengths up
+ * to 2k at every alignment, plus all-zero and all-ones buffers, then timed
+ * over buffers from 64 to 9000 bytes.
+ *
+ *   make cksum_bench && ./cksum_bench [bytes per size]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_cksum.h"
+
+#define DEFAULT_BYTES (1u << 30)
+#define MAX_LEN       9000
+#define CHECK_LEN     2048
+
+struct kernel
+{
+    const char* name;
+    sr_cksum_fn fn;
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rng(void)
+{
+    /* xorshift64*, deterministic across runs */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check(struct kernel* k, uint8_t* buf)
+{
+    int len, off, fill;
+
+    for(len = 0; len <= CHECK_LEN; len++)
+    {
+        for(off = 0; off < 32; off++)
+        {
+            if(k->fn(buf + off, len) != sr_cksum_scalar(buf + off, len))
+            {
+                fprintf(stderr, "%s: mismatch at len %d offset %d\n",
+                        k->name, len, off);
+                return -1;
+            }
+        }
+    }
+
+    /* -- sums of 0 and 0xffff, where the folding is easiest to get wrong -- */
+    for(fill = 0; fill < 2; fill++)
+    {
+        memset(buf, fill ? 0xff : 0, MAX_LEN);
+        for(len = 0; len <= MAX_LEN; len += 1 + len / 8)
+        {
+            if(k->fn(buf, len) != sr_cksum_scalar(buf, len))
+            {
+                fprintf(stderr, "%s: mismatch on %s buffer of len %d\n",
+                        k->name, fill ? "all-ones" : "zero", len);
+                return -1;
+            }
+        }
+    }
+
+    for(len = 0; len < MAX_LEN + 64; len++)
+    { buf[len] = rng(); }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    static const int sizes[] = { 64, 128, 256, 576, 1500, 4096, 9000 };
+    struct kernel kernels[4];
+    unsigned long bytes = DEFAULT_BYTES;
+    unsigned long i, iters;
+    unsigned int sink = 0;
+    uint8_t* buf;
+    double t0, t;
+    int nk = 0, k, s;
+
+    if(argc > 1)
+    { bytes = strtoul(argv[1], 0, 0); }
+
+    buf = (uint8_t*)malloc(MAX_LEN + 64);
+    if(!buf)
+    { return 1; }
+    for(i = 0; i < MAX_LEN + 64; i++)
+    { buf[i] = rng(); }
+
+    kernels[nk].name = "scalar";
+    kernels[nk++].fn = sr_cksum_scalar;
+#ifdef SR_CKSUM_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2"))
+    {
+        kernels[nk].name = "sse2";
+        kernels[nk++].fn = sr_cksum_sse2;
+    }
+    if(__builtin_cpu_supports("avx2"))
+    {
+        kernels[nk].name = "avx2";
+        kernels[nk++].fn = sr_cksum_avx2;
+    }
+#endif
+    printf("dispatch picks %s\n", sr_cksum_init());
+
+    for(k = 1; k < nk; k++)
+    {
+        if(check(&kernels[k], buf) != 0)
+        { return 1; }
+    }
+    printf("%d kernels agree with scalar\n", nk - 1);
+
+    printf("%6s", "bytes");
+    for(k = 0; k < nk; k++)
+    { printf("  %14s", kernels[k].name); }
+    printf("   (GB/s)\n");
+
+    for(s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        iters = bytes / sizes[s];
+        printf("%6d", sizes[s]);
+        for(k = 0; k < nk; k++)
+        {
+            t0 = now_sec();
+            for(i = 0; i < iters; i++)
+            { sink += kernels[k].fn(buf + (i & 1), sizes[s]); }
+            t = now_sec() - t0;
+            printf("  %14.2f", (double)iters * sizes[s] / t / 1e9);
+        }
+        printf("\n");
+    }
+
+    free(buf);
+    return sink == 0xdeadbeef;
+}
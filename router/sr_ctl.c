@@ -0,0 +1,583 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.c
+ *
+ * Description:
+ *
+ * Control socket, see sr_ctl.h.
+ *
+ * The thread polls the listening socket, and then the client it is
+ * serving, with a short timeout so that sr_ctl_stop never waits long.
+ * Replies are built in a growing buffer and sent once complete.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_ctl.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_arpcache.h"
+#include "sr_nat.h"
+#include "sr_stats.h"
+#include "sr_lat.h"
+#include "sr_rcu.h"
+#include "sr_log.h"
+
+#define SR_CTL_POLL_MS 200
+
+struct sr_ctl
+{
+    struct sr_instance* sr;
+    int fd;
+    struct sockaddr_un addr;
+    pthread_t thread;
+    int stop;
+};
+
+/* A reply under construction */
+struct ctl_out
+{
+    char* buf;
+    size_t len;
+    size_t cap;
+    int nomem;
+};
+
+static void ctl_printf(struct ctl_out* o, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void ctl_printf(struct ctl_out* o, const char* fmt, ...)
+{
+    va_list ap;
+    char* p;
+    int n;
+
+    if (o->nomem)
+    { return; }
+
+    for (;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+        { return; }
+        if ((size_t)n < o->cap - o->len)
+        {
+            o->len += n;
+            return;
+        }
+
+        p = (char*)realloc(o->buf, 2 * o->cap + n);
+        if (!p)
+        {
+            o->nomem = 1;
+            return;
+        }
+        o->buf = p;
+        o->cap = 2 * o->cap + n;
+    }
+}
+
+/* A JSON string; names come from the server, so escape them */
+static void ctl_string(struct ctl_out* o, const char* s, size_t max)
+{
+    size_t i;
+
+    ctl_printf(o, "\"");
+    for (i = 0; i < max && s[i]; i++)
+    {
+        if (s[i] == '"' || s[i] == '\\')
+        { ctl_printf(o, "\\%c", s[i]); }
+        else if ((unsigned char)s[i] < 0x20)
+        { ctl_printf(o, "\\u%04x", (unsigned char)s[i]); }
+        else
+        { ctl_printf(o, "%c", s[i]); }
+    }
+    ctl_printf(o, "\"");
+}
+
+static void ctl_stats(struct sr_ctl* ctl, struct ctl_out* o)
+{
+    struct sr_stats st;
+    struct sr_if* iface;
+    unsigned int i;
+    int first = 1;
+
+    sr_stats_snapshot(&st);
+
+    ctl_printf(o, "{\"interfaces\": [");
+    for (iface = ctl->sr->if_list; iface; iface = iface->next)
+    {
+        if (iface->idx >= SR_STATS_IFS)
+        { continue; }
+        i = iface->idx;
+        ctl_printf(o, "%s{\"name\": ", first ? "" : ", ");
+        ctl_string(o, iface->name, sr_IFACE_NAMELEN);
+        ctl_printf(o, ", \"rx_packets\": %lu, \"rx_bytes\": %lu, "
+                   "\"tx_packets\": %lu, \"tx_bytes\": %lu}",
+                   st.rx_pkts[i], st.rx_bytes[i], st.tx_pkts[i], st.tx_bytes[i]);
+        first = 0;
+    }
+    ctl_printf(o, "], \"drops\": {");
+    for (i = SR_DROP_NONE + 1; i < SR_DROP_NREASONS; i++)
+    {
+        ctl_printf(o, "%s\"%s\": %lu", i == SR_DROP_NONE + 1 ? "" : ", ",
+                   sr_stats_drop_name(i), st.drops[i]);
+    }
+    ctl_printf(o, "}}");
+}
+
+static void ctl_routes(struct sr_ctl* ctl, struct ctl_out* o)
+{
+    struct sr_rt* rt;
+    int first = 1;
+
+    ctl_printf(o, "{\"routes\": [");
+    sr_rcu_read_lock();
+    for (rt = __atomic_load_n(&(ctl->sr->routing_table), __ATOMIC_ACQUIRE);
+         rt; rt = rt->next)
+    {
+        ctl_printf(o, "%s{\"dest\": \"" SR_IP_FMT "\", \"gw\": \"" SR_IP_FMT
+                   "\", \"mask\": \"" SR_IP_FMT "\", \"iface\": ",
+                   first ? "" : ", ", SR_IP_ARGS(rt->dest.s_addr),
+                   SR_IP_ARGS(rt->gw.s_addr), SR_IP_ARGS(rt->mask.s_addr));
+        ctl_string(o, rt->interface, sr_IFACE_NAMELEN);
+        ctl_printf(o, "}");
+        first = 0;
+    }
+    sr_rcu_read_unlock();
+    ctl_printf(o, "]}");
+}
+
+static void ctl_arp(struct sr_ctl* ctl, struct ctl_out* o)
+{
+    struct sr_arpcache* cache = &(ctl->sr->cache);
+    struct sr_arpentry* entries;
+    unsigned int i, n;
+    time_t now = time(0);
+
+    entries = (struct sr_arpentry*)malloc(cache->capacity * sizeof(struct sr_arpentry));
+    if (!entries)
+    {
+        ctl_printf(o, "{\"error\": \"out of memory\"}");
+        return;
+    }
+    n = sr_arpcache_snapshot(cache, entries, cache->capacity);
+
+    ctl_printf(o, "{\"capacity\": %u, \"hits\": %lu, \"misses\": %lu, "
+               "\"evictions\": %lu, \"arp\": [", cache->capacity,
+               __atomic_load_n(&(cache->hits), __ATOMIC_RELAXED),
+               __atomic_load_n(&(cache->misses), __ATOMIC_RELAXED),
+               __atomic_load_n(&(cache->evictions), __ATOMIC_RELAXED));
+    for (i = 0; i < n; i++)
+    {
+        ctl_printf(o, "%s{\"ip\": \"" SR_IP_FMT "\", "
+                   "\"mac\": \"%02x:%02x:%02x:%02x:%02x:%02x\", \"age\": %ld}",
+                   i ? ", " : "", SR_IP_ARGS(entries[i].ip),
+                   entries[i].mac[0], entries[i].mac[1], entries[i].mac[2],
+                   entries[i].mac[3], entries[i].mac[4], entries[i].mac[5],
+                   (long)(now - entries[i].added));
+    }
+    ctl_printf(o, "]}");
+
+    free(entries);
+}
+
+static void ctl_nat(struct sr_ctl* ctl, struct ctl_out* o)
+{
+    struct sr_nat* nat = &(ctl->sr->nat);
+    struct sr_nat_mapping* maps;
+    unsigned int i, n, max;
+    time_t now = time(0);
+
+    if (!ctl->sr->nat_enabled)
+    {
+        ctl_printf(o, "{\"error\": \"NAT is not enabled\"}");
+        return;
+    }
+
+    /* -- room for mappings added while copying; any more are left out -- */
+    max = __atomic_load_n(&(nat->count), __ATOMIC_RELAXED) + 1024;
+    maps = (struct sr_nat_mapping*)malloc(max * sizeof(struct sr_nat_mapping));
+    if (!maps)
+    {
+        ctl_printf(o, "{\"error\": \"out of memory\"}");
+        return;
+    }
+    n = sr_nat_snapshot(nat, maps, max);
+
+    ctl_printf(o, "{\"nat\": [");
+    for (i = 0; i < n; i++)
+    {
+        ctl_printf(o, "%s{\"type\": \"%s\", \"int\": \"" SR_IP_FMT "\", "
+                   "\"int_aux\": %u, \"ext\": \"" SR_IP_FMT "\", "
+                   "\"ext_aux\": %u, \"idle\": %ld}",
+                   i ? ", " : "",
+                   maps[i].type == nat_mapping_icmp ? "icmp" : "tcp",
+                   SR_IP_ARGS(maps[i].ip_int), ntohs(maps[i].aux_int),
+                   SR_IP_ARGS(maps[i].ip_ext), maps[i].aux_ext,
+                   (long)(now - maps[i].last_updated));
+    }
+    ctl_printf(o, "]}");
+
+    free(maps);
+}
+
+static void ctl_latency(struct ctl_out* o)
+{
+    struct sr_lat_hist* h;
+    int s;
+
+    if (!sr_lat_enabled)
+    {
+        ctl_printf(o, "{\"error\": \"latency is not enabled (-P)\"}");
+        return;
+    }
+
+    h = (struct sr_lat_hist*)malloc(SR_LAT_NSTAGES * sizeof(struct sr_lat_hist));
+    if (!h)
+    {
+        ctl_printf(o, "{\"error\": \"out of memory\"}");
+        return;
+    }
+    sr_lat_snapshot(h);
+
+    ctl_printf(o, "{\"latency_ns\": {");
+    for (s = 0; s < SR_LAT_NSTAGES; s++)
+    {
+        ctl_printf(o, "%s\"%s\": {\"count\": %lu, \"p50\": %.0f, "
+                   "\"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f}",
+                   s ? ", " : "", sr_lat_stage_name(s), h[s].count,
+                   sr_lat_percentile(&h[s], 50.0),
+                   sr_lat_percentile(&h[s], 99.0),
+                   sr_lat_percentile(&h[s], 99.9),
+                   sr_lat_ns(h[s].max));
+    }
+    ctl_printf(o, "}}");
+
+    free(h);
+}
+
+/*---------------------------------------------------------------------
+ * Method: ctl_command(..)
+ * Scope:  Local
+ *
+ * Run one command line and put its reply in o.
+ *
+ *---------------------------------------------------------------------*/
+
+static void ctl_command(struct sr_ctl* ctl, char* line, struct ctl_out* o)
+{
+    char w[6][32];
+    struct in_addr dest, gw, mask;
+    int n, rc;
+
+    n = sscanf(line, "%31s %31s %31s %31s %31s %31s",
+               w[0], w[1], w[2], w[3], w[4], w[5]);
+
+    if (n == 1 && !strcmp(w[0], "stats"))
+    { ctl_stats(ctl, o); }
+    else if (n == 1 && !strcmp(w[0], "latency"))
+    { ctl_latency(o); }
+    else if (n == 1 && !strcmp(w[0], "routes"))
+    { ctl_routes(ctl, o); }
+    else if (n == 1 && !strcmp(w[0], "arp"))
+    { ctl_arp(ctl, o); }
+    else if (n == 1 && !strcmp(w[0], "nat"))
+    { ctl_nat(ctl, o); }
+    else if (n == 6 && !strcmp(w[0], "route") && !strcmp(w[1], "add"))
+    {
+        if (!inet_aton(w[2], &dest) || !inet_aton(w[3], &gw) ||
+            !inet_aton(w[4], &mask))
+        { ctl_printf(o, "{\"error\": \"bad address\"}"); }
+        else if (sr_get_interface(ctl->sr, w[5]) == 0)
+        { ctl_printf(o, "{\"error\": \"no such interface\"}"); }
+        else if (sr_rt_add(ctl->sr, dest, gw, mask, w[5]) != 0)
+        { ctl_printf(o, "{\"error\": \"out of memory\"}"); }
+        else
+        {
+            sr_log(SR_LOG_INFO, "control: added route %s/%s via %s\n",
+                   w[2], w[4], w[5]);
+            ctl_printf(o, "{\"ok\": true}");
+        }
+    }
+    else if (n == 4 && !strcmp(w[0], "route") && !strcmp(w[1], "del"))
+    {
+        if (!inet_aton(w[2], &dest) || !inet_aton(w[3], &mask))
+        { ctl_printf(o, "{\"error\": \"bad address\"}"); }
+        else if ((rc = sr_rt_del(ctl->sr, dest, mask)) > 0)
+        { ctl_printf(o, "{\"error\": \"no such route\"}"); }
+        else if (rc < 0)
+        { ctl_printf(o, "{\"error\": \"out of memory\"}"); }
+        else
+        {
+            sr_log(SR_LOG_INFO, "control: removed route %s/%s\n", w[2], w[3]);
+            ctl_printf(o, "{\"ok\": true}");
+        }
+    }
+    else if (n == 2 && !strcmp(w[0], "arp") && !strcmp(w[1], "flush"))
+    {
+        ctl_printf(o, "{\"ok\": true, \"flushed\": %u}",
+                   sr_arpcache_flush(&(ctl->sr->cache)));
+    }
+    else if (n == 2 && !strcmp(w[0], "nat") && !strcmp(w[1], "flush"))
+    {
+        if (!ctl->sr->nat_enabled)
+        { ctl_printf(o, "{\"error\": \"NAT is not enabled\"}"); }
+        else
+        {
+            ctl_printf(o, "{\"ok\": true, \"flushed\": %u}",
+                       sr_nat_flush(&(ctl->sr->nat)));
+        }
+    }
+    else if (n > 0)
+    { ctl_printf(o, "{\"error\": \"unknown command\"}"); }
+}
+
+static int ctl_send(int fd, const char* buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        { continue; }
+        if (n <= 0)
+        { return -1; }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Serve one client until it hangs up or the router stops */
+static void ctl_serve(struct sr_ctl* ctl, int fd)
+{
+    char line[SR_CTL_LINE];
+    struct ctl_out o;
+    struct pollfd pfd;
+    size_t used = 0;
+    char* nl;
+    ssize_t n;
+
+    o.cap = 4096;
+    o.buf = (char*)malloc(o.cap);
+    if (!o.buf)
+    { return; }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (!__atomic_load_n(&(ctl->stop), __ATOMIC_ACQUIRE))
+    {
+        if (poll(&pfd, 1, SR_CTL_POLL_MS) <= 0)
+        { continue; }
+
+        n = recv(fd, line + used, sizeof(line) - 1 - used, 0);
+        if (n < 0 && errno == EINTR)
+        { continue; }
+        if (n <= 0)
+        { break; }
+        used += n;
+        line[used] = 0;
+
+        while ((nl = strchr(line, '\n')) != 0)
+        {
+            *nl = 0;
+            o.len = 0;
+            o.nomem = 0;
+            ctl_command(ctl, line, &o);
+            if (o.nomem)
+            {
+                o.len = 0;
+                o.nomem = 0;
+                ctl_printf(&o, "{\"error\": \"out of memory\"}");
+            }
+            if (o.len)
+            { ctl_printf(&o, "\n"); }
+            if (o.len && ctl_send(fd, o.buf, o.len) != 0)
+            {
+                free(o.buf);
+                return;
+            }
+
+            used -= nl + 1 - line;
+            memmove(line, nl + 1, used + 1);
+        }
+
+        if (used == sizeof(line) - 1)
+        {
+            /* -- no command is this long, throw it away -- */
+            used = 0;
+            if (ctl_send(fd, "{\"error\": \"line too long\"}\n", 27) != 0)
+            { break; }
+        }
+    }
+
+    free(o.buf);
+}
+
+static void* ctl_main(void* arg)
+{
+    struct sr_ctl* ctl = (struct sr_ctl*)arg;
+    struct pollfd pfd;
+    int fd;
+
+    pfd.fd = ctl->fd;
+    pfd.events = POLLIN;
+
+    while (!__atomic_load_n(&(ctl->stop), __ATOMIC_ACQUIRE))
+    {
+        if (poll(&pfd, 1, SR_CTL_POLL_MS) <= 0)
+        { continue; }
+
+        fd = accept(ctl->fd, 0, 0);
+        if (fd < 0)
+        { continue; }
+        ctl_serve(ctl, fd);
+        close(fd);
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: ctl_bind(..)
+ * Scope:  Local
+ *
+ * Bind fd to path, owner only from the start.  The socket is bound in a
+ * private (0700) directory next to path, made owner only there, and only
+ * then renamed into place, replacing whatever was at path.  Neither a
+ * chmod after binding at path nor a umask, which is shared with every
+ * other thread, would be safe.  Returns -1 with errno set on error.
+ *
+ *---------------------------------------------------------------------*/
+
+static int ctl_bind(int fd, const char* path)
+{
+    struct sockaddr_un tmp;
+    char dir[sizeof(tmp.sun_path) - 2];     /* room for "/s" */
+    const char* slash = strrchr(path, '/');
+    size_t n = slash ? (size_t)(slash - path) + 1 : 0;
+    int rc = -1, err;
+
+    if (n + strlen(".sr_ctl.XXXXXX") >= sizeof(dir))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(dir, path, n);
+    strcpy(dir + n, ".sr_ctl.XXXXXX");
+    if (!mkdtemp(dir))
+    { return -1; }
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.sun_family = AF_UNIX;
+    sprintf(tmp.sun_path, "%s/s", dir);
+
+    if (bind(fd, (struct sockaddr*)&tmp, sizeof(tmp)) == 0)
+    {
+        if (chmod(tmp.sun_path, S_IRUSR | S_IWUSR) == 0 &&
+            rename(tmp.sun_path, path) == 0)
+        { rc = 0; }
+        else
+        { unlink(tmp.sun_path); }
+    }
+
+    err = errno;
+    rmdir(dir);
+    errno = err;
+    return rc;
+} /* -- ctl_bind -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_start(..)
+ * Scope:  Global
+ *
+ * Listen on a UNIX socket at path, replacing any socket left there, and
+ * start serving it.  Returns 0 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_ctl* sr_ctl_start(struct sr_instance* sr, const char* path)
+{
+    struct sr_ctl* ctl;
+
+    if (strlen(path) >= sizeof(ctl->addr.sun_path))
+    {
+        fprintf(stderr, "Control socket path too long: %s\n", path);
+        return 0;
+    }
+
+    ctl = (struct sr_ctl*)calloc(1, sizeof(struct sr_ctl));
+    if (!ctl)
+    { return 0; }
+    ctl->sr = sr;
+    ctl->addr.sun_family = AF_UNIX;
+    strcpy(ctl->addr.sun_path, path);
+
+    ctl->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (ctl->fd < 0)
+    {
+        perror("socket");
+        free(ctl);
+        return 0;
+    }
+
+    if (ctl_bind(ctl->fd, path) != 0 ||
+        listen(ctl->fd, 4) != 0)
+    {
+        perror(path);
+        close(ctl->fd);
+        free(ctl);
+        return 0;
+    }
+
+    if (pthread_create(&(ctl->thread), 0, ctl_main, ctl) != 0)
+    {
+        close(ctl->fd);
+        unlink(path);
+        free(ctl);
+        return 0;
+    }
+
+    return ctl;
+} /* -- sr_ctl_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_stop(..)
+ * Scope:  Global
+ *
+ * Stop serving, hanging up on any client, and remove the socket.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ctl_stop(struct sr_ctl* ctl)
+{
+    if (!ctl)
+    { return; }
+
+    __atomic_store_n(&(ctl->stop), 1, __ATOMIC_RELEASE);
+    pthread_join(ctl->thread, 0);
+
+    close(ctl->fd);
+    unlink(ctl->addr.sun_path);
+    free(ctl);
+} /* -- sr_ctl_stop -- */
@@ -0,0 +1,43 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.h
+ *
+ * Description:
+ *
+ * Control socket (-c path): a UNIX domain stream socket, served by a
+ * thread of its own, for looking at and changing a running router.
+ * Clients send one command per line and get one line of JSON back:
+ *
+ *   stats                          frame, byte and drop counters
+ *   latency                        per stage latency percentiles (-P)
+ *   routes                         the routing table
+ *   arp                            the ARP cache
+ *   nat                            NAT mappings
+ *   route add DEST GW MASK IFACE   add a route, or replace the one for
+ *                                  DEST/MASK
+ *   route del DEST MASK
+ *   arp flush                      forget every IP->MAC mapping
+ *   nat flush                      drop every NAT mapping
+ *
+ * Failures come back as {"error": "..."}.  For example
+ *
+ *   echo routes | socat - UNIX-CONNECT:/tmp/sr.ctl
+ *
+ * None of the queries hold up forwarding: counters, routes and the ARP
+ * cache are read the way the forwarding path reads them, without locks,
+ * and NAT mappings are copied out a few buckets at a time.  Clients are
+ * served one at a time.  The socket is only accessible to its owner.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CTL_H
+#define SR_CTL_H
+
+#define SR_CTL_LINE 256         /* longest command accepted */
+
+struct sr_instance;
+struct sr_ctl;
+
+struct sr_ctl* sr_ctl_start(struct sr_instance* sr, const char* path);
+void sr_ctl_stop(struct sr_ctl* ctl);
+
+#endif /* -- SR_CTL_H -- */
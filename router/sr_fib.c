@@ -0,0 +1,328 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * 16-8-8 multibit trie used for longest prefix match.  See sr_fib.h for the
+ * slot encoding.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <netinet/in.h>
+
+#include "sr_fib.h"
+#include "sr_rt.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_create(void)
+ * Scope:  Global
+ *
+ * Allocate an empty FIB.  Returns 0 if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_create(void)
+{
+    struct sr_fib* fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib));
+    return fib;
+} /* -- sr_fib_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_build(..)
+ * Scope:  Global
+ *
+ * Build a FIB from a routing table list.  Routes are installed shortest
+ * prefix first so that no insert has to push its next hop down into
+ * chunks that already exist, which keeps bulk loads linear.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_build(struct sr_rt* routing_table)
+{
+    struct sr_fib* fib;
+    struct sr_rt* rt_walker;
+    struct sr_rt** sorted;
+    unsigned long count[34];
+    unsigned long n = 0, i;
+    int len;
+
+    memset(count, 0, sizeof(count));
+    for(rt_walker = routing_table; rt_walker; rt_walker = rt_walker->next)
+    {
+        count[sr_fib_mask_len(rt_walker->mask.s_addr) + 1]++;
+        n++;
+    }
+    for(len = 1; len < 34; len++)
+    { count[len] += count[len - 1]; }
+
+    fib = sr_fib_create();
+    sorted = (struct sr_rt**)malloc((n ? n : 1) * sizeof(struct sr_rt*));
+    if(!fib || !sorted)
+    {
+        sr_fib_destroy(fib);
+        free(sorted);
+        return 0;
+    }
+
+    /* -- stable counting sort on prefix length -- */
+    for(rt_walker = routing_table; rt_walker; rt_walker = rt_walker->next)
+    { sorted[count[sr_fib_mask_len(rt_walker->mask.s_addr)]++] = rt_walker; }
+
+    for(i = 0; i < n; i++)
+    {
+        if(sr_fib_insert(fib, ntohl(sorted[i]->dest.s_addr),
+                         sr_fib_mask_len(sorted[i]->mask.s_addr),
+                         sorted[i]) != 0)
+        {
+            sr_fib_destroy(fib);
+            fib = 0;
+            break;
+        }
+    }
+
+    free(sorted);
+    return fib;
+} /* -- sr_fib_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_destroy(..)
+ * Scope:  Global
+ *
+ * Free the FIB.  The route entries it points at are not owned by it.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    if(!fib)
+    { return; }
+
+    free(fib->chunks);
+    free(fib->chunk_len);
+    free(fib->nexthops);
+    free(fib);
+} /* -- sr_fib_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_mask_len(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_mask_len(uint32_t mask_nbo)
+{
+    uint32_t mask = ntohl(mask_nbo);
+    int len = 0;
+
+    while(len < 32 && (mask & (0x80000000u >> len)))
+    { len++; }
+
+    return len;
+} /* -- sr_fib_mask_len -- */
+
+/* Make room for two more chunks so that slot pointers taken during a
+   single insert stay valid. */
+static int fib_reserve_chunks(struct sr_fib* fib)
+{
+    uint32_t cap;
+    uint32_t* chunks;
+    uint8_t* chunk_len;
+
+    if(fib->nchunks + 2 <= fib->chunks_cap)
+    { return 0; }
+
+    cap = fib->chunks_cap ? fib->chunks_cap * 2 : 64;
+    chunks = (uint32_t*)realloc(fib->chunks,
+            (size_t)cap * SR_FIB_CHUNK_SZ * sizeof(uint32_t));
+    if(!chunks)
+    { return -1; }
+    fib->chunks = chunks;
+
+    chunk_len = (uint8_t*)realloc(fib->chunk_len,
+            (size_t)cap * SR_FIB_CHUNK_SZ);
+    if(!chunk_len)
+    { return -1; }
+    fib->chunk_len = chunk_len;
+
+    fib->chunks_cap = cap;
+    return 0;
+}
+
+static int fib_reserve_nexthop(struct sr_fib* fib)
+{
+    uint32_t cap;
+    struct sr_rt** nexthops;
+
+    if(fib->nnexthops < fib->nexthops_cap)
+    { return 0; }
+
+    cap = fib->nexthops_cap ? fib->nexthops_cap * 2 : 64;
+    nexthops = (struct sr_rt**)realloc(fib->nexthops,
+            (size_t)cap * sizeof(struct sr_rt*));
+    if(!nexthops)
+    { return -1; }
+
+    fib->nexthops = nexthops;
+    fib->nexthops_cap = cap;
+    return 0;
+}
+
+/* Push next hop v (owned by a prefix of length plen1-1) into a slot and,
+   if the slot has been refined, into every slot below it that is owned by
+   a shorter prefix. */
+static void fib_fill(struct sr_fib* fib, uint32_t* slot, uint8_t* len,
+                     uint32_t v, uint8_t plen1)
+{
+    uint32_t base;
+    int i;
+
+    if(*slot & SR_FIB_CHILD)
+    {
+        base = (*slot & ~SR_FIB_CHILD) * SR_FIB_CHUNK_SZ;
+        for(i = 0; i < SR_FIB_CHUNK_SZ; i++)
+        {
+            fib_fill(fib, &fib->chunks[base + i], &fib->chunk_len[base + i],
+                     v, plen1);
+        }
+        return;
+    }
+
+    if(*len < plen1)
+    {
+        *slot = v;
+        *len = plen1;
+    }
+}
+
+/* Return the chunk refining this slot, creating one that inherits the
+   slot's current next hop if there is none yet. */
+static uint32_t fib_child(struct sr_fib* fib, uint32_t* slot, uint8_t* len)
+{
+    uint32_t c, base;
+    int i;
+
+    if(*slot & SR_FIB_CHILD)
+    { return *slot & ~SR_FIB_CHILD; }
+
+    assert(fib->nchunks < fib->chunks_cap);
+    c = fib->nchunks++;
+    base = c * SR_FIB_CHUNK_SZ;
+    for(i = 0; i < SR_FIB_CHUNK_SZ; i++)
+    {
+        fib->chunks[base + i] = *slot;
+        fib->chunk_len[base + i] = *len;
+    }
+
+    *slot = SR_FIB_CHILD | c;
+    return c;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_insert(..)
+ * Scope:  Global
+ *
+ * Install prefix/plen -> rt.  If the same prefix is installed twice the
+ * first entry wins, matching the order of the routing table file.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success, -1 if out of memory
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, int plen,
+                  struct sr_rt* rt)
+{
+    uint32_t v, c, base, start, n, i;
+    uint8_t plen1;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(rt);
+    assert(plen >= 0 && plen <= 32);
+
+    if(fib_reserve_chunks(fib) != 0 || fib_reserve_nexthop(fib) != 0)
+    { return -1; }
+
+    if(plen < 32)
+    { prefix &= ~(0xffffffffu >> plen); }
+
+    fib->nexthops[fib->nnexthops++] = rt;
+    v = fib->nnexthops;
+    plen1 = (uint8_t)(plen + 1);
+
+    if(plen <= SR_FIB_L1_BITS)
+    {
+        start = prefix >> 16;
+        n = 1u << (16 - plen);
+        for(i = 0; i < n; i++)
+        {
+            fib_fill(fib, &fib->l1[start + i], &fib->l1_len[start + i],
+                     v, plen1);
+        }
+        return 0;
+    }
+
+    c = fib_child(fib, &fib->l1[prefix >> 16], &fib->l1_len[prefix >> 16]);
+    base = c * SR_FIB_CHUNK_SZ;
+
+    if(plen <= 24)
+    {
+        start = (prefix >> 8) & 0xff;
+        n = 1u << (24 - plen);
+        for(i = 0; i < n; i++)
+        {
+            fib_fill(fib, &fib->chunks[base + start + i],
+                     &fib->chunk_len[base + start + i], v, plen1);
+        }
+        return 0;
+    }
+
+    i = base + ((prefix >> 8) & 0xff);
+    c = fib_child(fib, &fib->chunks[i], &fib->chunk_len[i]);
+    base = c * SR_FIB_CHUNK_SZ;
+
+    start = prefix & 0xff;
+    n = 1u << (32 - plen);
+    for(i = 0; i < n; i++)
+    {
+        fib_fill(fib, &fib->chunks[base + start + i],
+                 &fib->chunk_len[base + start + i], v, plen1);
+    }
+
+    return 0;
+} /* -- sr_fib_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope:  Global
+ *
+ * Longest prefix match: at most three slot reads.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip)
+{
+    uint32_t v;
+
+    if(!fib)
+    { return 0; }
+
+    v = fib->l1[ip >> 16];
+    if(v & SR_FIB_CHILD)
+    {
+        v = fib->chunks[(v & ~SR_FIB_CHILD) * SR_FIB_CHUNK_SZ +
+                        ((ip >> 8) & 0xff)];
+        if(v & SR_FIB_CHILD)
+        {
+            v = fib->chunks[(v & ~SR_FIB_CHILD) * SR_FIB_CHUNK_SZ +
+                            (ip & 0xff)];
+        }
+    }
+
+    return v ? fib->nexthops[v - 1] : 0;
+} /* -- sr_fib_lookup -- */
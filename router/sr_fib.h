@@ -0,0 +1,72 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ *
+ * Description:
+ *
+ * Forwarding information base built from the entries of the routing table.
+ *
+ * The FIB is a 16-8-8 multibit trie with leaf pushing: the top 16 bits of
+ * the destination index a 64k slot root array, and prefixes longer than /16
+ * (resp. /24) hang 256 slot chunks off the slot they refine.  Every slot
+ * holds either a next hop or a reference to a child chunk, so a lookup is
+ * at most three array reads no matter how many prefixes are installed.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FIB_H
+#define SR_FIB_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_FIB_L1_BITS   16
+#define SR_FIB_L1_SZ     (1 << SR_FIB_L1_BITS)
+#define SR_FIB_CHUNK_SZ  256
+#define SR_FIB_CHILD     0x80000000u  /* slot refers to a child chunk */
+
+struct sr_rt;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib
+ *
+ * Slot encoding: 0 means no route, SR_FIB_CHILD|n refers to chunk n and any
+ * other value v refers to nexthops[v-1].  The *_len arrays remember the
+ * prefix length (+1) that owns each slot and are only read on insert.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib
+{
+    uint32_t l1[SR_FIB_L1_SZ];
+    uint8_t  l1_len[SR_FIB_L1_SZ];
+
+    uint32_t* chunks;          /* nchunks * SR_FIB_CHUNK_SZ slots */
+    uint8_t*  chunk_len;
+    uint32_t  nchunks;
+    uint32_t  chunks_cap;
+
+    struct sr_rt** nexthops;
+    uint32_t  nnexthops;
+    uint32_t  nexthops_cap;
+};
+
+struct sr_fib* sr_fib_create(void);
+struct sr_fib* sr_fib_build(struct sr_rt* routing_table);
+void sr_fib_destroy(struct sr_fib* fib);
+
+/* prefix is in host byte order, plen in [0,32] */
+int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, int plen,
+                  struct sr_rt* rt);
+
+/* ip is in host byte order; returns 0 if no prefix matches */
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip);
+
+/* number of leading one bits in a netmask given in network byte order */
+int sr_fib_mask_len(uint32_t mask_nbo);
+
+#endif /* -- SR_FIB_H -- */
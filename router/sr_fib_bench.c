@@ -0,0 +1,168 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmark for the FIB (sr_fib.c).  Builds tables of 1k, 100k and 1M
+ * random prefixes with a roughly BGP-like length distribution and reports
+ * lookups/sec for random destinations.  The 1k table is also checked
+ * against a brute force longest prefix match before timing.
+ *
+ *   make fib_bench && ./fib_bench [lookups]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#include "sr_fib.h"
+#include "sr_rt.h"
+
+#define DEFAULT_LOOKUPS 20000000
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t rng(void)
+{
+    /* xorshift64*, deterministic across runs */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static int random_plen(void)
+{
+    uint32_t r = rng() % 100;
+
+    if(r < 55)  { return 24; }
+    if(r < 80)  { return 17 + (int)(rng() % 7); }
+    if(r < 92)  { return 8 + (int)(rng() % 9); }
+    return 25 + (int)(rng() % 8);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t plen_mask(int plen)
+{
+    return plen ? 0xffffffffu << (32 - plen) : 0;
+}
+
+/* brute force reference: longest matching mask, first entry on ties */
+static struct sr_rt* linear_lookup(struct sr_rt* rts, int n, uint32_t ip)
+{
+    struct sr_rt* best = 0;
+    int best_len = -1;
+    int i, len;
+
+    for(i = 0; i < n; i++)
+    {
+        len = sr_fib_mask_len(rts[i].mask.s_addr);
+        if(((ip ^ ntohl(rts[i].dest.s_addr)) & plen_mask(len)) == 0 &&
+           len > best_len)
+        {
+            best = &rts[i];
+            best_len = len;
+        }
+    }
+    return best;
+}
+
+static int run(int nprefixes, uint32_t* ips, int nlookups, int verify)
+{
+    struct sr_fib* fib;
+    struct sr_rt* rts;
+    struct sr_rt* hit;
+    double t0, t_build, t_lookup;
+    unsigned long found = 0;
+    int i, plen;
+
+    rts = (struct sr_rt*)calloc(nprefixes, sizeof(struct sr_rt));
+    if(!rts)
+    {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    for(i = 0; i < nprefixes; i++)
+    {
+        plen = random_plen();
+        rts[i].dest.s_addr = htonl(rng() & plen_mask(plen));
+        rts[i].mask.s_addr = htonl(plen_mask(plen));
+        rts[i].next = (i + 1 < nprefixes) ? &rts[i + 1] : 0;
+    }
+
+    t0 = now_sec();
+    fib = sr_fib_build(rts);
+    t_build = now_sec() - t0;
+    if(!fib)
+    {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    if(verify)
+    {
+        for(i = 0; i < 100000; i++)
+        {
+            if(sr_fib_lookup(fib, ips[i]) !=
+               linear_lookup(rts, nprefixes, ips[i]))
+            {
+                fprintf(stderr, "mismatch for %08x\n", ips[i]);
+                return -1;
+            }
+        }
+    }
+
+    t0 = now_sec();
+    for(i = 0; i < nlookups; i++)
+    {
+        hit = sr_fib_lookup(fib, ips[i]);
+        found += (hit != 0);
+    }
+    t_lookup = now_sec() - t0;
+
+    printf("%8d prefixes: build %7.3fs  chunks %7u  %6.1f Mlookups/s"
+           "  (%.1f ns/lookup, %lu hits)\n",
+           nprefixes, t_build, fib->nchunks,
+           nlookups / t_lookup / 1e6, t_lookup * 1e9 / nlookups, found);
+
+    sr_fib_destroy(fib);
+    free(rts);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int nlookups = DEFAULT_LOOKUPS;
+    uint32_t* ips;
+    int i;
+
+    if(argc > 1)
+    { nlookups = atoi(argv[1]); }
+    if(nlookups < 100000)
+    { nlookups = 100000; }
+
+    ips = (uint32_t*)malloc(nlookups * sizeof(uint32_t));
+    if(!ips)
+    { return 1; }
+    for(i = 0; i < nlookups; i++)
+    { ips[i] = rng(); }
+
+    if(run(1000, ips, nlookups, 1) != 0 ||
+       run(100000, ips, nlookups, 0) != 0 ||
+       run(1000000, ips, nlookups, 0) != 0)
+    { return 1; }
+
+    free(ips);
+    return 0;
+}
@@ -24,6 +24,7 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_capture.h"
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
@@ -76,7 +77,10 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->idx = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        if(sr->capture)
+        { sr_capture_add_interface(sr->capture, 0, name); }
         return;
     }
 
@@ -87,9 +91,12 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
 
     if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
     assert(if_walker->next);
+    if_walker->next->idx = if_walker->idx + 1;
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
     if_walker->next = 0;
+    if(sr->capture)
+    { sr_capture_add_interface(sr->capture, if_walker->idx, name); }
 } /* -- sr_add_interface -- */ 
 
 /*--------------------------------------------------------------------- 
@@ -41,6 +41,7 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int idx; /* position in if_list, the interface ID in captures */
   struct sr_if* next;
 };
 
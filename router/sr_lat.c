@@ -0,0 +1,325 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lat.c
+ *
+ * Description:
+ *
+ * Per-thread latency histograms, see sr_lat.h.
+ *
+ * Bucket i below 2^SR_LAT_SUB_BITS holds exactly the value i.  Above
+ * that, a value whose top bit is bit m (m >= SR_LAT_SUB_BITS) is kept to
+ * its top SR_LAT_SUB_BITS + 1 bits: with shift = m - SR_LAT_SUB_BITS it
+ * goes in bucket (shift + 1) * 2^SR_LAT_SUB_BITS + the SR_LAT_SUB_BITS
+ * bits below the top one.  The indices run on without gaps.
+ *
+ * The histograms of a thread's slot (see sr_thread.h) are allocated the
+ * first time anyone records in it, and like the counters in sr_stats.c
+ * only that thread writes them, except in SR_THREAD_SHARED, where they
+ * are updated with atomic adds.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_lat.h"
+#include "sr_thread.h"
+
+#define SR_LAT_SUB      (1u << SR_LAT_SUB_BITS)
+
+int sr_lat_enabled = 0;
+
+static double sr_lat_ns_per_tick = 1.0;
+static struct sr_lat_hist* sr_lat_slots[SR_THREAD_SLOTS];
+static __thread struct sr_lat_hist* sr_lat_own;
+static __thread int sr_lat_shared;
+
+static const char* sr_lat_names[SR_LAT_NSTAGES] =
+{ "frame", "queue", "validate", "nat", "lpm", "arp", "send", "handle",
+  "flush" };
+
+static unsigned int lat_bucket(uint64_t v)
+{
+    unsigned int msb, shift;
+
+    if (v < SR_LAT_SUB)
+    { return (unsigned int)v; }
+
+    msb = 63 - __builtin_clzll(v);
+    if (msb >= SR_LAT_MAX_BITS)
+    { return SR_LAT_BUCKETS - 1; }
+
+    shift = msb - SR_LAT_SUB_BITS;
+    return ((shift + 1) << SR_LAT_SUB_BITS) |
+           (unsigned int)((v >> shift) & (SR_LAT_SUB - 1));
+}
+
+/* Highest value that lands in bucket i */
+static uint64_t lat_bucket_high(unsigned int i)
+{
+    unsigned int shift;
+
+    if (i < SR_LAT_SUB)
+    { return i; }
+
+    shift = (i >> SR_LAT_SUB_BITS) - 1;
+    return ((((uint64_t)(i & (SR_LAT_SUB - 1)) | SR_LAT_SUB) << shift) +
+            ((uint64_t)1 << shift) - 1);
+}
+
+/* The calling thread's histograms, 0 if they could not be allocated */
+static struct sr_lat_hist* lat_slot(void)
+{
+    struct sr_lat_hist* h = 0;
+    unsigned int i;
+
+    if (sr_lat_own)
+    { return sr_lat_own; }
+
+    /* -- a slot given back keeps its histograms; the shared one may be
+          set up by several threads at once -- */
+    i = sr_thread_slot();
+    sr_lat_own = __atomic_load_n(&sr_lat_slots[i], __ATOMIC_ACQUIRE);
+    if (!sr_lat_own)
+    {
+        sr_lat_own = (struct sr_lat_hist*)calloc(SR_LAT_NSTAGES,
+                                                 sizeof(struct sr_lat_hist));
+        if (!sr_lat_own)
+        { return 0; }
+        if (!__atomic_compare_exchange_n(&sr_lat_slots[i], &h, sr_lat_own, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            free(sr_lat_own);
+            sr_lat_own = h;
+        }
+    }
+    sr_lat_shared = (i == SR_THREAD_SHARED);
+    return sr_lat_own;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_init(..)
+ * Scope:  Global
+ *
+ * Measure the TSC against the monotonic clock and start recording.
+ * Takes a few tens of milliseconds.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_lat_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec nap;
+    sr_lat_t t0, t1, c0, c1;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = 20 * 1000 * 1000;
+
+    c0 = sr_lat_clock();
+    t0 = sr_lat_now();
+    nanosleep(&nap, 0);
+    c1 = sr_lat_clock();
+    t1 = sr_lat_now();
+
+    if (t1 <= t0 || c1 <= c0)
+    { return -1; }
+    sr_lat_ns_per_tick = (double)(c1 - c0) / (double)(t1 - t0);
+#endif
+
+    sr_lat_enabled = 1;
+    return 0;
+} /* -- sr_lat_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_clock(..)
+ * Scope:  Global
+ *
+ * Monotonic nanoseconds, sr_lat_now() where there is no TSC.
+ *
+ *---------------------------------------------------------------------*/
+
+sr_lat_t sr_lat_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sr_lat_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+} /* -- sr_lat_clock -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_record(..)
+ * Scope:  Global
+ *
+ * Count one stage that took ticks.  Use SR_LAT_END rather than calling
+ * this.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_lat_record(int stage, sr_lat_t ticks)
+{
+    struct sr_lat_hist* h = lat_slot();
+    unsigned long* b;
+    uint64_t max;
+
+    if (!h)
+    { return; }
+    h += stage;
+
+    /* -- TSCs of different cores may disagree by a little -- */
+    if ((int64_t)ticks < 0)
+    { ticks = 0; }
+
+    b = &(h->bucket[lat_bucket(ticks)]);
+    if (sr_lat_shared)
+    {
+        __atomic_fetch_add(b, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&(h->count), 1, __ATOMIC_RELAXED);
+        max = __atomic_load_n(&(h->max), __ATOMIC_RELAXED);
+        while (ticks > max &&
+               !__atomic_compare_exchange_n(&(h->max), &max, ticks, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        { }
+        return;
+    }
+
+    __atomic_store_n(b, *b + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(h->count), h->count + 1, __ATOMIC_RELAXED);
+    if (ticks > h->max)
+    { __atomic_store_n(&(h->max), ticks, __ATOMIC_RELAXED); }
+} /* -- sr_lat_record -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_snapshot(..)
+ * Scope:  Global
+ *
+ * Add up every thread's histograms.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_lat_snapshot(struct sr_lat_hist out[SR_LAT_NSTAGES])
+{
+    const struct sr_lat_hist* h;
+    unsigned int i, n, s, b;
+    uint64_t max;
+
+    memset(out, 0, SR_LAT_NSTAGES * sizeof(struct sr_lat_hist));
+
+    n = sr_thread_nslots();
+
+    for (i = 0; i < n; i++)
+    {
+        h = __atomic_load_n(&sr_lat_slots[i], __ATOMIC_ACQUIRE);
+        if (!h)
+        { continue; }
+        for (s = 0; s < SR_LAT_NSTAGES; s++)
+        {
+            out[s].count += __atomic_load_n(&(h[s].count), __ATOMIC_RELAXED);
+            max = __atomic_load_n(&(h[s].max), __ATOMIC_RELAXED);
+            if (max > out[s].max)
+            { out[s].max = max; }
+            for (b = 0; b < SR_LAT_BUCKETS; b++)
+            { out[s].bucket[b] += __atomic_load_n(&(h[s].bucket[b]), __ATOMIC_RELAXED); }
+        }
+    }
+} /* -- sr_lat_snapshot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_percentile(..)
+ * Scope:  Global
+ *
+ * The time in ns that pct percent of the samples in h took at most,
+ * rounded up to the end of its bucket.  0 for an empty histogram.
+ *
+ *---------------------------------------------------------------------*/
+
+double sr_lat_percentile(const struct sr_lat_hist* h, double pct)
+{
+    unsigned long total = 0, want;
+    double rank;
+    uint64_t v;
+    unsigned int b;
+
+    for (b = 0; b < SR_LAT_BUCKETS; b++)
+    { total += h->bucket[b]; }
+    if (total == 0)
+    { return 0; }
+
+    /* -- the rank of the sample wanted, rounded up -- */
+    rank = total * pct / 100.0;
+    want = (unsigned long)rank;
+    if (want < rank || want == 0)
+    { want++; }
+
+    for (b = 0; b < SR_LAT_BUCKETS; b++)
+    {
+        if (h->bucket[b] >= want)
+        { break; }
+        want -= h->bucket[b];
+    }
+    if (b == SR_LAT_BUCKETS)
+    { b = SR_LAT_BUCKETS - 1; }
+
+    v = lat_bucket_high(b);
+    if (v > h->max)
+    { v = h->max; }
+    return sr_lat_ns(v);
+} /* -- sr_lat_percentile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_ns(..)
+ * Scope:  Global
+ *
+ * Convert a time recorded in sr_lat_now() ticks to nanoseconds.
+ *
+ *---------------------------------------------------------------------*/
+
+double sr_lat_ns(uint64_t ticks)
+{
+    return ticks * sr_lat_ns_per_tick;
+} /* -- sr_lat_ns -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_stage_name(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+const char* sr_lat_stage_name(int stage)
+{
+    return sr_lat_names[stage];
+} /* -- sr_lat_stage_name -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_lat_print(..)
+ * Scope:  Global
+ *
+ * Table of the percentiles of every stage that recorded anything.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_lat_print(FILE* fp)
+{
+    struct sr_lat_hist* h;
+    int s;
+
+    h = (struct sr_lat_hist*)malloc(SR_LAT_NSTAGES * sizeof(struct sr_lat_hist));
+    if (!h)
+    { return; }
+    sr_lat_snapshot(h);
+
+    fprintf(fp, "%-10s %10s %10s %10s %10s %10s   (ns)\n",
+            "stage", "count", "p50", "p99", "p99.9", "max");
+    for (s = 0; s < SR_LAT_NSTAGES; s++)
+    {
+        if (h[s].count == 0)
+        { continue; }
+        fprintf(fp, "%-10s %10lu %10.0f %10.0f %10.0f %10.0f\n",
+                sr_lat_names[s], h[s].count,
+                sr_lat_percentile(&h[s], 50.0),
+                sr_lat_percentile(&h[s], 99.0),
+                sr_lat_percentile(&h[s], 99.9),
+                sr_lat_ns(h[s].max));
+    }
+
+    free(h);
+} /* -- sr_lat_print -- */
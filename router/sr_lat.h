@@ -0,0 +1,92 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_lat.h
+ *
+ * Description:
+ *
+ * Latency histograms for the stages of the forwarding path (-P).
+ *
+ *   sr_lat_t t;
+ *   SR_LAT_BEGIN(t);
+ *   nexthopIface = longestPrefixMatch(sr, ip_hdr->ip_dst);
+ *   SR_LAT_END(SR_LAT_LPM, t);
+ *
+ * Off by default, when each of these is a load and a branch that is
+ * predicted not taken.  When on, the time between the two, read from the
+ * TSC where there is one and clock_gettime otherwise, goes into a
+ * histogram of the calling thread: log-linear buckets, HDR style, with
+ * 2^SR_LAT_SUB_BITS buckets per power of two, so any value is recorded
+ * to within about 3%.  sr_lat_snapshot adds up every thread's histograms
+ * and sr_lat_percentile reads them in nanoseconds.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LAT_H
+#define SR_LAT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+#define SR_LAT_SUB_BITS  5
+#define SR_LAT_MAX_BITS  40     /* longer times land in the last bucket */
+#define SR_LAT_BUCKETS   ((SR_LAT_MAX_BITS - SR_LAT_SUB_BITS + 1) << SR_LAT_SUB_BITS)
+
+enum sr_lat_stage
+{
+    SR_LAT_FRAME = 0,   /* command read from the server to frame handed on */
+    SR_LAT_QUEUE,       /* waiting in a worker's ring (-w) */
+    SR_LAT_VALIDATE,    /* sr_validate_frame */
+    SR_LAT_NAT,         /* sr_nat_update_headers */
+    SR_LAT_LPM,         /* longestPrefixMatch */
+    SR_LAT_ARP,         /* sr_arpcache_lookup of the next hop */
+    SR_LAT_SEND,        /* queuing the frame for the server */
+    SR_LAT_HANDLE,      /* the whole of sr_handlepacket */
+    SR_LAT_FLUSH,       /* writing out a batch, per batch */
+    SR_LAT_NSTAGES
+};
+
+struct sr_lat_hist
+{
+    unsigned long count;
+    uint64_t max;
+    unsigned long bucket[SR_LAT_BUCKETS];
+};
+
+typedef uint64_t sr_lat_t;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define sr_lat_now() ((sr_lat_t)__builtin_ia32_rdtsc())
+#else
+#define sr_lat_now() sr_lat_clock()
+#endif
+
+#define SR_LAT_BEGIN(t) \
+    do { \
+        if (__builtin_expect(sr_lat_enabled, 0)) \
+        { (t) = sr_lat_now(); } \
+    } while (0)
+
+#define SR_LAT_END(stage, t) \
+    do { \
+        if (__builtin_expect(sr_lat_enabled, 0)) \
+        { sr_lat_record((stage), sr_lat_now() - (t)); } \
+    } while (0)
+
+extern int sr_lat_enabled;
+
+int  sr_lat_init(void);
+sr_lat_t sr_lat_clock(void);
+void sr_lat_record(int stage, sr_lat_t ticks);
+void sr_lat_snapshot(struct sr_lat_hist out[SR_LAT_NSTAGES]);
+double sr_lat_percentile(const struct sr_lat_hist* h, double pct);
+double sr_lat_ns(uint64_t ticks);
+const char* sr_lat_stage_name(int stage);
+void sr_lat_print(FILE* fp);
+
+#endif /* -- SR_LAT_H -- */
@@ -0,0 +1,969 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_loadgen.c
+ *
+ * Description:
+ *
+ * Load generator that stands in for the VNS server, so the real sr binary
+ * can be load tested on one machine without Mininet or POX.  Waits for
+ * the router on a TCP port or a UNIX socket and goes through the same
+ * handshake as POX's srhandler.py: VNS_AUTH_REQUEST, VNS_AUTH_STATUS
+ * (any reply is accepted), VNSOPEN, then VNSHWINFO built from IP_CONFIG.
+ * With -M it creates shared memory rings instead (see sr_shm.h), waits
+ * for the router to attach and starts right at VNSHWINFO.
+ *
+ *   make loadgen
+ *   ./loadgen [-p port | -U path | -M path] [-n flows] [-S frame bytes]
+ *             [-R packets/sec] [-d secs | -c packets] [-i IP_CONFIG]
+ *             [-r rtable] [-h]
+ *   ./sr -p port -s 127.0.0.1 ...     (or -s path for -U, -M path for -M)
+ *
+ * The interfaces are the sw0-<name> lines of IP_CONFIG and the hosts its
+ * other lines.  Each host sits behind the interface its route in rtable
+ * points to, and loadgen answers the router's ARP requests for it.
+ * Traffic is UDP from the host "client" to every other host, spread over
+ * -n flows by source port so it hashes to different workers (sr -w).
+ * It is sent at -R packets/sec, or as fast as the router takes it when
+ * -R is 0.
+ *
+ * Every frame carries a sequence number and its send time, so whatever
+ * comes back gives forwarded throughput, latency and loss.  Frames still
+ * missing half a second after the last one was sent count as lost.  The
+ * session is then closed with VNSCLOSE, so sr exits and prints its own
+ * counters too.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_shm.h"
+#include "vnscommand.h"
+
+#define DEFAULT_PORT     8888
+#define DEFAULT_IPCONFIG "../IP_CONFIG"
+#define DEFAULT_RTABLE   "rtable"
+#define DEFAULT_SOURCE   "client"
+
+#define LG_MAX_IFS      16
+#define LG_MAX_HOSTS    64
+#define LG_MAX_ROUTES   1024
+#define LG_BUF_SZ       (256 * 1024)
+#define LG_MIN_FRAME    (sizeof(struct sr_ethernet_hdr) + 20 + 8 + 16)
+#define LG_MAX_FRAME    1514
+#define LG_SAMPLES      (1 << 22)   /* latencies kept for the percentiles */
+#define LG_DRAIN_NS     500000000ull
+#define LG_MAGIC        0x5352474e  /* "SRGN" */
+#define LG_SPORT        10000
+#define LG_DPORT        9           /* discard */
+#define LG_ARP_MSG      (sizeof(c_packet_header) + sizeof(struct sr_ethernet_hdr) + \
+                         sizeof(struct sr_arp_hdr))
+#define LG_ARP_PENDING  64
+#define LG_SHM_BATCH    256         /* frames published at once with -M */
+
+struct lg_if
+{
+    char name[sr_IFACE_NAMELEN];
+    uint32_t ip;
+    unsigned char mac[ETHER_ADDR_LEN];
+};
+
+struct lg_host
+{
+    char name[64];
+    uint32_t ip;
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct lg_if* iface;
+};
+
+struct lg_route
+{
+    uint32_t dest, mask;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+/* payload of every generated frame */
+struct lg_stamp
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t sent_ns;
+} __attribute__ ((packed));
+
+static struct lg_if ifs[LG_MAX_IFS];
+static unsigned int nifs;
+static struct lg_host hosts[LG_MAX_HOSTS];
+static unsigned int nhosts;
+static struct lg_route routes[LG_MAX_ROUTES];
+static unsigned int nroutes;
+
+static int sockfd = -1;
+static struct sr_shm* shm;          /* -M, instead of sockfd */
+
+/* -- ARP replies for the sender to write, so the receiver never blocks -- */
+static pthread_mutex_t arp_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t arp_pending[LG_ARP_PENDING * LG_ARP_MSG];
+static unsigned int narp_pending;
+
+/* -- what to send -- */
+static struct lg_host* source;
+static unsigned int nflows = 64, frame_len = 98;
+static double rate;                 /* packets/sec, 0 for as fast as possible */
+static double duration = 5;
+static unsigned long count;         /* stop after this many, if set */
+
+/* -- sender's results, read once it is done -- */
+static unsigned long sent;
+static uint64_t send_start, send_end;
+static int send_done;    /* under arp_lock */
+
+/* -- receiver's results -- */
+static unsigned long received, received_bytes, others, arp_replies;
+static uint64_t recv_first, recv_last;
+static uint32_t* lat_samples;
+static unsigned long nsamples;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* Copy at most size - 1 bytes of src and terminate; zero the rest. */
+static void copy_name(char* dst, size_t size, const char* src)
+{
+    size_t n = strlen(src);
+
+    if(n > size - 1)
+    { n = size - 1; }
+    memset(dst, 0, size);
+    memcpy(dst, src, n);
+}
+
+/* Whole commands only, one slot each. */
+static int write_shm(const uint8_t* p, size_t len)
+{
+    uint8_t* slot;
+    uint32_t n;
+
+    while(len >= 8)
+    {
+        n = ntohl(((const c_base*)p)->mLen);
+        if((slot = sr_shm_reserve(shm)) == 0)
+        { return -1; }
+        memcpy(slot, p, n);
+        p += n;
+        len -= n;
+    }
+    sr_shm_publish(shm);
+    return 0;
+}
+
+/* Only one thread writes at a time: the sender until it is done, then
+   the receiver. */
+static int write_all(const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    ssize_t n;
+
+    if(shm)
+    { return write_shm((const uint8_t*)buf, len); }
+
+    while(len > 0)
+    {
+        n = write(sockfd, p, len);
+        if(n < 0 && errno == EINTR)
+        { continue; }
+        if(n < 0)
+        { return -1; }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Topology
+ *---------------------------------------------------------------------------*/
+
+static int load_ipconfig(const char* path)
+{
+    FILE* fp;
+    char line[256], name[64], ip[64];
+    struct in_addr addr;
+
+    if((fp = fopen(path, "r")) == 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, "%63s %63s", name, ip) != 2 || inet_aton(ip, &addr) == 0)
+        { continue; }
+
+        if(strncmp(name, "sw0-", 4) == 0 && nifs < LG_MAX_IFS)
+        {
+            /* -- same MACs as sr_bench makes up -- */
+            copy_name(ifs[nifs].name, sr_IFACE_NAMELEN, name + 4);
+            ifs[nifs].ip = addr.s_addr;
+            ifs[nifs].mac[0] = 0x02;
+            ifs[nifs].mac[5] = (unsigned char)(nifs + 1);
+            nifs++;
+        }
+        else if(strncmp(name, "sw0-", 4) != 0 && nhosts < LG_MAX_HOSTS)
+        {
+            copy_name(hosts[nhosts].name, sizeof(hosts[nhosts].name), name);
+            hosts[nhosts].ip = addr.s_addr;
+            hosts[nhosts].mac[0] = 0x02;
+            hosts[nhosts].mac[1] = 0xbe;
+            memcpy(hosts[nhosts].mac + 2, &addr.s_addr, 4);
+            nhosts++;
+        }
+    }
+    fclose(fp);
+
+    if(nifs == 0 || nhosts < 2)
+    {
+        fprintf(stderr, "%s: need sw0-* interfaces and at least two hosts\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Put every host behind the interface of its longest matching route. */
+static int place_hosts(const char* path)
+{
+    FILE* fp;
+    char line[256], dest[64], gw[64], mask[64], iface[64];
+    struct in_addr d, m;
+    struct lg_route* best;
+    unsigned int h, r, i;
+
+    if((fp = fopen(path, "r")) == 0)
+    {
+        perror(path);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp) && nroutes < LG_MAX_ROUTES)
+    {
+        if(sscanf(line, "%63s %63s %63s %63s", dest, gw, mask, iface) != 4 ||
+           inet_aton(dest, &d) == 0 || inet_aton(mask, &m) == 0)
+        { continue; }
+        routes[nroutes].dest = d.s_addr;
+        routes[nroutes].mask = m.s_addr;
+        copy_name(routes[nroutes].iface, sr_IFACE_NAMELEN, iface);
+        nroutes++;
+    }
+    fclose(fp);
+
+    for(h = 0; h < nhosts; h++)
+    {
+        best = 0;
+        for(r = 0; r < nroutes; r++)
+        {
+            if((hosts[h].ip & routes[r].mask) == (routes[r].dest & routes[r].mask) &&
+               (!best || ntohl(routes[r].mask) > ntohl(best->mask)))
+            { best = &routes[r]; }
+        }
+        for(i = 0; best && i < nifs; i++)
+        {
+            if(strcmp(ifs[i].name, best->iface) == 0)
+            { hosts[h].iface = &ifs[i]; }
+        }
+        if(!hosts[h].iface)
+        { fprintf(stderr, "no route to host %s, not using it\n", hosts[h].name); }
+    }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * VNS session
+ *---------------------------------------------------------------------------*/
+
+static int read_all(void* buf, size_t len)
+{
+    char* p = (char*)buf;
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = read(sockfd, p, len);
+        if(n < 0 && errno == EINTR)
+        { continue; }
+        if(n <= 0)
+        { return -1; }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* One whole command into buf, returns its type or -1. */
+static int read_command(uint8_t* buf, size_t max)
+{
+    uint32_t len;
+
+    if(read_all(buf, 8) != 0)
+    { return -1; }
+    len = ntohl(((c_base*)buf)->mLen);
+    if(len < 8 || len > max || read_all(buf + 8, len - 8) != 0)
+    { return -1; }
+    return ntohl(((c_base*)buf)->mType);
+}
+
+static int send_hwinfo(void)
+{
+    c_hwinfo hw;
+    unsigned int i, n = 0;
+    uint32_t len;
+
+    memset(&hw, 0, sizeof(hw));
+    for(i = 0; i < nifs; i++)
+    {
+        hw.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        copy_name(hw.mHWInfo[n++].value, sizeof(hw.mHWInfo[0].value), ifs[i].name);
+        hw.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw.mHWInfo[n++].value, &ifs[i].ip, 4);
+        hw.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw.mHWInfo[n++].value, ifs[i].mac, ETHER_ADDR_LEN);
+    }
+    len = 8 + n * sizeof(c_hw_entry);
+    hw.mLen = htonl(len);
+    hw.mType = htonl(VNSHWINFO);
+    return write_all(&hw, len);
+}
+
+static int handshake(void)
+{
+    uint8_t buf[4096];
+    c_auth_request* req = (c_auth_request*)buf;
+    c_auth_status* st = (c_auth_status*)buf;
+
+    req->mLen = htonl(sizeof(c_auth_request) + 8);
+    req->mType = htonl(VNS_AUTH_REQUEST);
+    memcpy(req->salt, "loadgen!", 8);
+    if(write_all(buf, sizeof(c_auth_request) + 8) != 0 ||
+       read_command(buf, sizeof(buf)) != VNS_AUTH_REPLY)
+    { return -1; }
+
+    st->mLen = htonl(sizeof(c_auth_status));
+    st->mType = htonl(VNS_AUTH_STATUS);
+    st->auth_ok = 1;
+    if(write_all(buf, sizeof(c_auth_status)) != 0 ||
+       read_command(buf, sizeof(buf)) != VNSOPEN)
+    { return -1; }
+
+    return send_hwinfo();
+}
+
+static void close_session(const char* why)
+{
+    c_close c;
+
+    memset(&c, 0, sizeof(c));
+    c.mLen = htonl(sizeof(c));
+    c.mType = htonl(VNSCLOSE);
+    copy_name(c.mErrorMessage, sizeof(c.mErrorMessage), why);
+    write_all(&c, sizeof(c));
+}
+
+/* VNSPACKET header and the frame after it, returns the message length */
+static unsigned int put_packet(uint8_t* out, const char* ifname,
+                               const uint8_t* frame, unsigned int len)
+{
+    c_packet_header* h = (c_packet_header*)out;
+
+    h->mLen = htonl(sizeof(c_packet_header) + len);
+    h->mType = htonl(VNSPACKET);
+    copy_name(h->mInterfaceName, sizeof(h->mInterfaceName), ifname);
+    if(frame)
+    { memcpy(out + sizeof(c_packet_header), frame, len); }
+    return sizeof(c_packet_header) + len;
+}
+
+/*-----------------------------------------------------------------------------
+ * Sender
+ *---------------------------------------------------------------------------*/
+
+/* Write the frame of packet seq, a UDP datagram of flow seq % nflows. */
+static void build_frame(uint8_t* f, uint32_t seq, struct lg_host* dst)
+{
+    struct sr_ethernet_hdr* e = (struct sr_ethernet_hdr*)f;
+    struct sr_ip_hdr* ip = (struct sr_ip_hdr*)(e + 1);
+    uint8_t* udp = (uint8_t*)(ip + 1);
+    struct lg_stamp st;
+    unsigned int ip_len = frame_len - sizeof(struct sr_ethernet_hdr);
+    uint16_t sport = LG_SPORT + seq % nflows;
+    uint32_t sum = 0;
+    unsigned int i;
+
+    memcpy(e->ether_dhost, source->iface->mac, ETHER_ADDR_LEN);
+    memcpy(e->ether_shost, source->mac, ETHER_ADDR_LEN);
+    e->ether_type = htons(ethertype_ip);
+
+    memset(ip, 0, sizeof(*ip));
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(ip_len);
+    ip->ip_id = htons((uint16_t)seq);
+    ip->ip_ttl = 64;
+    ip->ip_p = 17;
+    ip->ip_src = source->ip;
+    ip->ip_dst = dst->ip;
+    for(i = 0; i < 20; i += 2)
+    { sum += ((uint8_t*)ip)[i] << 8 | ((uint8_t*)ip)[i + 1]; }
+    while(sum >> 16)
+    { sum = (sum & 0xffff) + (sum >> 16); }
+    ip->ip_sum = htons((uint16_t)~sum);
+
+    udp[0] = sport >> 8;
+    udp[1] = sport & 0xff;
+    udp[2] = 0;
+    udp[3] = LG_DPORT;
+    udp[4] = (ip_len - 20) >> 8;
+    udp[5] = (ip_len - 20) & 0xff;
+    udp[6] = udp[7] = 0;    /* no UDP checksum */
+
+    st.magic = htonl(LG_MAGIC);
+    st.seq = htonl(seq);
+    st.sent_ns = now_ns();
+    memcpy(udp + 8, &st, sizeof(st));
+}
+
+static void* sender(void* arg)
+{
+    struct lg_host* dsts[LG_MAX_HOSTS];
+    unsigned int ndsts = 0, i, used, n;
+    uint8_t* buf;
+    uint8_t* out;
+    uint64_t now, end, due;
+    struct timespec nap;
+    uint32_t seq = 0;
+
+    for(i = 0; i < nhosts; i++)
+    {
+        if(&hosts[i] != source && hosts[i].iface)
+        { dsts[ndsts++] = &hosts[i]; }
+    }
+
+    buf = (uint8_t*)malloc(LG_BUF_SZ);
+    if(!buf || ndsts == 0)
+    {
+        fprintf(stderr, ndsts ? "out of memory\n" : "no hosts to send to\n");
+        pthread_mutex_lock(&arp_lock);
+        send_done = 1;
+        pthread_mutex_unlock(&arp_lock);
+        return 0;
+    }
+
+    send_start = now_ns();
+    end = send_start + (uint64_t)(duration * 1e9);
+    for(;;)
+    {
+        now = now_ns();
+        if((count && seq >= count) || (!count && now >= end))
+        { break; }
+
+        /* -- ARP replies first, then everything that is due, as one write -- */
+        pthread_mutex_lock(&arp_lock);
+        used = narp_pending * LG_ARP_MSG;
+        memcpy(buf, arp_pending, used);
+        narp_pending = 0;
+        pthread_mutex_unlock(&arp_lock);
+
+        due = rate > 0 ? (uint64_t)((now - send_start) * 1e-9 * rate) + 1 : ~0ull;
+        if(shm)
+        {
+            /* -- with -M the frames are built right in the ring -- */
+            if(used > 0 && write_all(buf, used) != 0)
+            { break; }
+            for(n = 0; seq < due && (!count || seq < count) && n < LG_SHM_BATCH;
+                n++, seq++)
+            {
+                if((out = sr_shm_reserve(shm)) == 0)
+                { break; }
+                build_frame(out + sizeof(c_packet_header), seq,
+                            dsts[(seq % nflows) % ndsts]);
+                put_packet(out, source->iface->name, 0, frame_len);
+            }
+            sr_shm_publish(shm);
+            if(sr_shm_closed(shm))
+            { break; }
+            used += n;
+        }
+        else
+        {
+            while(seq < due && (!count || seq < count) &&
+                  used + sizeof(c_packet_header) + frame_len <= LG_BUF_SZ)
+            {
+                build_frame(buf + used + sizeof(c_packet_header), seq,
+                            dsts[(seq % nflows) % ndsts]);
+                used += put_packet(buf + used, source->iface->name, 0, frame_len);
+                seq++;
+            }
+            if(used > 0 && write_all(buf, used) != 0)
+            { break; }
+        }
+
+        if(used == 0)
+        {
+            nap.tv_sec = 0;
+            nap.tv_nsec = 20000;
+            nanosleep(&nap, 0);
+        }
+    }
+
+    send_end = now_ns();
+    __atomic_store_n(&sent, seq, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&arp_lock);
+    send_done = 1;
+    pthread_mutex_unlock(&arp_lock);
+    free(buf);
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Receiver
+ *---------------------------------------------------------------------------*/
+
+static void answer_arp(const char* ifname, const uint8_t* f, unsigned int len)
+{
+    const struct sr_arp_hdr* a = (const struct sr_arp_hdr*)(f + sizeof(struct sr_ethernet_hdr));
+    uint8_t out[LG_ARP_MSG];
+    struct sr_ethernet_hdr* re = (struct sr_ethernet_hdr*)(out + sizeof(c_packet_header));
+    struct sr_arp_hdr* ra = (struct sr_arp_hdr*)(re + 1);
+    unsigned int h;
+
+    if(len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr))
+    { return; }
+    if(a->ar_op != htons(arp_op_request))
+    {
+        arp_replies++;
+        return;
+    }
+
+    for(h = 0; h < nhosts; h++)
+    {
+        if(hosts[h].ip == a->ar_tip)
+        { break; }
+    }
+    if(h == nhosts)
+    { return; }
+
+    memcpy(re->ether_dhost, a->ar_sha, ETHER_ADDR_LEN);
+    memcpy(re->ether_shost, hosts[h].mac, ETHER_ADDR_LEN);
+    re->ether_type = htons(ethertype_arp);
+    *ra = *a;
+    ra->ar_op = htons(arp_op_reply);
+    memcpy(ra->ar_sha, hosts[h].mac, ETHER_ADDR_LEN);
+    ra->ar_sip = hosts[h].ip;
+    memcpy(ra->ar_tha, a->ar_sha, ETHER_ADDR_LEN);
+    ra->ar_tip = a->ar_sip;
+
+    put_packet(out, ifname, 0, sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr));
+
+    /* -- the sender may be stuck in write() until we read more -- */
+    pthread_mutex_lock(&arp_lock);
+    if(!send_done)
+    {
+        if(narp_pending < LG_ARP_PENDING)
+        { memcpy(arp_pending + LG_ARP_MSG * narp_pending++, out, LG_ARP_MSG); }
+        pthread_mutex_unlock(&arp_lock);
+        return;
+    }
+    pthread_mutex_unlock(&arp_lock);
+    write_all(out, sizeof(out));
+}
+
+static void frame_in(const char* ifname, const uint8_t* f, unsigned int len,
+                     uint64_t now)
+{
+    const struct sr_ethernet_hdr* e = (const struct sr_ethernet_hdr*)f;
+    const struct sr_ip_hdr* ip = (const struct sr_ip_hdr*)(e + 1);
+    struct lg_stamp st;
+    uint64_t lat;
+
+    if(len >= sizeof(struct sr_ethernet_hdr) && e->ether_type == htons(ethertype_arp))
+    {
+        answer_arp(ifname, f, len);
+        return;
+    }
+
+    if(len < LG_MIN_FRAME || e->ether_type != htons(ethertype_ip) ||
+       ip->ip_p != 17 || ip->ip_hl != 5)
+    {
+        others++;
+        return;
+    }
+    memcpy(&st, f + sizeof(struct sr_ethernet_hdr) + 20 + 8, sizeof(st));
+    if(st.magic != htonl(LG_MAGIC))
+    {
+        others++;
+        return;
+    }
+
+    if(received++ == 0)
+    { recv_first = now; }
+    recv_last = now;
+    received_bytes += len;
+
+    lat = now - st.sent_ns;
+    if(lat > 0xffffffffu)
+    { lat = 0xffffffffu; }
+    lat_samples[nsamples++ % LG_SAMPLES] = (uint32_t)lat;
+}
+
+static void command_in(const uint8_t* cmd, unsigned int len, uint64_t now)
+{
+    if(ntohl(((const c_base*)cmd)->mType) == VNSPACKET &&
+       len >= sizeof(c_packet_header))
+    {
+        frame_in(((const c_packet_header*)cmd)->mInterfaceName,
+                 cmd + sizeof(c_packet_header),
+                 len - sizeof(c_packet_header), now);
+    }
+}
+
+/* Whether to stop receiving: everything sent has had time to come back. */
+static int drained(uint64_t now, uint64_t* deadline)
+{
+    int done;
+
+    pthread_mutex_lock(&arp_lock);
+    done = send_done;
+    pthread_mutex_unlock(&arp_lock);
+    if(!done)
+    { return 0; }
+
+    if(*deadline == 0)
+    { *deadline = now + LG_DRAIN_NS; }
+    return now >= *deadline ||
+           received >= __atomic_load_n(&sent, __ATOMIC_ACQUIRE);
+}
+
+/* receive() for -M: commands are read in place and their slots handed
+   back a batch at a time. */
+static void receive_shm(void)
+{
+    uint8_t* cmd;
+    uint64_t deadline = 0;
+    unsigned int len;
+
+    while(!drained(now_ns(), &deadline))
+    {
+        if((cmd = sr_shm_next(shm, 0)) == 0)
+        {
+            sr_shm_release(shm);
+            if((cmd = sr_shm_next(shm, 10)) == 0)
+            {
+                if(sr_shm_closed(shm))
+                {
+                    fprintf(stderr, "router closed the connection\n");
+                    break;
+                }
+                continue;
+            }
+        }
+
+        len = ntohl(((c_base*)cmd)->mLen);
+        if(len < 8 || len > SR_SHM_SLOT_SZ)
+        {
+            fprintf(stderr, "bad command length %u from the router\n", len);
+            break;
+        }
+        command_in(cmd, len, now_ns());
+        if(sr_shm_unreleased(shm) >= LG_SHM_BATCH)
+        { sr_shm_release(shm); }
+    }
+    sr_shm_release(shm);
+}
+
+/* Take frames from the router until everything sent has had time to
+   come back. */
+static void receive(void)
+{
+    uint8_t* buf;
+    unsigned int head = 0, tail = 0, len;
+    struct pollfd pfd;
+    uint64_t now, deadline = 0;
+    ssize_t n;
+
+    if(shm)
+    {
+        receive_shm();
+        return;
+    }
+
+    buf = (uint8_t*)malloc(LG_BUF_SZ);
+    if(!buf)
+    { return; }
+
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+
+    for(;;)
+    {
+        if(drained(now_ns(), &deadline))
+        { break; }
+
+        if(poll(&pfd, 1, 10) <= 0)
+        { continue; }
+        n = read(sockfd, buf + tail, LG_BUF_SZ - tail);
+        if(n < 0 && errno == EINTR)
+        { continue; }
+        if(n <= 0)
+        {
+            fprintf(stderr, "router closed the connection\n");
+            break;
+        }
+        tail += n;
+        now = now_ns();
+
+        while(tail - head >= 8)
+        {
+            len = ntohl(((c_base*)(buf + head))->mLen);
+            if(len < 8 || len > LG_BUF_SZ / 2)
+            {
+                fprintf(stderr, "bad command length %u from the router\n", len);
+                free(buf);
+                return;
+            }
+            if(tail - head < len)
+            { break; }
+            command_in(buf + head, len, now);
+            head += len;
+        }
+
+        /* -- keep the partial command at the front -- */
+        memmove(buf, buf + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+    free(buf);
+}
+
+/*-----------------------------------------------------------------------------
+ * Results
+ *---------------------------------------------------------------------------*/
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct(unsigned long n, double p)
+{
+    unsigned long i = (unsigned long)(n * p / 100.0);
+    return lat_samples[i < n ? i : n - 1] / 1000.0;
+}
+
+static void report(void)
+{
+    double send_secs = (send_end - send_start) / 1e9;
+    double recv_secs = (recv_last - recv_first) / 1e9;
+    unsigned long n = nsamples < LG_SAMPLES ? nsamples : LG_SAMPLES;
+    unsigned long lost = sent > received ? sent - received : 0;
+
+    printf("offered   %lu frames of %u bytes in %.3f s, %.0f pps %.1f Mbit/s\n",
+           sent, frame_len, send_secs, sent / send_secs,
+           sent * frame_len * 8 / send_secs / 1e6);
+    if(received > 1 && recv_secs > 0)
+    {
+        printf("forwarded %lu frames in %.3f s, %.0f pps %.1f Mbit/s\n",
+               received, recv_secs, received / recv_secs,
+               received_bytes * 8 / recv_secs / 1e6);
+    }
+    else
+    { printf("forwarded %lu frames\n", received); }
+    printf("lost      %lu (%.3f%%)\n", lost, sent ? 100.0 * lost / sent : 0.0);
+
+    if(n > 0)
+    {
+        qsort(lat_samples, n, sizeof(uint32_t), cmp_u32);
+        printf("latency   p50 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+               pct(n, 50), pct(n, 99), pct(n, 99.9), lat_samples[n - 1] / 1000.0);
+    }
+    if(others || arp_replies)
+    { printf("other     %lu frames, %lu ARP replies\n", others, arp_replies); }
+}
+
+/*-----------------------------------------------------------------------------
+ * main
+ *---------------------------------------------------------------------------*/
+
+static int wait_for_router(unsigned short port, const char* path)
+{
+    struct sockaddr_in sin;
+    struct sockaddr_un sun;
+    int lfd, fd, on = 1;
+
+    if(path)
+    {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        copy_name(sun.sun_path, sizeof(sun.sun_path), path);
+        unlink(path);
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(lfd < 0 || bind(lfd, (struct sockaddr*)&sun, sizeof(sun)) != 0)
+        {
+            perror(path);
+            return -1;
+        }
+    }
+    else
+    {
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(port);
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        if(lfd >= 0)
+        { setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)); }
+        if(lfd < 0 || bind(lfd, (struct sockaddr*)&sin, sizeof(sin)) != 0)
+        {
+            perror("bind");
+            return -1;
+        }
+    }
+
+    if(listen(lfd, 1) != 0 || (fd = accept(lfd, 0, 0)) < 0)
+    {
+        perror("accept");
+        return -1;
+    }
+    close(lfd);
+    if(path)
+    { unlink(path); }
+    else
+    { setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); }
+    return fd;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-p port | -U path | -M path] [-n flows] [-S frame bytes]\n"
+            "       [-R packets/sec] [-d secs | -c packets] [-i IP_CONFIG]\n"
+            "       [-r rtable] [-s source host]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned short port = DEFAULT_PORT;
+    const char* path = 0;
+    const char* shmpath = 0;
+    const char* ipconfig = DEFAULT_IPCONFIG;
+    const char* rtable = DEFAULT_RTABLE;
+    const char* src = DEFAULT_SOURCE;
+    pthread_t thread;
+    unsigned int i;
+    int c;
+
+    while((c = getopt(argc, argv, "hp:U:M:n:S:R:d:c:i:r:s:")) != -1)
+    {
+        switch(c)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'U': path = optarg; break;
+            case 'M': shmpath = optarg; break;
+            case 'n': nflows = atoi(optarg); break;
+            case 'S': frame_len = atoi(optarg); break;
+            case 'R': rate = atof(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'c': count = strtoul(optarg, 0, 10); break;
+            case 'i': ipconfig = optarg; break;
+            case 'r': rtable = optarg; break;
+            case 's': src = optarg; break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if(nflows == 0)
+    { nflows = 1; }
+    if(frame_len < LG_MIN_FRAME)
+    { frame_len = LG_MIN_FRAME; }
+    if(frame_len > LG_MAX_FRAME)
+    { frame_len = LG_MAX_FRAME; }
+
+    if(load_ipconfig(ipconfig) != 0 || place_hosts(rtable) != 0)
+    { return 1; }
+    for(i = 0; i < nhosts; i++)
+    {
+        if(strcmp(hosts[i].name, src) == 0)
+        { source = &hosts[i]; }
+    }
+    if(!source || !source->iface)
+    {
+        fprintf(stderr, "no usable source host %s\n", src);
+        return 1;
+    }
+
+    lat_samples = (uint32_t*)malloc(LG_SAMPLES * sizeof(uint32_t));
+    if(!lat_samples)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if(shmpath || path)
+    { printf("waiting for the router on %s\n", shmpath ? shmpath : path); }
+    else
+    { printf("waiting for the router on 127.0.0.1:%u\n", port); }
+    fflush(stdout);
+
+    if(shmpath)
+    {
+        if((shm = sr_shm_create(shmpath)) == 0)
+        { return 1; }
+        sr_shm_wait_attached(shm, -1);
+        unlink(shmpath);    /* -- both sides have it mapped now -- */
+        if(send_hwinfo() != 0)
+        {
+            fprintf(stderr, "router went away\n");
+            return 1;
+        }
+    }
+    else
+    {
+        if((sockfd = wait_for_router(port, path)) < 0)
+        { return 1; }
+        if(handshake() != 0)
+        {
+            fprintf(stderr, "handshake with the router failed\n");
+            return 1;
+        }
+    }
+
+    if(pthread_create(&thread, 0, sender, 0) != 0)
+    {
+        fprintf(stderr, "cannot start the sender\n");
+        return 1;
+    }
+    receive();
+    pthread_join(thread, 0);
+
+    report();
+    close_session("loadgen done");
+    if(shm)
+    { sr_shm_close(shm); }
+    else
+    { close(sockfd); }
+    free(lat_samples);
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,175 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.c
+ *
+ * Description:
+ *
+ * Logging ring and the thread that drains it, see sr_log.h.
+ *
+ * The ring is a bounded multi producer, single consumer queue: each slot
+ * carries a sequence number saying whose turn it is.  With lap the
+ * position pos rounded down to a multiple of SR_LOG_RING, a producer
+ * claims pos by moving tail on with a compare and swap once its slot
+ * shows seq == lap, fills it in and publishes it with seq = lap + 1.  The
+ * consumer takes it when it sees that, and hands the slot to the next lap
+ * with seq = lap + SR_LOG_RING.  An all-zero ring is ready for lap 0, so
+ * messages can be queued before the thread is started.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sr_log.h"
+
+struct sr_log_rec
+{
+    unsigned int seq;
+    int level;
+    struct timeval tv;
+    char msg[SR_LOG_MSG];
+};
+
+static struct sr_log_rec sr_log_ring[SR_LOG_RING];
+static unsigned int sr_log_tail;    /* next position to claim */
+static unsigned int sr_log_head;    /* consumer only */
+static unsigned long sr_log_drops;
+static int sr_log_running;
+static int sr_log_stopping;
+static pthread_t sr_log_thread;
+
+static const char sr_log_tags[] = "EWIDT";
+
+int sr_log_level = SR_LOG_LEVEL;
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_write(..)
+ * Scope:  Global
+ *
+ * Queue one message.  Use the sr_log() macro rather than calling this.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_write(int level, const char* fmt, ...)
+{
+    struct sr_log_rec* rec;
+    unsigned int pos, lap, seq;
+    va_list ap;
+
+    pos = __atomic_load_n(&sr_log_tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        rec = &sr_log_ring[pos & (SR_LOG_RING - 1)];
+        lap = pos & ~(SR_LOG_RING - 1);
+        seq = __atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE);
+        if ((int)(seq - lap) == 0)
+        {
+            if (__atomic_compare_exchange_n(&sr_log_tail, &pos, pos + 1, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            { break; }
+        }
+        else if ((int)(seq - lap) < 0)
+        {
+            /* -- full, the consumer is a lap behind -- */
+            __atomic_fetch_add(&sr_log_drops, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            pos = __atomic_load_n(&sr_log_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->level = level;
+    gettimeofday(&(rec->tv), 0);
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+
+    __atomic_store_n(&(rec->seq), lap + 1, __ATOMIC_RELEASE);
+} /* -- sr_log_write -- */
+
+/* Write out whatever has been published.  Returns the number written. */
+static int sr_log_drain(void)
+{
+    struct sr_log_rec* rec;
+    unsigned int lap;
+    int n = 0;
+
+    for (;;)
+    {
+        rec = &sr_log_ring[sr_log_head & (SR_LOG_RING - 1)];
+        lap = sr_log_head & ~(SR_LOG_RING - 1);
+        if (__atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE) != lap + 1)
+        { break; }
+
+        fprintf(stderr, "%ld.%06ld %c %s", (long)rec->tv.tv_sec,
+                (long)rec->tv.tv_usec, sr_log_tags[rec->level], rec->msg);
+
+        __atomic_store_n(&(rec->seq), lap + SR_LOG_RING, __ATOMIC_RELEASE);
+        sr_log_head++;
+        n++;
+    }
+
+    if (n)
+    { fflush(stderr); }
+    return n;
+}
+
+static void* sr_log_main(void* arg)
+{
+    struct timespec idle;
+
+    idle.tv_sec = 0;
+    idle.tv_nsec = 10 * 1000 * 1000;
+
+    while (!__atomic_load_n(&sr_log_stopping, __ATOMIC_ACQUIRE))
+    {
+        if (sr_log_drain() == 0)
+        { nanosleep(&idle, 0); }
+    }
+    sr_log_drain();
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_start(..)
+ * Scope:  Global
+ *
+ * Start the thread that writes messages out.  Messages logged before
+ * this are kept (up to SR_LOG_RING of them) and written once it runs.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_log_start(void)
+{
+    if (pthread_create(&sr_log_thread, 0, sr_log_main, 0) != 0)
+    { return -1; }
+    sr_log_running = 1;
+
+    return 0;
+} /* -- sr_log_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_log_stop(..)
+ * Scope:  Global
+ *
+ * Write out what is queued and stop the thread.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_log_stop(void)
+{
+    if (!sr_log_running)
+    { return; }
+
+    __atomic_store_n(&sr_log_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(sr_log_thread, 0);
+    sr_log_running = 0;
+
+    if (sr_log_drops)
+    { fprintf(stderr, "log ring full, %lu messages dropped\n", sr_log_drops); }
+} /* -- sr_log_stop -- */
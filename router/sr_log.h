@@ -0,0 +1,54 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_log.h
+ *
+ * Description:
+ *
+ * Leveled logging for the packet path.
+ *
+ *   sr_log(SR_LOG_DEBUG, "no route to " SR_IP_FMT "\n", SR_IP_ARGS(ip));
+ *
+ * Messages above SR_LOG_LEVEL (set with 'make LOG_LEVEL=n') are compiled
+ * out, arguments and all.  The rest are checked against the runtime level
+ * (-L), formatted into a slot of a lock-free ring and written to stderr by
+ * a background thread, so the calling thread never waits on stdio.  When
+ * the ring is full the message is dropped and counted rather than
+ * blocking.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#define SR_LOG_ERR   0
+#define SR_LOG_WARN  1
+#define SR_LOG_INFO  2
+#define SR_LOG_DEBUG 3
+#define SR_LOG_TRACE 4
+
+#ifndef SR_LOG_LEVEL
+#define SR_LOG_LEVEL SR_LOG_INFO
+#endif
+
+#define SR_LOG_RING 4096    /* messages, power of 2 */
+#define SR_LOG_MSG  240     /* longer messages are truncated */
+
+/* dotted quad of an address in network byte order */
+#define SR_IP_FMT "%u.%u.%u.%u"
+#define SR_IP_ARGS(ip) \
+    ((const unsigned char*)&(ip))[0], ((const unsigned char*)&(ip))[1], \
+    ((const unsigned char*)&(ip))[2], ((const unsigned char*)&(ip))[3]
+
+#define sr_log(level, fmt, args...) \
+    do { \
+        if ((level) <= SR_LOG_LEVEL && (level) <= sr_log_level) \
+        { sr_log_write((level), fmt, ## args); } \
+    } while (0)
+
+extern int sr_log_level;    /* runtime threshold, SR_LOG_LEVEL by default */
+
+void sr_log_write(int level, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int  sr_log_start(void);
+void sr_log_stop(void);
+
+#endif /* -- SR_LOG_H -- */
@@ -29,10 +29,18 @@
 #include <getopt.h>
 #endif /* _LINUX_ */
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
 #include "sr_router.h"
 #include "sr_rt.h"
 #include "sr_nat.h"
+#include "sr_worker.h"
+#include "sr_cksum.h"
+#include "sr_log.h"
+#include "sr_ctl.h"
+#include "sr_lat.h"
+#include "sr_shm.h"
+#include "sr_afpacket.h"
+#include "sr_xdp.h"
 
 extern char* optarg;
 
@@ -66,12 +74,25 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *ctlpath = 0;
+    char *shmpath = 0;
+    char *kifs[SR_AFPACKET_MAX_IFS];
+    unsigned int nkifs = 0;
+    int xdp = 0;
+    unsigned int snaplen = PACKET_DUMP_SIZE;
+    unsigned long rotate_mb = 0;
+    unsigned int rotate_secs = 0;
+    unsigned int arpcache_size = SR_ARPCACHE_SZ;
+    unsigned int nworkers = 0;
+    int latency = 0;
+    struct in_addr natpool[SR_NAT_MAX_EXTIPS];
+    unsigned int nnatpool = 0, i;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
     sr.nat_enabled = 0;
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:nI:E:R:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:S:C:G:T:nI:E:R:X:a:w:L:c:PM:K:x")) != EOF)
     {
         switch (c)
         {
@@ -97,6 +118,17 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'S':
+                snaplen = atoi((char *) optarg);
+                if(snaplen == 0 || snaplen > IP_MAXPACKET)
+                { snaplen = IP_MAXPACKET; }
+                break;
+            case 'C':
+                rotate_mb = strtoul((char *) optarg, 0, 10);
+                break;
+            case 'G':
+                rotate_secs = atoi((char *) optarg);
+                break;
             case 'r':
                 rtable = optarg;
                 break;
@@ -118,11 +150,72 @@ int main(int argc, char **argv)
 			case 'R':
 				sr.nat.TCP_transitory_timeout = atoi((char *) optarg);
 				break;				
+            case 'X':
+                if (nnatpool == SR_NAT_MAX_EXTIPS ||
+                    inet_aton(optarg, &natpool[nnatpool]) == 0)
+                {
+                    fprintf(stderr,"Bad or too many NAT addresses: %s\n", optarg);
+                    exit(1);
+                }
+                nnatpool++;
+                break;
+            case 'a':
+                arpcache_size = atoi((char *) optarg);
+                break;
+            case 'w':
+                nworkers = atoi((char *) optarg);
+                break;
+            case 'c':
+                ctlpath = optarg;
+                break;
+            case 'P':
+                latency = 1;
+                break;
+            case 'M':
+                shmpath = optarg;
+                break;
+            case 'K':
+                if (nkifs == SR_AFPACKET_MAX_IFS)
+                {
+                    fprintf(stderr,"Too many interfaces: %s\n", optarg);
+                    exit(1);
+                }
+                kifs[nkifs++] = optarg;
+                break;
+            case 'x':
+                xdp = 1;
+                break;
+            case 'L':
+                sr_log_level = atoi((char *) optarg);
+                if(sr_log_level > SR_LOG_LEVEL)
+                {
+                    fprintf(stderr, "Log level %d not compiled in, using %d "
+                            "(rebuild with make LOG_LEVEL=%d)\n",
+                            sr_log_level, SR_LOG_LEVEL, sr_log_level);
+                    sr_log_level = SR_LOG_LEVEL;
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
+    if(sr_log_start() != 0)
+    {
+        fprintf(stderr,"Error starting the log thread\n");
+        exit(1);
+    }
+
+    /* -- pick the checksum kernel before any thread can use it -- */
+    Debug("Using %s checksum\n", sr_cksum_init());
+
+    if(latency && sr_lat_init() != 0)
+    {
+        fprintf(stderr,"Error calibrating the latency clock\n");
+        exit(1);
+    }
+
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    sr.arpcache_size = arpcache_size;
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -143,8 +236,9 @@ int main(int argc, char **argv)
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr.capture = sr_capture_open(logfile, snaplen,
+                                     rotate_mb * 1000000, rotate_secs);
+        if(!sr.capture)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -152,16 +246,39 @@ int main(int argc, char **argv)
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
+    if(nkifs > 0)
+    {
+        /* -- real Linux interfaces, which the kernel describes for us -- */
+        Debug("Client %s using %u Linux interfaces%s\n", sr.user, nkifs,
+              xdp ? " over AF_XDP" : "");
+        if((xdp ? sr_connect_to_xdp(&sr, kifs, nkifs) :
+                  sr_connect_to_afpacket(&sr, kifs, nkifs)) == -1)
+        {
+            return 1;
+        }
+    }
+    else if(shmpath != 0)
+    {
+        /* -- a local peer instead of a server, no session to negotiate -- */
+        Debug("Client %s attaching to %s\n", sr.user, shmpath);
+        if(sr_connect_to_shm(&sr, shmpath) == -1)
+        {
+            return 1;
+        }
+    }
     else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
     {
-        return 1;
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
     }
 
     if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
@@ -181,15 +298,45 @@ int main(int argc, char **argv)
             exit(1);
 		}
 		printf("Yay!\n");
-                /* Set next port */
-		sr.nat.next_port = 1024;
+		/* External address pool, if any */
+		for (i = 0; i < nnatpool; i++) {
+			if (sr_nat_add_external_ip(&(sr.nat), natpool[i].s_addr) != 0) {
+				fprintf(stderr,"Error adding NAT address %s\n", inet_ntoa(natpool[i]));
+				exit(1);
+			}
+		}
 		printf("I HATE THIS\n");
 	}
 	
 	
+    /* -- hand forwarding to worker threads if asked to -- */
+    if(sr_workers_start(&sr, nworkers) != 0)
+    {
+        fprintf(stderr,"Error starting %u forwarding workers\n", nworkers);
+        exit(1);
+    }
+
+    if(ctlpath != 0)
+    {
+        sr.ctl = sr_ctl_start(&sr, ctlpath);
+        if(!sr.ctl)
+        {
+            fprintf(stderr,"Error starting control socket %s\n", ctlpath);
+            exit(1);
+        }
+    }
+
     /* -- whizbang main loop ;-) */
     while( sr_read_from_server(&sr) == 1);
 
+    sr_ctl_stop(sr.ctl);
+    sr.ctl = 0;
+    sr_workers_stop(&sr);
+    sr_print_stats(&sr);
+    if(sr_lat_enabled)
+    { sr_lat_print(stderr); }
+    sr_log_stop();
+
     sr_destroy_instance(&sr);
 
     return 0;
@@ -206,7 +353,15 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file [-S snaplen] [-C rotate MB] [-G rotate secs]] \n");
+    printf("           [-a arp cache entries] \n");
+    printf("           [-w forwarding worker threads] [-L log level 0-4] \n");
+    printf("           [-c control socket path] [-P stage latencies] \n");
+    printf("           [-M shared memory path, instead of a server] \n");
+    printf("           [-K linux interface[=ip]]... [-x] (instead of a server) \n");
+    printf("   -x uses AF_XDP for the -K interfaces \n");
+    printf("           [-n [-X NAT pool address]...] \n");
+    printf("   a server containing '/' is the path of a UNIX socket \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -248,11 +403,22 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    /* -- nothing may send, or log what it sends, from here on; the
+          workers are already stopped -- */
+    sr_stop(sr);
+
+    if(sr->capture)
     {
-        sr_dump_close(sr->logfile);
+        sr_capture_close(sr->capture);
+        sr->capture = 0;
     }
 
+    sr_shm_close(sr->shm);
+    sr_afpacket_close(sr);
+    sr_xdp_close(sr);
+    free(sr->rxbuf);
+    free(sr->tx.buf);
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -271,12 +437,25 @@ static void sr_init_instance(struct sr_instance* sr)
     assert(sr);
 
     sr->sockfd = -1;
+    sr->transport = 0;
+    sr->shm = 0;
+    sr->afp = 0;
+    sr->xdp = 0;
+    sr->rxbuf = 0;
+    sr->rx_head = sr->rx_tail = 0;
+    memset(&(sr->tx), 0, sizeof(sr->tx));
+    pthread_mutex_init(&(sr->tx_wlock), 0);
+    sr->nworkers = 0;
+    sr->workers = 0;
     sr->user[0] = 0;
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
+    sr->fib = 0;
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr->capture = 0;
+    sr->ctl = 0;
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -6,8 +6,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include "sr_utils.h"
 #include "sr_if.h"
+#include "sr_stats.h"
+
+/* Seconds a connection may stay idle in its current state */
+static int nat_conn_timeout(struct sr_nat *nat, struct sr_nat_connection *conn) {
+	return conn->state == nat_conn_state_established ?
+		nat->TCP_established_timeout : nat->TCP_transitory_timeout;
+}
+
+/* Note activity on a mapping that keeps it alive for another timeout
+   seconds. The expiry only ever moves later, so a short lived TCP
+   connection can't cut short an established one on the same mapping.
+   Called with nat->lock held. */
+static void nat_touch(struct sr_nat *nat, struct sr_nat_mapping *mapping, int timeout) {
+	time_t now = time(NULL);
+
+	mapping->last_updated = now;
+	if (!sr_timer_pending(&(mapping->timer)) ||
+	    (uint64_t)(now + timeout) > mapping->timer.expires) {
+		sr_twheel_schedule(&(nat->wheel), &(mapping->timer), now + timeout);
+	}
+}
 
 int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
 
@@ -18,6 +40,23 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
   pthread_mutexattr_settype(&(nat->attr), PTHREAD_MUTEX_RECURSIVE);
   int success = pthread_mutex_init(&(nat->lock), &(nat->attr));
 
+  /* Initialize any variables here, before the timeout thread sees them */
+  nat->internal_iface = NULL;
+  nat->nextips = 0;
+  nat->npool = 0;
+  nat->nbuckets = SR_NAT_MIN_BUCKETS;
+  nat->count = 0;
+  nat->by_int = calloc(nat->nbuckets, sizeof(struct sr_nat_mapping *));
+  nat->by_ext = calloc(nat->nbuckets, sizeof(struct sr_nat_mapping *));
+  if (nat->by_int == NULL || nat->by_ext == NULL) {
+    return -1;
+  }
+  sr_twheel_init(&(nat->wheel), time(NULL));
+  sr_twheel_init(&(nat->syn_wheel), time(NULL));
+  nat->syn_due = NULL;
+  nat->nsyns = 0;
+  nat->stop = 0;
+
   /* Initialize timeout thread */
 
   pthread_attr_init(&(nat->thread_attr));
@@ -28,25 +67,64 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
 
   /* CAREFUL MODIFYING CODE ABOVE THIS LINE! */
 
-  nat->mappings = NULL;
-  /* Initialize any variables here */
-  /* TODO */
-
   return success;
 }
 
-sr_nat_ip_position * sr_nat_get_ip_positions(struct sr_instance *sr, struct sr_ip_hdr* ip_hdr, char* interface) {
-	static sr_nat_ip_position result[2];
+/* Keep a copy of an unsolicited SYN to answer SR_NAT_SYN_DELAY seconds
+   from now. Called with nat->lock held. */
+static int nat_syn_hold(struct sr_instance *sr, uint8_t *packet, struct sr_if *iface,
+	uint32_t ip_ext, uint16_t aux_ext) {
+	struct sr_nat *nat = &(sr->nat);
+	struct sr_ip_hdr *ip_hdr = (struct sr_ip_hdr *)(packet + sizeof(struct sr_ethernet_hdr));
+	struct sr_nat_syn *syn;
+
+	if (nat->nsyns >= SR_NAT_MAX_SYNS) {
+		return -1;
+	}
+	syn = (struct sr_nat_syn *) malloc(sizeof(struct sr_nat_syn));
+	if (syn == NULL) {
+		return -1;
+	}
+	syn->sr = sr;
+	syn->iface = iface;
+	syn->ip_ext = ip_ext;
+	syn->aux_ext = aux_ext;
+	syn->len = sizeof(struct sr_ethernet_hdr) + ntohs(ip_hdr->ip_len);
+	if (syn->len > SR_NAT_SYN_COPY) {
+		syn->len = SR_NAT_SYN_COPY;
+	}
+	memcpy(syn->frame, packet, syn->len);
+	syn->timer.next = NULL;
+	sr_twheel_schedule(&(nat->syn_wheel), &(syn->timer), time(NULL) + SR_NAT_SYN_DELAY);
+	nat->nsyns++;
+	return 0;
+}
+
+/* Fills in and returns result (caller's storage, so workers don't share it) */
+sr_nat_ip_position * sr_nat_get_ip_positions(struct sr_instance *sr, struct sr_ip_hdr* ip_hdr, struct sr_if* interface, sr_nat_ip_position result[2]) {
 	struct sr_if* currInterface = 0;
+	unsigned int i;
+	struct sr_if* internal_iface = __atomic_load_n(&(sr->nat.internal_iface), __ATOMIC_ACQUIRE);
 	
+	if (internal_iface == NULL) {
+		internal_iface = sr_get_interface(sr, NAT_INTERNAL_IFACE);
+		__atomic_store_n(&(sr->nat.internal_iface), internal_iface, __ATOMIC_RELEASE);
+	}
+
 	/* Source is either type nat_position_host or nat_position_outside */
-	if (strncmp(interface, "eth1", 4) == 0) {
+	if (interface == internal_iface) {
 		result[0] = nat_position_host;
 	} else {
 		result[0] = nat_position_server;
 	}
 	
-	/* Destination is can be any position */
+	/* Destination is can be any position; pool addresses count as ours */
+	for (i = 0; i < sr->nat.npool; i++) {
+		if (sr->nat.extips[i].ip == ip_hdr->ip_dst) {
+			result[1] = nat_position_interface;
+			return result;
+		}
+	}
 	currInterface = sr->if_list;
 	while (currInterface != NULL) {
 		if (currInterface->ip == ip_hdr->ip_dst) {
@@ -61,13 +139,15 @@ sr_nat_ip_position * sr_nat_get_ip_positions(struct sr_instance *sr, struct sr_i
 	return result;
 }
 
-int sr_nat_update_headers(struct sr_instance **sr, uint8_t **packet, char* interface) {
-	uint16_t target_port, source_port, tempChecksum;
-	sr_nat_ip_position *ip_positions, source_ip_position, dest_ip_position;
+int sr_nat_update_headers(struct sr_instance **sr, uint8_t **packet, struct sr_if* interface) {
+	uint16_t target_port, source_port, old_port;
+	uint32_t old_ip;
+	sr_nat_ip_position ip_positions[2], source_ip_position, dest_ip_position;
 	struct sr_nat_mapping *lookup_result;
 	sr_nat_mapping_type mapping_type;
 	struct sr_icmp_t8_hdr* icmp_hdr;
 	struct sr_tcp_hdr* tcp_hdr;
+	struct sr_if* ext_iface;
 	
 	struct sr_ip_hdr* ip_hdr = (struct sr_ip_hdr*)(*packet + sizeof(struct sr_ethernet_hdr));
 	int ip_size = 4 * ip_hdr->ip_hl;
@@ -85,112 +165,135 @@ int sr_nat_update_headers(struct sr_instance **sr, uint8_t **packet, char* inter
 	}
 
 	/* Determine whether src and dst are inside or outside to the NAT box */
-	ip_positions = sr_nat_get_ip_positions(*sr, ip_hdr, interface);
+	sr_nat_get_ip_positions(*sr, ip_hdr, interface, ip_positions);
 	source_ip_position = ip_positions[0];
 	dest_ip_position = ip_positions[1];
 
+	/* Mappings are only valid while the lock is held */
+	pthread_mutex_lock(&((*sr)->nat.lock));
+
 	/* From server to NAT hosts */
 	if (source_ip_position == nat_position_server && dest_ip_position == nat_position_interface) {
-		lookup_result = sr_nat_lookup_external(&((*sr)->nat), ntohs(target_port), mapping_type);
+		lookup_result = sr_nat_lookup_external(&((*sr)->nat), ip_hdr->ip_dst, ntohs(target_port), mapping_type);
 		
-		/* Drop packet if no mapping exists */
+		/* No mapping: the frame is for us, and is answered as such, but an
+		   unsolicited SYN to a port we hand out only after a while */
 		if (lookup_result == NULL) {
-			if(ntohs(target_port) >= 1024){
-				sleep(6.0);
+			if (mapping_type == nat_mapping_tcp && ntohs(target_port) >= 1024) {
+				if (nat_syn_hold(*sr, *packet, interface, ip_hdr->ip_dst, ntohs(target_port)) != 0) {
+					sr_stats_drop(SR_DROP_NAT_MISS);
+				}
+				pthread_mutex_unlock(&((*sr)->nat.lock));
+				return -1;
 			}
-
+			pthread_mutex_unlock(&((*sr)->nat.lock));
 			return 0;
 		}
 		
 		/* Replace destination IP */
+		old_ip = ip_hdr->ip_dst;
 		ip_hdr->ip_dst = lookup_result->ip_int;
+		ip_hdr->ip_sum = cksum_adjust32(ip_hdr->ip_sum, old_ip, ip_hdr->ip_dst);
 		
-		/* Replace dest port */
+		/* Replace dest port, patching the checksum rather than summing the payload */
 		if (mapping_type == nat_mapping_icmp) {
+			nat_touch(&((*sr)->nat), lookup_result, (*sr)->nat.ICMP_timeout);
+			old_port = icmp_hdr->icmp_id;
 			icmp_hdr->icmp_id = lookup_result->aux_int;
-			/* Recalculate checksum here */
-			icmp_hdr->icmp_sum = 0;
-			tempChecksum = cksum(icmp_hdr, ntohs(ip_hdr->ip_len) - ip_size);
-			icmp_hdr->icmp_sum = tempChecksum;
+			icmp_hdr->icmp_sum = cksum_adjust16(icmp_hdr->icmp_sum, old_port, icmp_hdr->icmp_id);
 		} else {
+			old_port = tcp_hdr->tcp_dst_port;
 			tcp_hdr->tcp_dst_port = lookup_result->aux_int;
 			add_connection(&((*sr)->nat), lookup_result, ip_hdr->ip_src, 1);
-			/* Recalculate checksum here */
-			tcp_hdr->tcp_checksum = 0;
-			tempChecksum = cksum(tcp_hdr, ntohs(ip_hdr->ip_len) - ip_size);
-			tcp_hdr->tcp_checksum = tempChecksum;
+			/* The TCP checksum covers the address too, through the pseudo-header */
+			tcp_hdr->tcp_checksum = cksum_adjust32(tcp_hdr->tcp_checksum, old_ip, ip_hdr->ip_dst);
+			tcp_hdr->tcp_checksum = cksum_adjust16(tcp_hdr->tcp_checksum, old_port, tcp_hdr->tcp_dst_port);
 		}
 
 	/* From NAT hosts to server */
 	} else if (source_ip_position == nat_position_host && dest_ip_position == nat_position_server) { 
 		lookup_result = sr_nat_lookup_internal(&((*sr)->nat), ip_hdr->ip_src, source_port, mapping_type);
 
-		/* If no existing mapping, make one */
+		/* If no existing mapping, make one on the interface it leaves by */
 		if (lookup_result == NULL) {
+			ext_iface = longestPrefixMatch(*sr, ip_hdr->ip_dst);
+			if (ext_iface != NULL) {
+				(*sr)->nat.ip_ext = ext_iface->ip;
+			}
 			lookup_result = sr_nat_insert_mapping(&((*sr)->nat), ip_hdr->ip_src, source_port, mapping_type);
+			if (lookup_result == NULL) {
+				pthread_mutex_unlock(&((*sr)->nat.lock));
+				sr_stats_drop(SR_DROP_NAT_MISS);
+				return -1;
+			}
 		}
 		
 
 		/* Replace source IP */
+		old_ip = ip_hdr->ip_src;
 		ip_hdr->ip_src = lookup_result->ip_ext;
+		ip_hdr->ip_sum = cksum_adjust32(ip_hdr->ip_sum, old_ip, ip_hdr->ip_src);
 		
 		/* Replace src port */
 		if (mapping_type == nat_mapping_icmp) {
+			nat_touch(&((*sr)->nat), lookup_result, (*sr)->nat.ICMP_timeout);
+			old_port = icmp_hdr->icmp_id;
 			icmp_hdr->icmp_id = ntohs(lookup_result->aux_ext); 
-			icmp_hdr->icmp_sum = 0;
-			tempChecksum = cksum(icmp_hdr, ntohs(ip_hdr->ip_len) - ip_size);
-			icmp_hdr->icmp_sum = tempChecksum;
+			icmp_hdr->icmp_sum = cksum_adjust16(icmp_hdr->icmp_sum, old_port, icmp_hdr->icmp_id);
 		} else {
+			old_port = tcp_hdr->tcp_src_port;
 			tcp_hdr->tcp_src_port = ntohs(lookup_result->aux_ext);
 			add_connection(&((*sr)->nat), lookup_result, ip_hdr->ip_dst, 0);
-			tcp_hdr->tcp_checksum = 0;
-			tempChecksum = cksum(tcp_hdr, ntohs(ip_hdr->ip_len) - ip_size);
-			tcp_hdr->tcp_checksum = tempChecksum;
+			tcp_hdr->tcp_checksum = cksum_adjust32(tcp_hdr->tcp_checksum, old_ip, ip_hdr->ip_src);
+			tcp_hdr->tcp_checksum = cksum_adjust16(tcp_hdr->tcp_checksum, old_port, tcp_hdr->tcp_src_port);
 		}
 	}
 
-	/* free(lookup_result); */
+	pthread_mutex_unlock(&((*sr)->nat.lock));
 	return 0;
 }
 
 struct sr_nat_connection *add_connection(struct sr_nat *nat, struct sr_nat_mapping *mapping, uint32_t server_ip, int initializer){
 	/* Initializer: (0) NAT Host, (1) Server */
+	struct sr_nat_connection *conn, **pp;
+	time_t now = time(NULL);
+
 	pthread_mutex_lock(&(nat->lock));
 	
-	struct sr_nat_connection *new_conn = malloc(sizeof(struct sr_nat_connection));
-	new_conn->server_ip = server_ip;
-	new_conn->last_updated = time(NULL);
-	new_conn->state = nat_conn_state_transitory;
-	new_conn->next = NULL;
-	
-	struct sr_nat_connection *conn = mapping->conns;
-	
-	if (conn == NULL){
-		mapping->conns = new_conn;
-		pthread_mutex_unlock(&(nat->lock));
-		return new_conn;
-	}
-		
-	while (conn) {
+	pp = &(mapping->conns);
+	while ((conn = *pp) != NULL) {
 		if (conn->server_ip == server_ip) {
-			conn->last_updated = time(NULL);
-			if (initializer == 0) {
-				conn->state = nat_conn_state_established;
-			}
-			free(new_conn);
-			pthread_mutex_unlock(&(nat->lock));
-			return conn;
+			break;
 		}
-		if (conn->next == NULL){
-			conn->next = new_conn;
+		/* Drop connections that have timed out while we're here */
+		if (difftime(now, conn->last_updated) >= nat_conn_timeout(nat, conn)) {
+			*pp = conn->next;
+			free(conn);
+			continue;
+		}
+		pp = &(conn->next);
+	}
+
+	if (conn == NULL) {
+		conn = malloc(sizeof(struct sr_nat_connection));
+		if (conn == NULL) {
 			pthread_mutex_unlock(&(nat->lock));
-			return new_conn;
+			return NULL;
 		}
-		conn = conn->next;
+		conn->server_ip = server_ip;
+		conn->state = nat_conn_state_transitory;
+		conn->next = NULL;
+		*pp = conn;
+	} else if (initializer == 0) {
+		conn->state = nat_conn_state_established;
 	}
+	conn->last_updated = now;
+
+	/* The mapping lives as long as its longest lived connection */
+	nat_touch(nat, mapping, nat_conn_timeout(nat, conn));
+
 	pthread_mutex_unlock(&(nat->lock));
-	/* Should never get here */
-	return NULL;
+	return conn;
 }
 
 int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
@@ -206,148 +309,399 @@ int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
 
 }
 
+/* Wheel callback: a mapping has been idle for its whole timeout */
+static void nat_expire(struct sr_timer *timer, void *arg) {
+	struct sr_nat_mapping *mapping = (struct sr_nat_mapping *)
+		((char *)timer - offsetof(struct sr_nat_mapping, timer));
+
+	sr_nat_remove_mapping((struct sr_nat *)arg, mapping);
+}
+
+/* Wheel callback: an unsolicited SYN has waited long enough. It is
+   answered unless an outbound SYN has opened its mapping meanwhile. */
+static void nat_syn_expire(struct sr_timer *timer, void *arg) {
+	struct sr_nat *nat = (struct sr_nat *)arg;
+	struct sr_nat_syn *syn = (struct sr_nat_syn *)
+		((char *)timer - offsetof(struct sr_nat_syn, timer));
+
+	nat->nsyns--;
+	if (sr_nat_lookup_external(nat, syn->ip_ext, syn->aux_ext, nat_mapping_tcp) != NULL) {
+		free(syn);
+		return;
+	}
+	syn->next = nat->syn_due;
+	nat->syn_due = syn;
+}
+
+/* Send a port unreachable for every SYN on the list, and free them. */
+static void nat_syn_answer(struct sr_nat_syn *syn) {
+	struct sr_nat_syn *next;
+	struct sr_instance *sr = NULL;
+
+	for ( ; syn != NULL; syn = next) {
+		next = syn->next;
+		sr = syn->sr;
+		create_send_icmpMessage(sr, syn->frame, syn->len, 3, 3, syn->iface);
+		free(syn);
+	}
+	if (sr != NULL) {
+		sr_flush_packets(sr);
+	}
+}
+
 void *sr_nat_timeout(void *nat_ptr) {  /* Periodic Timout handling */
- /* struct sr_nat *nat = (struct sr_nat *)nat_ptr;
-  struct sr_nat_mapping *mappings, *prev_mapping = NULL;
-  
+  struct sr_nat *nat = (struct sr_nat *)nat_ptr;
+  struct sr_nat_syn *due;
+  time_t now;
+
   while (1) {
     sleep(1.0);
+    if (__atomic_load_n(&(nat->stop), __ATOMIC_ACQUIRE)) {
+      break;
+    }
+    now = time(NULL);
     pthread_mutex_lock(&(nat->lock));
 
-    time_t curtime = time(NULL);
-
-    * handle periodic tasks here *
-    mappings = nat->mappings;
-    while (mappings != NULL) {
-		if (mappings->type == nat_mapping_icmp){
-			* ICMP Timeout *
-			if (difftime(curtime, mappings->last_updated) >= nat->ICMP_timeout) {
-				if (prev_mapping == NULL){
-					nat->mappings = mappings->next;
-					free(mappings);
-					mappings = nat->mappings;
-				} else {
-					prev_mapping->next = mappings->next;
-					free(mappings);
-					mappings = prev_mapping->next;
-				}
-			} else {
-				prev_mapping = mappings;
-				mappings = mappings->next;
-			}
-		} else if (mappings->type == nat_mapping_tcp) {
-			* jhfjkkkkkkkkkkkkkkkkkgjhfkjlhjfgkf   k  hkfgjkh j *
-		}
-	}
-    
+    /* handle periodic tasks here; only mappings that are due are visited */
+    sr_twheel_advance(&(nat->wheel), now, nat_expire, nat);
+    sr_twheel_advance(&(nat->syn_wheel), now, nat_syn_expire, nat);
+    due = nat->syn_due;
+    nat->syn_due = NULL;
+
     pthread_mutex_unlock(&(nat->lock));
-  }*/
+
+    /* the replies may wait on other locks, so send them outside ours */
+    nat_syn_answer(due);
+  }
   return NULL;
 }
 
-/* Get the mapping associated with given external port.
-   You must free the returned structure if it is not NULL. */
-struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
-    uint16_t aux_ext, sr_nat_mapping_type type ) {
-	struct sr_nat_mapping *currMapping = nat->mappings;
+/* Have the timeout thread finish its current round and wait for it, so
+   it sends nothing after this returns. */
+void sr_nat_stop(struct sr_nat *nat) {
+  __atomic_store_n(&(nat->stop), 1, __ATOMIC_RELEASE);
+  pthread_join(nat->thread, NULL);
+}
 
-	pthread_mutex_lock(&(nat->lock));
+/* Set up a port pool with every port free, lowest first. */
+static int nat_portpool_init(struct sr_nat_portpool *pool) {
+	unsigned int i;
 
-	/* handle lookup here, malloc and assign to copy */
-	struct sr_nat_mapping *copy = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
+	pool->ring = malloc(SR_NAT_NPORTS * sizeof(uint16_t));
+	if (pool->ring == NULL) {
+		return -1;
+	}
+	for (i = 0; i < SR_NAT_NPORTS; i++) {
+		pool->ring[i] = SR_NAT_PORT_MIN + i;
+	}
+	pool->head = 0;
+	pool->count = SR_NAT_NPORTS;
+	memset(pool->in_use, 0, sizeof(pool->in_use));
+	return 0;
+}
 
-	if (currMapping != NULL) {
-		memcpy(copy, currMapping, sizeof(struct sr_nat_mapping));
-	} else {
-		pthread_mutex_unlock(&(nat->lock));
-		return NULL;
+/* Take the free port that has been free the longest. Returns 0 if none. */
+static uint16_t nat_port_alloc(struct sr_nat_portpool *pool) {
+	uint16_t port;
+	unsigned int bit;
+
+	if (pool->count == 0) {
+		return 0;
 	}
-	  
-	while (copy != NULL) {
-		if (copy->aux_ext == aux_ext) {
-			break;
+	port = pool->ring[pool->head];
+	pool->head = (pool->head + 1) % SR_NAT_NPORTS;
+	pool->count--;
+
+	bit = port - SR_NAT_PORT_MIN;
+	pool->in_use[bit / 8] |= 1 << (bit % 8);
+	return port;
+}
+
+static void nat_port_free(struct sr_nat_portpool *pool, uint16_t port) {
+	unsigned int bit = port - SR_NAT_PORT_MIN;
+
+	if (port < SR_NAT_PORT_MIN || !(pool->in_use[bit / 8] & (1 << (bit % 8)))) {
+		return;
+	}
+	pool->in_use[bit / 8] &= ~(1 << (bit % 8));
+	pool->ring[(pool->head + pool->count) % SR_NAT_NPORTS] = port;
+	pool->count++;
+}
+
+/* Find the entry for an external address, adding it if add is set. */
+static struct sr_nat_extip *nat_extip(struct sr_nat *nat, uint32_t ip, int add) {
+	struct sr_nat_extip *extip;
+	unsigned int i;
+
+	for (i = 0; i < nat->nextips; i++) {
+		if (nat->extips[i].ip == ip) {
+			return &(nat->extips[i]);
 		}
+	}
+	if (!add || nat->nextips == SR_NAT_MAX_EXTIPS) {
+		return NULL;
+	}
 
-		if(copy->next == NULL){
-			pthread_mutex_unlock(&(nat->lock));
+	extip = &(nat->extips[nat->nextips]);
+	extip->ip = ip;
+	for (i = 0; i <= nat_mapping_tcp; i++) {
+		if (nat_portpool_init(&(extip->ports[i])) != 0) {
+			while (i-- > 0) {
+				free(extip->ports[i].ring);
+			}
 			return NULL;
 		}
-		memcpy(copy, copy->next, sizeof(struct sr_nat_mapping));
 	}
-	  
+	nat->nextips++;
+	return extip;
+}
+
+int sr_nat_add_external_ip(struct sr_nat *nat, uint32_t ip) {
+	int rc = -1;
+
+	pthread_mutex_lock(&(nat->lock));
+	/* Pool addresses must stay at the front of extips */
+	if (nat->npool == nat->nextips && nat_extip(nat, ip, 1) != NULL) {
+		nat->npool = nat->nextips;
+		rc = 0;
+	}
 	pthread_mutex_unlock(&(nat->lock));
-	return copy;
+	return rc;
 }
 
-/* Get the mapping associated with given internal (ip, port) pair.
-   You must free the returned structure if it is not NULL. */
-struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
-  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
+/* Hash of a mapping key, mixed so that keys differing only in their low
+   bits (consecutive ports, hosts on one subnet) spread over the table. */
+static unsigned int nat_hash(uint32_t a, uint32_t b) {
+	uint32_t h = a * 0x9e3779b1u ^ b;
+	h ^= h >> 16;
+	h *= 0x45d9f3b;
+	h ^= h >> 16;
+	return h;
+}
 
-  pthread_mutex_lock(&(nat->lock));
+static unsigned int nat_int_bucket(struct sr_nat *nat, sr_nat_mapping_type type,
+	uint32_t ip_int, uint16_t aux_int) {
+	return nat_hash(ip_int, ((uint32_t)type << 16) | aux_int) & (nat->nbuckets - 1);
+}
 
-  /* handle lookup here, malloc and assign to copy. */
-	struct sr_nat_mapping *copy = malloc(sizeof(struct sr_nat_mapping));
+static unsigned int nat_ext_bucket(struct sr_nat *nat, sr_nat_mapping_type type,
+	uint32_t ip_ext, uint16_t aux_ext) {
+	return nat_hash(ip_ext, ((uint32_t)type << 16) | aux_ext) & (nat->nbuckets - 1);
+}
 
-	if (nat->mappings) {
-		memcpy(copy, nat->mappings, sizeof(struct sr_nat_mapping));
-	} else {
-		pthread_mutex_unlock(&(nat->lock));
-		return NULL;
+static void nat_link(struct sr_nat *nat, struct sr_nat_mapping *mapping) {
+	unsigned int i;
+
+	i = nat_int_bucket(nat, mapping->type, mapping->ip_int, mapping->aux_int);
+	mapping->next_int = nat->by_int[i];
+	nat->by_int[i] = mapping;
+
+	i = nat_ext_bucket(nat, mapping->type, mapping->ip_ext, mapping->aux_ext);
+	mapping->next_ext = nat->by_ext[i];
+	nat->by_ext[i] = mapping;
+}
+
+/* Double the number of buckets; on failure the table just gets fuller. */
+static void nat_grow(struct sr_nat *nat) {
+	struct sr_nat_mapping **old_int = nat->by_int;
+	struct sr_nat_mapping **by_int, **by_ext, *mapping, *next;
+	unsigned int old_n = nat->nbuckets, i;
+
+	by_int = calloc(2 * old_n, sizeof(struct sr_nat_mapping *));
+	by_ext = calloc(2 * old_n, sizeof(struct sr_nat_mapping *));
+	if (by_int == NULL || by_ext == NULL) {
+		free(by_int);
+		free(by_ext);
+		return;
 	}
-	  
-	while (copy) {
-		if (copy->ip_int == ip_int && copy->aux_int == aux_int) {
+
+	free(nat->by_ext);
+	nat->by_int = by_int;
+	nat->by_ext = by_ext;
+	nat->nbuckets = 2 * old_n;
+
+	/* Every mapping is on exactly one internal chain, so walking those
+	   relinks each one once */
+	for (i = 0; i < old_n; i++) {
+		for (mapping = old_int[i]; mapping != NULL; mapping = next) {
+			next = mapping->next_int;
+			nat_link(nat, mapping);
+		}
+	}
+	free(old_int);
+}
+
+/* Get the mapping associated with given external (ip, port) pair. */
+struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
+    uint32_t ip_ext, uint16_t aux_ext, sr_nat_mapping_type type ) {
+	struct sr_nat_mapping *mapping;
+
+	mapping = nat->by_ext[nat_ext_bucket(nat, type, ip_ext, aux_ext)];
+	while (mapping != NULL) {
+		if (mapping->aux_ext == aux_ext && mapping->ip_ext == ip_ext &&
+		    mapping->type == type) {
 			break;
 		}
+		mapping = mapping->next_ext;
+	}
 
-		if (copy->next == NULL){
-			pthread_mutex_unlock(&(nat->lock));
-			return NULL;
+	return mapping;
+}
+
+/* Get the mapping associated with given internal (ip, port) pair. */
+struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
+  uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
+	struct sr_nat_mapping *mapping;
+
+	mapping = nat->by_int[nat_int_bucket(nat, type, ip_int, aux_int)];
+	while (mapping != NULL) {
+		if (mapping->ip_int == ip_int && mapping->aux_int == aux_int &&
+		    mapping->type == type) {
+			break;
 		}
-		memcpy(copy, copy->next, sizeof(struct sr_nat_mapping));
+		mapping = mapping->next_int;
 	}
 
-  pthread_mutex_unlock(&(nat->lock));
-  return copy;
+	return mapping;
 }
 
-/* Insert a new mapping into the nat's mapping table.
-   Actually returns a copy to the new mapping, for thread safety.
- */
+/* Insert a new mapping into the nat's mapping table. */
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
 	uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type ) {
-	struct sr_nat_mapping *currMapping = nat->mappings;
+	struct sr_nat_mapping *mapping;
+	struct sr_nat_extip *extip = NULL;
+	unsigned int start, i;
+	uint16_t port;
 
-	pthread_mutex_lock(&(nat->lock));
-
-	/* handle insert here, create a mapping, and then return a copy of it */
-	struct sr_nat_mapping *mapping = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
-	struct sr_nat_mapping *copy = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
+	mapping = (struct sr_nat_mapping *) malloc(sizeof(struct sr_nat_mapping));
+	if (mapping == NULL) {
+		return NULL;
+	}
 	mapping->type = type;
 	mapping->ip_int = ip_int;
-	mapping->ip_ext = nat->ip_ext;
 	mapping->aux_int = aux_int;
-	mapping->aux_ext = nat->next_port;
-	nat->next_port++;
-	mapping->last_updated = time(NULL);	
-	mapping->conns = NULL;
-	mapping->next = NULL;
-	  
-	/* Loop to end of nat->mappings then add */
-	if (currMapping == NULL) {
-		nat->mappings = mapping;
+
+	/* A host keeps one pool address for all its mappings (RFC 4787 paired
+	   pooling) unless that address has run out of ports */
+	if (nat->npool > 0) {
+		start = nat_hash(ip_int, 0) % nat->npool;
+		for (i = 0, port = 0; i < nat->npool && port == 0; i++) {
+			extip = &(nat->extips[(start + i) % nat->npool]);
+			port = nat_port_alloc(&(extip->ports[type]));
+		}
 	} else {
-		while (currMapping != NULL) {
-			if (currMapping->next == NULL){
-				currMapping->next = mapping;
-				break;
+		extip = nat_extip(nat, nat->ip_ext, 1);
+		port = extip ? nat_port_alloc(&(extip->ports[type])) : 0;
+	}
+	if (port == 0) {
+		free(mapping);
+		return NULL;
+	}
+	mapping->ip_ext = extip->ip;
+	mapping->aux_ext = port;
+	mapping->conns = NULL;
+	mapping->timer.next = NULL;
+	nat_touch(nat, mapping, type == nat_mapping_icmp ?
+		nat->ICMP_timeout : nat->TCP_transitory_timeout);
+
+	if (nat->count >= nat->nbuckets) {
+		nat_grow(nat);
+	}
+	nat_link(nat, mapping);
+	nat->count++;
+
+	return mapping;
+}
+
+/* Remove a mapping, returning its external port to the pool. */
+void sr_nat_remove_mapping(struct sr_nat *nat, struct sr_nat_mapping *mapping) {
+	struct sr_nat_mapping **pp;
+	struct sr_nat_connection *conn, *next;
+	struct sr_nat_extip *extip;
+
+	pthread_mutex_lock(&(nat->lock));
+
+	pp = &(nat->by_int[nat_int_bucket(nat, mapping->type, mapping->ip_int, mapping->aux_int)]);
+	while (*pp != mapping) {
+		pp = &((*pp)->next_int);
+	}
+	*pp = mapping->next_int;
+
+	pp = &(nat->by_ext[nat_ext_bucket(nat, mapping->type, mapping->ip_ext, mapping->aux_ext)]);
+	while (*pp != mapping) {
+		pp = &((*pp)->next_ext);
+	}
+	*pp = mapping->next_ext;
+	nat->count--;
+	sr_timer_cancel(&(mapping->timer));
+
+	extip = nat_extip(nat, mapping->ip_ext, 0);
+	if (extip != NULL) {
+		nat_port_free(&(extip->ports[mapping->type]), mapping->aux_ext);
+	}
+
+	for (conn = mapping->conns; conn != NULL; conn = next) {
+		next = conn->next;
+		free(conn);
+	}
+	free(mapping);
+
+	pthread_mutex_unlock(&(nat->lock));
+}
+
+/* Copy up to max mappings into out. The lock is only held for
+   SR_NAT_SNAP_BUCKETS buckets at a time so translation is never held up
+   for long; if the table is resized in between the copy starts over. The
+   pointers in the copies are cleared. Returns the number copied. */
+unsigned int sr_nat_snapshot(struct sr_nat *nat, struct sr_nat_mapping *out, unsigned int max) {
+	struct sr_nat_mapping *mapping;
+	unsigned int nbuckets, i, end, n;
+
+	pthread_mutex_lock(&(nat->lock));
+	nbuckets = nat->nbuckets;
+	pthread_mutex_unlock(&(nat->lock));
+
+	i = 0;
+	n = 0;
+	while (i < nbuckets && n < max) {
+		pthread_mutex_lock(&(nat->lock));
+		if (nat->nbuckets != nbuckets) {
+			nbuckets = nat->nbuckets;
+			i = 0;
+			n = 0;
+			pthread_mutex_unlock(&(nat->lock));
+			continue;
+		}
+
+		end = i + SR_NAT_SNAP_BUCKETS < nbuckets ? i + SR_NAT_SNAP_BUCKETS : nbuckets;
+		for (; i < end; i++) {
+			for (mapping = nat->by_int[i]; mapping != NULL && n < max; mapping = mapping->next_int) {
+				out[n] = *mapping;
+				out[n].conns = NULL;
+				out[n].next_int = NULL;
+				out[n].next_ext = NULL;
+				out[n].timer.next = out[n].timer.prev = NULL;
+				n++;
 			}
-			currMapping = currMapping->next;
 		}
+		pthread_mutex_unlock(&(nat->lock));
 	}
 
-	memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
+	return n;
+}
+
+/* Remove every mapping, returning their ports to the pools. */
+unsigned int sr_nat_flush(struct sr_nat *nat) {
+	unsigned int i, n = 0;
+
+	pthread_mutex_lock(&(nat->lock));
+	for (i = 0; i < nat->nbuckets; i++) {
+		while (nat->by_int[i] != NULL) {
+			sr_nat_remove_mapping(nat, nat->by_int[i]);
+			n++;
+		}
+	}
 	pthread_mutex_unlock(&(nat->lock));
-	return copy;
+
+	return n;
 }
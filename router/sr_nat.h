@@ -9,6 +9,11 @@
 #include <time.h>
 #include <pthread.h>
 
+#include "sr_timer.h"
+
+struct sr_if;
+struct sr_instance;
+
 typedef enum {
   nat_position_interface, /* NAT Box Interface IP */
   nat_position_host, /* NAT Hosts */
@@ -42,47 +47,131 @@ struct sr_nat_mapping {
   uint16_t aux_ext; /* external port or icmp id */
   time_t last_updated; /* use to timeout mappings */
   struct sr_nat_connection *conns; /* list of connections. null for ICMP */
-  struct sr_nat_mapping *next;
+  struct sr_nat_mapping *next_int; /* chain in nat->by_int */
+  struct sr_nat_mapping *next_ext; /* chain in nat->by_ext */
+  struct sr_timer timer; /* on nat->wheel, fires when the mapping expires */
+};
+
+/* An unsolicited inbound SYN waits SR_NAT_SYN_DELAY seconds for an outbound
+   SYN to open its mapping before it is answered with a port unreachable
+   (RFC 5382 REQ-4), on a timer rather than in the forwarding thread. */
+#define SR_NAT_SYN_DELAY 6
+#define SR_NAT_MAX_SYNS 1024 /* waiting at once; more are dropped */
+#define SR_NAT_SYN_COPY 64 /* bytes of the frame kept, enough to quote */
+
+struct sr_nat_syn {
+  struct sr_timer timer; /* on nat->syn_wheel */
+  struct sr_nat_syn *next; /* on nat->syn_due */
+  struct sr_instance *sr;
+  struct sr_if *iface; /* arrived on */
+  uint32_t ip_ext; /* the mapping it was looking for */
+  uint16_t aux_ext;
+  unsigned int len;
+  uint8_t frame[SR_NAT_SYN_COPY];
+};
+
+#define SR_NAT_MIN_BUCKETS 1024
+#define SR_NAT_SNAP_BUCKETS 256 /* buckets copied per hold of the lock */
+
+/* External ports (and ICMP ids) handed out per external IP and protocol */
+#define SR_NAT_PORT_MIN 1024
+#define SR_NAT_PORT_MAX 65535
+#define SR_NAT_NPORTS (SR_NAT_PORT_MAX - SR_NAT_PORT_MIN + 1)
+#define SR_NAT_MAX_EXTIPS 64
+
+/* Free ports of one protocol on one external IP, kept in a FIFO ring so
+   a released port is the last one to be handed out again. */
+struct sr_nat_portpool {
+  uint16_t *ring;
+  unsigned int head;
+  unsigned int count;
+  uint8_t in_use[SR_NAT_NPORTS / 8 + 1];
+};
+
+struct sr_nat_extip {
+  uint32_t ip; /* network byte order */
+  struct sr_nat_portpool ports[nat_mapping_tcp + 1];
 };
 
 struct sr_nat {
   int ICMP_timeout;
   int TCP_established_timeout;
   int TCP_transitory_timeout;
-  uint32_t ip_ext;
-  uint16_t next_port;
-  struct sr_nat_mapping *mappings;
+  uint32_t ip_ext; /* egress interface address of the packet being translated */
+
+  /* External addresses. The first npool were configured (-X) and are used
+     for all mappings; with none configured each mapping uses the address of
+     the interface it leaves by, added here on first use. */
+  struct sr_nat_extip extips[SR_NAT_MAX_EXTIPS];
+  unsigned int nextips;
+  unsigned int npool;
+  struct sr_if *internal_iface; /* resolved lazily from NAT_INTERNAL_IFACE */
+
+  /* every mapping is indexed both ways; chained, grown at load factor 1 */
+  struct sr_nat_mapping **by_int; /* (type, ip_int, aux_int) */
+  struct sr_nat_mapping **by_ext; /* (type, ip_ext, aux_ext) */
+  unsigned int nbuckets;          /* power of two */
+  unsigned int count;
+
+  /* mapping expiry, one tick per second */
+  struct sr_twheel wheel;
+
+  /* unsolicited SYNs, likewise; due ones are answered without the lock */
+  struct sr_twheel syn_wheel;
+  struct sr_nat_syn *syn_due;
+  unsigned int nsyns;
 
   /* threading */
   pthread_mutex_t lock;
   pthread_mutexattr_t attr;
   pthread_attr_t thread_attr;
   pthread_t thread;
+  int stop; /* set by sr_nat_stop */
 };
 
 #include "sr_router.h"
 
+/* Interface facing the NAT hosts */
+#define NAT_INTERNAL_IFACE "eth1"
+
 int   sr_nat_init(struct sr_nat *nat);     /* Initializes the nat */
-sr_nat_ip_position * sr_nat_get_ip_positions(struct sr_instance *sr, struct sr_ip_hdr* ip_hdr, char* interface);
-int sr_nat_update_headers(struct sr_instance **sr, uint8_t **packet, char* interface);
+sr_nat_ip_position * sr_nat_get_ip_positions(struct sr_instance *sr, struct sr_ip_hdr* ip_hdr, struct sr_if* interface, sr_nat_ip_position result[2]);
+int sr_nat_update_headers(struct sr_instance **sr, uint8_t **packet, struct sr_if* interface);
 struct sr_nat_connection *add_connection(struct sr_nat *nat, struct sr_nat_mapping *mapping, uint32_t server_ip, int initializer);
 int   sr_nat_destroy(struct sr_nat *nat);  /* Destroys the nat (free memory) */
 void *sr_nat_timeout(void *nat_ptr);  /* Periodic Timout */
+void  sr_nat_stop(struct sr_nat *nat);  /* Stops and joins the timeout thread */
 
-/* Get the mapping associated with given external port.
-   You must free the returned structure if it is not NULL. */
+/* The lookup and insert functions return the mapping itself, not a copy.
+   They must be called with nat->lock held, and the mapping may only be
+   used until it is released. None of them allocate except insert. */
+
+/* Get the mapping associated with given external (ip, port) pair. */
 struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
-    uint16_t aux_ext, sr_nat_mapping_type type );
+    uint32_t ip_ext, uint16_t aux_ext, sr_nat_mapping_type type );
 
-/* Get the mapping associated with given internal (ip, port) pair.
-   You must free the returned structure if it is not NULL. */
+/* Get the mapping associated with given internal (ip, port) pair. */
 struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
-/* Insert a new mapping into the nat's mapping table.
-   You must free the returned structure if it is not NULL. */
+/* Insert a new mapping into the nat's mapping table, allocating it an
+   external address and port. Returns NULL if out of memory or ports. */
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
+/* Remove a mapping, returning its external port to the pool. */
+void sr_nat_remove_mapping(struct sr_nat *nat, struct sr_nat_mapping *mapping);
+
+/* Copy up to max mappings into out without holding up translation for
+   long. The copies' pointers are cleared. Returns the number copied. */
+unsigned int sr_nat_snapshot(struct sr_nat *nat, struct sr_nat_mapping *out, unsigned int max);
+
+/* Remove every mapping. Returns the number removed. */
+unsigned int sr_nat_flush(struct sr_nat *nat);
+
+/* Add an address (network byte order) to the external pool. Call after
+   sr_nat_init and before packets are translated. */
+int sr_nat_add_external_ip(struct sr_nat *nat, uint32_t ip);
+
 
 #endif
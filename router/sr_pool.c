@@ -0,0 +1,205 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.c
+ *
+ * Description:
+ *
+ * Per-thread cached object pools, see sr_pool.h.
+ *
+ * Memory layout of an object:
+ *
+ *   | struct sr_poolobj | SR_POOL_HEADROOM | objsize bytes ... |
+ *                                          ^ pointer handed out
+ *
+ * Slabs are never returned to the system; a pool holds on to its high
+ * water mark, which is bounded by its limit.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "sr_pool.h"
+
+#define SR_POOL_ALIGN 64
+
+struct sr_poolobj
+{
+    struct sr_poolobj* next;   /* free list link, only while free */
+    struct sr_pool* pool;
+    unsigned int refcnt;
+};
+
+struct sr_pool_tcache
+{
+    struct sr_poolobj* head;
+    unsigned int n;
+};
+
+static __thread struct sr_pool_tcache sr_pool_tcache[SR_POOL_MAX];
+
+struct sr_pool sr_pktbuf_pool =
+    SR_POOL_INITIALIZER(SR_POOL_PKTBUF, SR_PKTBUF_SZ, SR_PKTBUF_MAX);
+
+#define OBJ_OFFSET (sizeof(struct sr_poolobj) + SR_POOL_HEADROOM)
+
+static struct sr_poolobj* obj_hdr(void* obj)
+{
+    return (struct sr_poolobj*)((uint8_t*)obj - OBJ_OFFSET);
+}
+
+static unsigned int obj_stride(const struct sr_pool* pool)
+{
+    return (OBJ_OFFSET + pool->objsize + SR_POOL_ALIGN - 1) &
+           ~(SR_POOL_ALIGN - 1);
+}
+
+/* Fill an empty thread cache from the depot, carving a new slab if the
+   depot is empty.  Returns 0 if the pool is at its limit. */
+static int pool_refill(struct sr_pool* pool, struct sr_pool_tcache* tc)
+{
+    struct sr_poolobj* o;
+    uint8_t* slab;
+    unsigned int stride, i;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    if ( pool->ndepot == 0 && pool->nobjs + SR_POOL_BATCH <= pool->limit )
+    {
+        stride = obj_stride(pool);
+        if ( posix_memalign((void**)&slab, SR_POOL_ALIGN,
+                            (size_t)stride * SR_POOL_BATCH) == 0 )
+        {
+            for ( i = 0; i < SR_POOL_BATCH; i++ )
+            {
+                o = (struct sr_poolobj*)(slab + (size_t)i * stride);
+                o->pool = pool;
+                o->next = (struct sr_poolobj*)pool->depot;
+                pool->depot = o;
+            }
+            pool->ndepot += SR_POOL_BATCH;
+            pool->nobjs += SR_POOL_BATCH;
+        }
+    }
+
+    while ( pool->ndepot > 0 && tc->n < SR_POOL_BATCH )
+    {
+        o = (struct sr_poolobj*)pool->depot;
+        pool->depot = o->next;
+        pool->ndepot--;
+        o->next = tc->head;
+        tc->head = o;
+        tc->n++;
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+
+    return tc->n > 0;
+}
+
+/* Hand half of an overfull thread cache back to the depot. */
+static void pool_drain(struct sr_pool* pool, struct sr_pool_tcache* tc)
+{
+    struct sr_poolobj* o;
+    unsigned int i;
+
+    pthread_mutex_lock(&(pool->lock));
+    for ( i = 0; i < SR_POOL_BATCH; i++ )
+    {
+        o = tc->head;
+        tc->head = o->next;
+        tc->n--;
+        o->next = (struct sr_poolobj*)pool->depot;
+        pool->depot = o;
+        pool->ndepot++;
+    }
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_get(..)
+ * Scope:  Global
+ *
+ * Take an object from the pool with a reference count of one.  Returns
+ * 0 if the pool is exhausted.
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_pool_get(struct sr_pool* pool)
+{
+    struct sr_pool_tcache* tc;
+    struct sr_poolobj* o;
+
+    /* -- REQUIRES -- */
+    assert(pool);
+    assert(pool->id < SR_POOL_MAX);
+
+    tc = &sr_pool_tcache[pool->id];
+    if ( tc->n == 0 && !pool_refill(pool, tc) )
+    { return 0; }
+
+    o = tc->head;
+    tc->head = o->next;
+    tc->n--;
+
+    o->refcnt = 1;
+    return (uint8_t*)o + OBJ_OFFSET;
+} /* -- sr_pool_get -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_ref(..)
+ * Scope:  Global
+ *
+ * Take another reference to obj; each one is dropped with sr_pool_put.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pool_ref(void* obj)
+{
+    assert(obj);
+    __atomic_add_fetch(&(obj_hdr(obj)->refcnt), 1, __ATOMIC_RELAXED);
+} /* -- sr_pool_ref -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pool_put(..)
+ * Scope:  Global
+ *
+ * Drop a reference to obj, returning it to the calling thread's cache
+ * when it was the last one.  obj may be 0.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_pool_put(void* obj)
+{
+    struct sr_poolobj* o;
+    struct sr_pool_tcache* tc;
+
+    if ( !obj )
+    { return; }
+
+    o = obj_hdr(obj);
+    assert(o->refcnt > 0);
+    if ( __atomic_sub_fetch(&(o->refcnt), 1, __ATOMIC_ACQ_REL) != 0 )
+    { return; }
+
+    tc = &sr_pool_tcache[o->pool->id];
+    o->next = tc->head;
+    tc->head = o;
+    tc->n++;
+
+    if ( tc->n >= 2 * SR_POOL_BATCH )
+    { pool_drain(o->pool, tc); }
+} /* -- sr_pool_put -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_pktbuf_alloc(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_pktbuf_alloc(unsigned int len)
+{
+    if ( len > SR_PKTBUF_SZ )
+    { return 0; }
+
+    return (uint8_t*)sr_pool_get(&sr_pktbuf_pool);
+} /* -- sr_pktbuf_alloc -- */
@@ -0,0 +1,87 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_pool.h
+ *
+ * Description:
+ *
+ * Fixed size, reference counted object pools used for packet buffers and
+ * the other small objects that are created per packet.
+ *
+ * Every thread keeps a private cache of free objects so that get/put are
+ * a couple of pointer operations in the common case.  Objects move between
+ * the thread caches and a shared depot in batches, and the depot grows a
+ * slab at a time up to a fixed limit, so after warm up no allocator calls
+ * are made at all.  Objects may be released by a different thread than
+ * the one that took them (e.g. packets queued by the receive thread and
+ * dropped by the ARP sweeper).
+ *
+ * Every object has SR_POOL_HEADROOM bytes of headroom in front of it so
+ * that packet buffers can be handed to sr_send_pktbuf() and sent without
+ * a copy.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_POOL_H
+#define SR_POOL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#define SR_POOL_HEADROOM 24       /* at least SR_PKT_HEADROOM in sr_router.h,
+                                     checked in sr_vns_comm.c */
+#define SR_POOL_BATCH    32       /* objects moved per depot transfer */
+
+#define SR_PKTBUF_SZ     10000    /* largest frame VNS will carry */
+#define SR_PKTBUF_MAX    8192     /* packet buffers in existence at most */
+
+/* one thread cache slot per pool, so pools are numbered up front */
+enum sr_pool_id {
+    SR_POOL_PKTBUF = 0,
+    SR_POOL_ARPQ,
+    SR_POOL_MAX
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_pool
+ *
+ * Shared part of a pool.  Define one with SR_POOL_INITIALIZER.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_pool
+{
+    enum sr_pool_id id;
+    unsigned int objsize;   /* usable bytes per object */
+    unsigned int limit;     /* objects allocated at most */
+
+    pthread_mutex_t lock;   /* protects the fields below */
+    void* depot;            /* free objects not cached by any thread */
+    unsigned int ndepot;
+    unsigned int nobjs;     /* objects allocated so far */
+};
+
+#define SR_POOL_INITIALIZER(id, objsize, limit) \
+    { (id), (objsize), (limit), PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 }
+
+void* sr_pool_get(struct sr_pool* pool);
+void  sr_pool_ref(void* obj);
+void  sr_pool_put(void* obj);
+
+/* -- packet buffers -- */
+
+extern struct sr_pool sr_pktbuf_pool;
+
+/* Returns a buffer for a frame of len bytes, or 0 if len is too large or
+   the pool is exhausted.  The caller holds one reference. */
+uint8_t* sr_pktbuf_alloc(unsigned int len);
+
+#define sr_pktbuf_hold(buf)    sr_pool_ref(buf)
+#define sr_pktbuf_release(buf) sr_pool_put(buf)
+
+#endif /* -- SR_POOL_H -- */
@@ -0,0 +1,127 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.c
+ *
+ * Description:
+ *
+ * Epoch based RCU, see sr_rcu.h.
+ *
+ * Each reading thread has a slot of its own, see sr_thread.h.  On
+ * entering a read section it copies the global epoch into its slot, and
+ * on leaving it clears the slot.  sr_rcu_synchronize advances the epoch
+ * after the new copy has been published and waits for every slot that
+ * holds an older epoch: readers that entered before the advance may hold
+ * the old copy, those that enter after it are sure to see the new one.
+ * The fence in sr_rcu_read_lock pairs with the ones on the writer side so
+ * that a reader the writer misses always sees the new copy.
+ *
+ * Threads that share SR_THREAD_SHARED count their readers there instead;
+ * a writer waits for that count to drop to zero.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <time.h>
+
+#include "sr_rcu.h"
+#include "sr_thread.h"
+#include "sr_worker.h"
+
+struct sr_rcu_slot
+{
+    unsigned long epoch;    /* 0 when not in a read section */
+    unsigned int nreaders;  /* shared slot only */
+} __attribute__((aligned(SR_CACHELINE)));
+
+static struct sr_rcu_slot sr_rcu_slots[SR_THREAD_SLOTS];
+static unsigned long sr_rcu_epoch = 1;
+static __thread struct sr_rcu_slot* sr_rcu_own;
+
+#define RCU_SHARED(s) ((s) == &sr_rcu_slots[SR_THREAD_SHARED])
+
+static struct sr_rcu_slot* rcu_slot(void)
+{
+    if (!sr_rcu_own)
+    { sr_rcu_own = &sr_rcu_slots[sr_thread_slot()]; }
+    return sr_rcu_own;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_read_lock(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_read_lock(void)
+{
+    struct sr_rcu_slot* s = rcu_slot();
+
+    if (RCU_SHARED(s))
+    {
+        __atomic_fetch_add(&(s->nreaders), 1, __ATOMIC_SEQ_CST);
+        return;
+    }
+    __atomic_store_n(&(s->epoch), __atomic_load_n(&sr_rcu_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+} /* -- sr_rcu_read_lock -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_read_unlock(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_read_unlock(void)
+{
+    struct sr_rcu_slot* s = sr_rcu_own;
+
+    if (RCU_SHARED(s))
+    { __atomic_fetch_sub(&(s->nreaders), 1, __ATOMIC_RELEASE); }
+    else
+    { __atomic_store_n(&(s->epoch), 0, __ATOMIC_RELEASE); }
+} /* -- sr_rcu_read_unlock -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_synchronize(..)
+ * Scope:  Global
+ *
+ * Wait until no reader can still hold anything unpublished before this
+ * call.  Sleeps rather than spins, it is only for the control path.
+ * Must not be called inside a read section.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_synchronize(void)
+{
+    struct timespec nap;
+    struct sr_rcu_slot* s;
+    unsigned long e, v;
+    unsigned int i, n;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = 100 * 1000;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    e = __atomic_add_fetch(&sr_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+
+    n = sr_thread_nslots();
+
+    for (i = 0; i < n; i++)
+    {
+        s = &sr_rcu_slots[i];
+        for (;;)
+        {
+            if (RCU_SHARED(s))
+            {
+                if (__atomic_load_n(&(s->nreaders), __ATOMIC_ACQUIRE) == 0)
+                { break; }
+            }
+            else
+            {
+                v = __atomic_load_n(&(s->epoch), __ATOMIC_ACQUIRE);
+                if (v == 0 || v >= e)
+                { break; }
+            }
+            nanosleep(&nap, 0);
+        }
+    }
+} /* -- sr_rcu_synchronize -- */
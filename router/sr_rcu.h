@@ -0,0 +1,30 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.h
+ *
+ * Description:
+ *
+ * Read-copy-update for data that the forwarding path reads on every
+ * packet but that is only rarely replaced, such as the routing table and
+ * FIB.  Readers bracket their use with sr_rcu_read_lock/unlock and never
+ * block or take a lock; a writer builds a new copy, publishes it with an
+ * atomic store, calls sr_rcu_synchronize to wait until every reader that
+ * may still see the old copy has finished, and only then frees it.
+ *
+ *   sr_rcu_read_lock();
+ *   fib = __atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE);
+ *   rt = sr_fib_lookup(fib, ip);
+ *   ... use rt ...
+ *   sr_rcu_read_unlock();
+ *
+ * Read sections must not nest or block.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RCU_H
+#define SR_RCU_H
+
+void sr_rcu_read_lock(void);
+void sr_rcu_read_unlock(void);
+void sr_rcu_synchronize(void);
+
+#endif /* -- SR_RCU_H -- */
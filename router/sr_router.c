@@ -22,6 +22,10 @@
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_utils.h"
+#include "sr_pool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_lat.h"
 
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
@@ -37,15 +41,15 @@ void sr_init(struct sr_instance* sr)
     assert(sr);
 
     /* Initialize cache and cache cleanup thread */
-    sr_arpcache_init(&(sr->cache));
+    sr_arpcache_init(&(sr->cache), sr->arpcache_size);
 
     pthread_attr_init(&(sr->attr));
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_t thread;
 
-    pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
+    sr->sweep_stop = 0;
+    pthread_create(&(sr->sweeper), &(sr->attr), sr_arpcache_timeout, sr);
 
     /* Add initialization code here! */
     /* TODO BIG BIG BIG TODO: Maybe?  MAYBE?!!?*/
@@ -53,52 +57,156 @@ void sr_init(struct sr_instance* sr)
 } /* -- sr_init -- */
 
 /*---------------------------------------------------------------------
- * Method: sr_handlepacket(uint8_t* p,char* interface)
+ * Method: sr_stop(..)
+ * Scope:  Global
+ *
+ * Stop the threads that send on their own, the ARP sweeper started by
+ * sr_init and the NAT timeout thread, and wait for them, so that nothing
+ * is sent once this returns.  Each notices within a second.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stop(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    __atomic_store_n(&(sr->sweep_stop), 1, __ATOMIC_RELEASE);
+    if (sr->nat_enabled == 1)
+    { sr_nat_stop(&(sr->nat)); }
+    pthread_join(sr->sweeper, 0);
+} /* -- sr_stop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_validate_frame(..)
+ * Scope:  Local
+ *
+ * Check the link and network headers of a received frame without
+ * touching it: the ethertype is IPv4 or ARP, the frame holds the header
+ * it claims, and for IPv4 the version, header length, total length and
+ * the checksum over the whole header, options included, are right.
+ * Returns SR_DROP_NONE or the reason to drop the frame.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_validate_frame(const uint8_t* packet, unsigned int len)
+{
+    const struct sr_ethernet_hdr* e_hdr = (const struct sr_ethernet_hdr*)packet;
+    const struct sr_ip_hdr* ip_hdr;
+    unsigned int hl, ip_len;
+
+    if(len < sizeof(struct sr_ethernet_hdr))
+    { return SR_DROP_RUNT; }
+    if(e_hdr->ether_type == htons(ethertype_arp))
+    {
+        return len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) ?
+               SR_DROP_RUNT : SR_DROP_NONE;
+    }
+    if(e_hdr->ether_type != htons(ethertype_ip))
+    { return SR_DROP_ETHERTYPE; }
+    if(len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr))
+    { return SR_DROP_RUNT; }
+
+    ip_hdr = (const struct sr_ip_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    hl = ip_hdr->ip_hl * 4;
+    ip_len = ntohs(ip_hdr->ip_len);
+    len -= sizeof(struct sr_ethernet_hdr);
+
+    if(ip_hdr->ip_v != 4)
+    { return SR_DROP_IP_VERSION; }
+    if(hl < sizeof(struct sr_ip_hdr))
+    { return SR_DROP_IP_HL; }
+    if(ip_len < hl || ip_len > len)  /* the frame may be padded, not cut */
+    { return SR_DROP_IP_LEN; }
+    /* -- a correct header, checksum included, sums to 0xffff -- */
+    if(cksum(ip_hdr, hl) != 0xffff)
+    { return SR_DROP_IP_CKSUM; }
+
+    return SR_DROP_NONE;
+} /* -- sr_validate_frame -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_print_stats(..)
+ * Scope:  Global
+ *
+ * Print the packet counters of every interface and the drops by reason.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_print_stats(struct sr_instance* sr)
+{
+    struct sr_stats st;
+    struct sr_if* iface;
+    int i;
+
+    sr_stats_snapshot(&st);
+
+    for(iface = sr->if_list; iface; iface = iface->next)
+    {
+        if(iface->idx >= SR_STATS_IFS)
+        { continue; }
+        i = iface->idx;
+        fprintf(stderr, "%s: rx %lu frames %lu bytes, tx %lu frames %lu bytes\n",
+                iface->name, st.rx_pkts[i], st.rx_bytes[i],
+                st.tx_pkts[i], st.tx_bytes[i]);
+    }
+    for(i = SR_DROP_NONE + 1; i < SR_DROP_NREASONS; i++)
+    {
+        if(st.drops[i])
+        { fprintf(stderr, "dropped %lu frames: %s\n", st.drops[i], sr_stats_drop_name(i)); }
+    }
+} /* -- sr_print_stats -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_handlepacket(uint8_t* p,struct sr_if* interface)
  * Scope:  Global
  *
  * This method is called each time the router receives a packet on the
  * interface.  The packet buffer, the packet length and the receiving
  * interface are passed in as parameters. The packet is complete with
- * ethernet headers.
+ * ethernet headers.  The receiving interface has already been resolved
+ * from its name by sr_vns_comm.c.
  *
- * Note: Both the packet buffer and the character's memory are handled
- * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
- * packet instead if you intend to keep it around beyond the scope of
- * the method call.
+ * Note: Both the packet buffer and the interface record are owned
+ * by sr_vns_comm.c that means do NOT delete either.  The packet is
+ * preceded by SR_PKT_HEADROOM bytes of headroom and stays valid until the
+ * next sr_flush_packets(), so it may be forwarded with
+ * sr_send_packet_inplace().  Make a copy of the packet instead if you
+ * intend to keep it around beyond the scope of the method call.
  *
  *---------------------------------------------------------------------*/
 
 int sr_handlepacket(struct sr_instance* sr,
         uint8_t * packet/* lent */,
         unsigned int len,
-        char* interface/* lent */)
+        struct sr_if* interface/* lent */)
 {
   /* REQUIRES */
   assert(sr);
   assert(packet);
   assert(interface);
 
-  printf("*** -> Received packet of length %d \n",len);
-
   struct sr_ethernet_hdr* ether_hdr = 0;
   struct sr_ip_hdr* ip_hdr = 0;
   struct sr_if* currInterface = 0;
-  struct sr_arpentry* ARPentry = 0;
+  unsigned char nexthopMAC[ETHER_ADDR_LEN];
   struct sr_arpreq* ARPreq = 0;
-  struct sr_if *nexthopIface, *nat_iface;
-  uint16_t tempChecksum;
+  struct sr_if *nexthopIface;
   uint8_t* icmp_reply;
-  int type, icmp_reply_len, nat_result;
-
-  /* Check len meets minimum size */
-  if (len < sizeof(struct sr_ethernet_hdr) ){
-	/* Send ICMP reply to sender of type 12 code 2 (Bad length) */
-	create_send_icmpMessage(sr, packet, len, 12, 2, interface);
-	fprintf(stderr , "** Error: packet is wayy to short \n");
-    return -1;
+  int type, icmp_reply_len, nat_result, drop, found;
+  sr_lat_t t = 0;
+
+  sr_log(SR_LOG_TRACE, "%s: received %u bytes\n", interface->name, len);
+
+  /* Drop malformed and non-IP frames before anything else looks at them */
+  SR_LAT_BEGIN(t);
+  drop = sr_validate_frame(packet, len);
+  SR_LAT_END(SR_LAT_VALIDATE, t);
+  if (drop != SR_DROP_NONE) {
+	sr_stats_drop(drop);
+	return -1;
   }
 
-	    printf("Hello\n");
   /* Extract ethernet header */
   ether_hdr = (struct sr_ethernet_hdr*)packet;
   
@@ -108,30 +216,17 @@ int sr_handlepacket(struct sr_instance* sr,
 		return 0;
   }
   
-	    printf("Hello\n");
 	/* Extract IP header */
 	ip_hdr = (struct sr_ip_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
 
-	    printf("Yellow\n");
-	printf("IP DST IS: ");
-	print_addr_ip_int(ip_hdr->ip_dst);
-	nat_iface = longestPrefixMatch(sr, ip_hdr->ip_dst);
-	if (nat_iface != NULL) 	{
-           sr->nat.ip_ext = nat_iface->ip;
-        }
-	    printf("Hello\n");
-	/* validate checksum */
-	tempChecksum = ip_hdr->ip_sum;
-	ip_hdr->ip_sum = 0;
-	if (tempChecksum != cksum(ip_hdr, sizeof(struct sr_ip_hdr))) {
-		/* Drop the packet */
-		fprintf(stderr , "** Error: checksum mismatch \n");
-		return -1;
-	}
+	sr_log(SR_LOG_TRACE, "IP " SR_IP_FMT " -> " SR_IP_FMT " proto %u\n",
+	       SR_IP_ARGS(ip_hdr->ip_src), SR_IP_ARGS(ip_hdr->ip_dst), ip_hdr->ip_p);
 	
 	/* If NAT enabled, update packet metadata */
 	if (sr->nat_enabled == 1) {
-	    nat_result = sr_nat_update_headers(&sr, &packet, interface);
+		SR_LAT_BEGIN(t);
+		nat_result = sr_nat_update_headers(&sr, &packet, interface);
+		SR_LAT_END(SR_LAT_NAT, t);
 		if (nat_result == -1) {
 			return -1;
 		} else if (nat_result == -2) {
@@ -140,12 +235,8 @@ int sr_handlepacket(struct sr_instance* sr,
 		}
 	}
 	
-	/* Decrement TTL */
-	(ip_hdr->ip_ttl)--;
-
-	/* Recalculate checksum here */
-	tempChecksum = cksum(ip_hdr, sizeof(struct sr_ip_hdr));
-	ip_hdr->ip_sum = tempChecksum;
+	/* Decrement TTL, updating the checksum */
+	ip_decrement_ttl(ip_hdr);
 
 	/* See if dest ip is one of our interfaces. If it IS, send it out through that interface */
 	currInterface = sr->if_list;
@@ -162,15 +253,22 @@ int sr_handlepacket(struct sr_instance* sr,
 				icmp_reply_len = 70;
 			}
 
-			ARPentry = sr_arpcache_lookup(&(sr->cache), ip_hdr->ip_src);
-			icmp_reply = create_icmpMessage(sr, packet, len, type, type, currInterface->name);
-			if (ARPentry != NULL){				
-				sr_send_packet(sr, icmp_reply, icmp_reply_len, interface);
-				free(icmp_reply);
+			icmp_reply = create_icmpMessage(sr, packet, len, type, type, currInterface);
+			if (icmp_reply == NULL) {
+				sr_log(SR_LOG_WARN, "out of packet buffers, ICMP reply dropped\n");
+				return -1;
+			}
+			if (sr_arpcache_lookup(&(sr->cache), ip_hdr->ip_src, nexthopMAC)){				
+				sr_send_pktbuf(sr, icmp_reply, icmp_reply_len, interface);
+				sr_pktbuf_release(icmp_reply);
 				return 0;
 			} else {
+				/* Hold the cache lock so a concurrent ARP reply or sweep can't destroy the request */
+				pthread_mutex_lock(&(sr->cache.lock));
 				ARPreq = sr_arpcache_queuereq(&(sr->cache), ip_hdr->ip_src, icmp_reply, icmp_reply_len, interface);
 				handle_arpreq(sr, ARPreq);
+				pthread_mutex_unlock(&(sr->cache.lock));
+				sr_pktbuf_release(icmp_reply);
 				return 0;
 			}
 		}
@@ -181,33 +279,43 @@ int sr_handlepacket(struct sr_instance* sr,
 	if (ip_hdr->ip_ttl < 1) {
 		/* Send ICMP reply to sender type 11 code 0 */
 		create_send_icmpMessage(sr, packet, len, 11, 0, interface);
-		fprintf(stderr , "** Packet's TTL is 0 \n");
+		sr_stats_drop(SR_DROP_TTL);
+		sr_log(SR_LOG_DEBUG, "TTL expired for " SR_IP_FMT "\n", SR_IP_ARGS(ip_hdr->ip_dst));
 		return -1;
 	}
 
 	/* Otherwise find longest prefix match (through routing table) and send it there */
+	SR_LAT_BEGIN(t);
 	nexthopIface = longestPrefixMatch(sr, ip_hdr->ip_dst);
+	SR_LAT_END(SR_LAT_LPM, t);
 	if (!nexthopIface) {
 		/* Send destination unreachable type 3 code 0 (Net unreachable) */
 		create_send_icmpMessage(sr, packet, len, 3, 0, interface);
-		fprintf(stderr , "** Error: No prefix match! \n");
+		sr_stats_drop(SR_DROP_NO_ROUTE);
+		sr_log(SR_LOG_DEBUG, "no route to " SR_IP_FMT "\n", SR_IP_ARGS(ip_hdr->ip_dst));
 		return -1;
 	}
 
-	ARPentry = sr_arpcache_lookup(&(sr->cache), ip_hdr->ip_dst);
-	if (ARPentry != NULL) {
-		/* MAC Address = ARPentry->mac; */
-		memcpy(ether_hdr->ether_dhost, ARPentry->mac, ETHER_ADDR_LEN);
+	SR_LAT_BEGIN(t);
+	found = sr_arpcache_lookup(&(sr->cache), ip_hdr->ip_dst, nexthopMAC);
+	SR_LAT_END(SR_LAT_ARP, t);
+	if (found) {
+		memcpy(ether_hdr->ether_dhost, nexthopMAC, ETHER_ADDR_LEN);
 		memcpy(ether_hdr->ether_shost, nexthopIface->addr, ETHER_ADDR_LEN);
 		
-		sr_send_packet(sr, packet, len, nexthopIface->name);
-		free(ARPentry);
+		/* Forward without copying, see the note on headroom above */
+		SR_LAT_BEGIN(t);
+		sr_send_packet_inplace(sr, packet, len, nexthopIface);
+		SR_LAT_END(SR_LAT_SEND, t);
 	} else {
-		/* Add a ARP request onto the ARP request queue */
-		ARPreq = sr_arpcache_queuereq(&(sr->cache), ip_hdr->ip_dst, packet, len, nexthopIface->name);
+		/* Add a ARP request onto the ARP request queue, under the cache lock
+		   since other workers and the sweeper may handle the same request */
+		pthread_mutex_lock(&(sr->cache.lock));
+		ARPreq = sr_arpcache_queuereq(&(sr->cache), ip_hdr->ip_dst, packet, len, nexthopIface);
 
 		/* Write and call handle_arpreq */
 		handle_arpreq(sr, ARPreq);
+		pthread_mutex_unlock(&(sr->cache.lock));
 	}
 
 	return 0;
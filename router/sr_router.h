@@ -11,11 +11,14 @@
 
 #include <netinet/in.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
 #include "sr_nat.h"
+#include "sr_stats.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -30,10 +33,40 @@
 
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
+#define SR_RXBUF_SZ (64 * 1024) /* must hold several max size VNS commands */
+#define SR_TXBUF_SZ (64 * 1024) /* staging for copied outgoing frames */
+#define SR_TX_IOV   64          /* frames per writev() */
+#define SR_PKT_HEADROOM 24      /* room for a VNS packet header in front of
+                                   frames sent with sr_send_packet_inplace */
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_fib;
+struct sr_worker;
+struct sr_capture;
+struct sr_ctl;
+struct sr_transport;
+struct sr_shm;
+struct sr_afpacket;
+struct sr_xdp;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_txbatch
+ *
+ * Outgoing frames queued for a single writev() to the server.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_txbatch
+{
+    pthread_mutex_t lock;
+    unsigned char* buf;   /* VNS header + frame copies from sr_send_packet */
+    unsigned int used;
+    struct iovec iov[SR_TX_IOV];
+    uint8_t* hold[SR_TX_IOV]; /* pool buffer referenced by iov[i], if any */
+    int niov;
+};
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -45,31 +78,57 @@ struct sr_rt;
 struct sr_instance
 {
     int  sockfd;   /* socket to server */
+    const struct sr_transport* transport; /* sockfd, shm, afp or xdp, see sr_transport.h */
+    struct sr_shm* shm; /* -M rings, see sr_shm.h */
+    struct sr_afpacket* afp; /* -K interfaces, see sr_afpacket.h */
+    struct sr_xdp* xdp; /* -K -x interfaces, see sr_xdp.h */
     char user[32]; /* user name */
     char host[32]; /* host name */ 
     char template[30]; /* template name if any */
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
+    unsigned char* rxbuf; /* commands read from server, see sr_read_command */
+    unsigned int rx_head, rx_tail;
+    struct sr_txbatch tx; /* frames waiting for sr_flush_packets */
+    pthread_mutex_t tx_wlock; /* serializes writes to sockfd */
+    unsigned int nworkers; /* forwarding workers (-w), 0 to forward inline */
+    struct sr_worker* workers;
     struct sr_if* if_list; /* list of interfaces */
     struct sr_rt* routing_table; /* routing table */
+    struct sr_fib* fib; /* lookup structure built from routing_table */
+    pthread_mutex_t rt_lock; /* serializes changes to the two above, which
+                                are read under RCU (see sr_rt_add) */
     struct sr_arpcache cache;   /* ARP cache */
+    unsigned int arpcache_size; /* ARP cache capacity (-a) */
     int nat_enabled;  /* NAT enabled/disabled */
     struct sr_nat nat;   /* nat configs */
     pthread_attr_t attr;
-    FILE* logfile;
+    pthread_t sweeper; /* sr_arpcache_timeout, started by sr_init */
+    int sweep_stop;    /* set by sr_stop */
+    struct sr_capture* capture; /* -l packet log, see sr_capture.h */
+    struct sr_ctl* ctl; /* -c control socket, see sr_ctl.h */
 };
 
 /* -- sr_main.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
-int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , struct sr_if*);
+int sr_send_packet_inplace(struct sr_instance* , uint8_t* , unsigned int , struct sr_if*);
+int sr_send_pktbuf(struct sr_instance* , uint8_t* , unsigned int , struct sr_if*);
+int sr_flush_packets(struct sr_instance* );
+int sr_txbatch_init(struct sr_txbatch* );
+void sr_txbatch_free(struct sr_txbatch* );
+void sr_tx_bind(struct sr_txbatch* );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
+int sr_connect_to_shm(struct sr_instance* , const char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
-int sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_stop(struct sr_instance* );
+int sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , struct sr_if* );
+void sr_print_stats(struct sr_instance* );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
@@ -20,7 +20,9 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_fib.h"
 #include "sr_router.h"
+#include "sr_rcu.h"
 
 /*---------------------------------------------------------------------
  * Method:
@@ -77,11 +79,22 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
         if( clear_routing_table == 0 ){
             printf("Loading routing table from server, clear local routing table.\n");
             sr->routing_table = 0;
+            sr_fib_destroy(sr->fib);
+            sr->fib = 0;
             clear_routing_table = 1;
         }
         sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
     } /* -- while -- */
 
+    /* -- compile the whole table into the FIB in one pass -- */
+    sr_fib_destroy(sr->fib);
+    sr->fib = sr_fib_build(sr->routing_table);
+    if(sr->fib == 0)
+    {
+        fprintf(stderr, "Error: out of memory building FIB\n");
+        return -1;
+    }
+
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
@@ -94,42 +107,244 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
 struct in_addr gw, struct in_addr mask,char* if_name)
 {
     struct sr_rt* rt_walker = 0;
+    struct sr_rt* entry = 0;
 
     /* -- REQUIRES -- */
     assert(if_name);
     assert(sr);
 
+    entry = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+    assert(entry);
+    entry->next = 0;
+    entry->dest = dest;
+    entry->gw   = gw;
+    entry->mask = mask;
+    strncpy(entry->interface,if_name,sr_IFACE_NAMELEN);
+    entry->ifp  = sr->if_list ? sr_get_interface(sr, if_name) : 0;
+
     /* -- empty list special case -- */
     if(sr->routing_table == 0)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        sr->routing_table = entry;
+    }
+    else
+    {
+        /* -- find the end of the list -- */
+        rt_walker = sr->routing_table;
+        while(rt_walker->next){
+          rt_walker = rt_walker->next; 
+        }
+        rt_walker->next = entry;
+    }
 
-        return;
+    /* -- routes added after sr_load_rt go straight into the FIB -- */
+    if(sr->fib != 0 &&
+       sr_fib_insert(sr->fib, ntohl(dest.s_addr),
+                     sr_fib_mask_len(mask.s_addr), entry) != 0)
+    {
+        fprintf(stderr, "Error: out of memory adding route to FIB\n");
     }
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
+} /* -- sr_add_entry -- */
+
+/* Free a list of routes */
+static void sr_rt_free(struct sr_rt* table)
+{
+    struct sr_rt* next;
+
+    for( ; table; table = next)
+    {
+        next = table->next;
+        free(table);
     }
+}
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+/*---------------------------------------------------------------------
+ * Method: sr_rt_publish(..)
+ * Scope:  Local
+ *
+ * Compile table into a new FIB, make both live and free the ones they
+ * replace once no forwarding thread can still be using them (sr_rcu.h).
+ * Called with sr->rt_lock held.  On failure table is freed and nothing
+ * changes.
+ *
+ *---------------------------------------------------------------------*/
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+static int sr_rt_publish(struct sr_instance* sr, struct sr_rt* table)
+{
+    struct sr_fib* fib;
+    struct sr_fib* old_fib;
+    struct sr_rt* old_table;
 
-} /* -- sr_add_entry -- */
+    fib = sr_fib_build(table);
+    if(fib == 0)
+    {
+        sr_rt_free(table);
+        return -1;
+    }
+
+    old_table = sr->routing_table;
+    old_fib = sr->fib;
+    __atomic_store_n(&(sr->routing_table), table, __ATOMIC_RELEASE);
+    __atomic_store_n(&(sr->fib), fib, __ATOMIC_RELEASE);
+
+    sr_rcu_synchronize();
+
+    sr_fib_destroy(old_fib);
+    sr_rt_free(old_table);
+    return 0;
+} /* -- sr_rt_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_copy(..)
+ * Scope:  Local
+ *
+ * Copy the live table, leaving out the route for dest/mask; *found
+ * tells whether there was one.  Called with sr->rt_lock held.  Returns
+ * 0 and sets *copy, 0 for an empty table, or -1 out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_copy(struct sr_instance* sr, struct sr_rt** copy,
+                      struct in_addr dest, struct in_addr mask, int* found)
+{
+    struct sr_rt* rt_walker;
+    struct sr_rt** tail = copy;
+
+    *copy = 0;
+    *found = 0;
+    for(rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    {
+        if(rt_walker->mask.s_addr == mask.s_addr &&
+           ((rt_walker->dest.s_addr ^ dest.s_addr) & mask.s_addr) == 0)
+        {
+            *found = 1;
+            continue;
+        }
+        *tail = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+        if(*tail == 0)
+        {
+            sr_rt_free(*copy);
+            *copy = 0;
+            return -1;
+        }
+        **tail = *rt_walker;
+        (*tail)->next = 0;
+        tail = &((*tail)->next);
+    }
+    return 0;
+} /* -- sr_rt_copy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_add(..)
+ * Scope:  Global
+ *
+ * Add a route while the router is running, replacing any route for the
+ * same dest/mask.  Forwarding goes on undisturbed, see sr_rt_publish.
+ * Returns 0, or -1 if if_name is not an interface or out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_add(struct sr_instance* sr, struct in_addr dest, struct in_addr gw,
+              struct in_addr mask, const char* if_name)
+{
+    struct sr_rt* table;
+    struct sr_rt* entry;
+    struct sr_rt** tail;
+    struct sr_if* ifp;
+    int found, rc;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(if_name);
+
+    ifp = sr_get_interface(sr, if_name);
+    if(ifp == 0)
+    { return -1; }
+
+    entry = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+    if(entry == 0)
+    { return -1; }
+    memset(entry, 0, sizeof(struct sr_rt));
+    entry->dest.s_addr = dest.s_addr & mask.s_addr;
+    entry->gw   = gw;
+    entry->mask = mask;
+    strncpy(entry->interface, if_name, sr_IFACE_NAMELEN - 1);
+    entry->ifp  = ifp;
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    if(sr_rt_copy(sr, &table, entry->dest, mask, &found) != 0)
+    {
+        pthread_mutex_unlock(&(sr->rt_lock));
+        free(entry);
+        return -1;
+    }
+    tail = &table;
+    while(*tail)
+    { tail = &((*tail)->next); }
+    *tail = entry;
+    rc = sr_rt_publish(sr, table);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    return rc;
+} /* -- sr_rt_add -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_del(..)
+ * Scope:  Global
+ *
+ * Remove the route for dest/mask while the router is running.  Returns
+ * 0, 1 if there is no such route, or -1 out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_del(struct sr_instance* sr, struct in_addr dest, struct in_addr mask)
+{
+    struct sr_rt* table;
+    int found, rc;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    if(sr_rt_copy(sr, &table, dest, mask, &found) != 0)
+    {
+        pthread_mutex_unlock(&(sr->rt_lock));
+        return -1;
+    }
+    if(!found)
+    {
+        pthread_mutex_unlock(&(sr->rt_lock));
+        sr_rt_free(table);
+        return 1;
+    }
+    rc = sr_rt_publish(sr, table);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    return rc;
+} /* -- sr_rt_del -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_resolve_interfaces(..)
+ * Scope:  Global
+ *
+ * Point every route at its outgoing interface record so that the
+ * forwarding path never has to look interfaces up by name.  Must be
+ * called again whenever the interface list changes (VNSHWINFO).
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_resolve_interfaces(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for(rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    { rt_walker->ifp = sr_get_interface(sr, rt_walker->interface); }
+
+} /* -- sr_rt_resolve_interfaces -- */
 
 /*---------------------------------------------------------------------
  * Method:
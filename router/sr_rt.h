@@ -33,6 +33,8 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    struct sr_if* ifp; /* resolved from interface, 0 until the interface
+                          is known (see sr_rt_resolve_interfaces) */
     struct sr_rt* next;
 };
 
@@ -40,6 +42,10 @@ struct sr_rt
 int sr_load_rt(struct sr_instance*,const char*);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+int sr_rt_add(struct sr_instance*, struct in_addr, struct in_addr,
+              struct in_addr, const char*);
+int sr_rt_del(struct sr_instance*, struct in_addr, struct in_addr);
+void sr_rt_resolve_interfaces(struct sr_instance* sr);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
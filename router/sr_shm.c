@@ -0,0 +1,362 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory rings for the -M transport, see sr_shm.h.  Used by both
+ * the router and loadgen, so nothing here knows about sr_instance.
+ *
+ * Indices run freely and are masked when used.  The producer's store of
+ * head and the consumer's store of tail are seq_cst, as are the stores
+ * of the waiting flags, so a side that sees the other's flag clear after
+ * moving its index knows the other will see the move before sleeping.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif /* _LINUX_ */
+
+#include "sr_shm.h"
+
+#define SR_SHM_SPIN     256     /* looks at an empty/full ring before sleeping */
+#define SR_SHM_NAP_MS   100     /* longest sleep, so closing is noticed */
+
+static void shm_wait(uint32_t* addr, uint32_t val, int ms)
+{
+    struct timespec ts;
+
+#ifdef _LINUX_
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, 0, 0);
+#else
+    (void)addr;
+    (void)val;
+    (void)ms;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 50000;
+    nanosleep(&ts, 0);
+#endif
+}
+
+static void shm_wake(uint32_t* addr)
+{
+#ifdef _LINUX_
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#else
+    (void)addr;
+#endif
+}
+
+static struct sr_shm_region* shm_map(const char* path, int create)
+{
+    struct sr_shm_region* region;
+    struct stat st;
+    int fd;
+
+    fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    if (fd < 0)
+    {
+        perror(path);
+        return 0;
+    }
+
+    if (create && ftruncate(fd, sizeof(struct sr_shm_region)) != 0)
+    {
+        perror(path);
+        close(fd);
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct sr_shm_region))
+    {
+        fprintf(stderr, "%s: not a shared memory transport\n", path);
+        close(fd);
+        return 0;
+    }
+
+    region = (struct sr_shm_region*)mmap(0, sizeof(struct sr_shm_region),
+                                         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        perror("mmap");
+        return 0;
+    }
+    return region;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_create(..)
+ * Scope:  Global
+ *
+ * Create (or start over) the region at path, as the peer.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_shm* sr_shm_create(const char* path)
+{
+    struct sr_shm* shm;
+    struct sr_shm_region* region;
+
+    if ((shm = (struct sr_shm*)calloc(1, sizeof(struct sr_shm))) == 0)
+    { return 0; }
+    if ((region = shm_map(path, 1)) == 0)
+    {
+        free(shm);
+        return 0;
+    }
+
+    region->slots = SR_SHM_SLOTS;
+    region->slot_sz = SR_SHM_SLOT_SZ;
+    __atomic_store_n(&(region->magic), SR_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    shm->region = region;
+    shm->in = &(region->from_router);
+    shm->out = &(region->to_router);
+    shm->space = SR_SHM_SLOTS;
+    shm->peer = 1;
+    return shm;
+} /* -- sr_shm_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_attach(..)
+ * Scope:  Global
+ *
+ * Map the region a peer created at path, as the router.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_shm* sr_shm_attach(const char* path)
+{
+    struct sr_shm* shm;
+    struct sr_shm_region* region;
+
+    if ((shm = (struct sr_shm*)calloc(1, sizeof(struct sr_shm))) == 0)
+    { return 0; }
+    if ((region = shm_map(path, 0)) == 0)
+    {
+        free(shm);
+        return 0;
+    }
+
+    if (__atomic_load_n(&(region->magic), __ATOMIC_ACQUIRE) != SR_SHM_MAGIC ||
+        region->slots != SR_SHM_SLOTS || region->slot_sz != SR_SHM_SLOT_SZ ||
+        region->closed)
+    {
+        fprintf(stderr, "%s: not a shared memory transport, or a stale one\n", path);
+        munmap(region, sizeof(struct sr_shm_region));
+        free(shm);
+        return 0;
+    }
+
+    shm->region = region;
+    shm->in = &(region->to_router);
+    shm->out = &(region->from_router);
+    shm->taken = shm->avail = __atomic_load_n(&(shm->in->tail), __ATOMIC_ACQUIRE);
+    shm->reserved = __atomic_load_n(&(shm->out->head), __ATOMIC_ACQUIRE);
+    shm->space = __atomic_load_n(&(shm->out->tail), __ATOMIC_ACQUIRE) + SR_SHM_SLOTS;
+
+    __atomic_store_n(&(region->attached), 1, __ATOMIC_SEQ_CST);
+    shm_wake(&(region->attached));
+    return shm;
+} /* -- sr_shm_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_wait_attached(..)
+ * Scope:  Global
+ *
+ * For the peer: wait up to timeout_ms (forever if negative) for the
+ * router to attach.  Returns 0 once it has.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_shm_wait_attached(struct sr_shm* shm, int timeout_ms)
+{
+    struct sr_shm_region* region = shm->region;
+    int waited = 0;
+
+    while (!__atomic_load_n(&(region->attached), __ATOMIC_ACQUIRE))
+    {
+        if (timeout_ms >= 0 && waited >= timeout_ms)
+        { return -1; }
+        shm_wait(&(region->attached), 0, SR_SHM_NAP_MS);
+        waited += SR_SHM_NAP_MS;
+    }
+    return 0;
+} /* -- sr_shm_wait_attached -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_close(..)
+ * Scope:  Global
+ *
+ * Tell the other side we are gone, wake it wherever it sleeps and unmap.
+ * Commands already published can still be read.  Removing the file is
+ * up to the peer, which can do so as soon as the router has attached.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_shm_close(struct sr_shm* shm)
+{
+    struct sr_shm_region* region;
+
+    if (!shm)
+    { return; }
+    region = shm->region;
+
+    sr_shm_publish(shm);
+    sr_shm_release(shm);
+    __atomic_store_n(&(region->closed), 1, __ATOMIC_SEQ_CST);
+    shm_wake(&(region->to_router.head));
+    shm_wake(&(region->to_router.tail));
+    shm_wake(&(region->from_router.head));
+    shm_wake(&(region->from_router.tail));
+    shm_wake(&(region->attached));
+
+    munmap(region, sizeof(struct sr_shm_region));
+    free(shm);
+} /* -- sr_shm_close -- */
+
+int sr_shm_closed(struct sr_shm* shm)
+{
+    return __atomic_load_n(&(shm->region->closed), __ATOMIC_ACQUIRE);
+} /* -- sr_shm_closed -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_reserve(..)
+ * Scope:  Global
+ *
+ * The next free slot of the outgoing ring, waiting for the consumer to
+ * free one if they are all in use.  Returns 0 if the other side has
+ * gone away.
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_shm_reserve(struct sr_shm* shm)
+{
+    struct sr_shm_ring* r = shm->out;
+    uint32_t tail;
+    int spin = 0;
+
+    while (shm->reserved == shm->space)
+    {
+        shm->space = __atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE) + SR_SHM_SLOTS;
+        if (shm->reserved != shm->space)
+        { break; }
+        if (sr_shm_closed(shm))
+        { return 0; }
+
+        /* -- full: let the consumer at what we have, then sleep -- */
+        sr_shm_publish(shm);
+        if (spin++ < SR_SHM_SPIN)
+        { continue; }
+
+        __atomic_store_n(&(r->producer_waiting), 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&(r->tail), __ATOMIC_SEQ_CST);
+        if (tail + SR_SHM_SLOTS == shm->reserved)
+        { shm_wait(&(r->tail), tail, SR_SHM_NAP_MS); }
+        __atomic_store_n(&(r->producer_waiting), 0, __ATOMIC_RELAXED);
+    }
+
+    return r->slots[shm->reserved++ & (SR_SHM_SLOTS - 1)];
+} /* -- sr_shm_reserve -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_publish(..)
+ * Scope:  Global
+ *
+ * Hand every slot reserved so far to the consumer.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_shm_publish(struct sr_shm* shm)
+{
+    struct sr_shm_ring* r = shm->out;
+
+    if (shm->reserved == __atomic_load_n(&(r->head), __ATOMIC_RELAXED))
+    { return; }
+
+    __atomic_store_n(&(r->head), shm->reserved, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(r->consumer_waiting), __ATOMIC_SEQ_CST))
+    { shm_wake(&(r->head)); }
+} /* -- sr_shm_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_next(..)
+ * Scope:  Global
+ *
+ * The next filled slot of the incoming ring.  If there is none, waits
+ * up to timeout_ms for one (0 doesn't wait, negative waits until the
+ * other side goes away).  Returns 0 if there still is none.  The slot
+ * stays the caller's until sr_shm_release.
+ *
+ *---------------------------------------------------------------------*/
+
+uint8_t* sr_shm_next(struct sr_shm* shm, int timeout_ms)
+{
+    struct sr_shm_ring* r = shm->in;
+    uint32_t head;
+    int spin = 0, nap;
+
+    while (shm->taken == shm->avail)
+    {
+        shm->avail = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+        if (shm->taken != shm->avail)
+        { break; }
+        if (timeout_ms == 0 || sr_shm_closed(shm))
+        { return 0; }
+        if (spin++ < SR_SHM_SPIN)
+        { continue; }
+
+        nap = (timeout_ms < 0 || timeout_ms > SR_SHM_NAP_MS) ? SR_SHM_NAP_MS : timeout_ms;
+        __atomic_store_n(&(r->consumer_waiting), 1, __ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&(r->head), __ATOMIC_SEQ_CST);
+        if (head == shm->taken)
+        { shm_wait(&(r->head), head, nap); }
+        __atomic_store_n(&(r->consumer_waiting), 0, __ATOMIC_RELAXED);
+
+        if (timeout_ms > 0)
+        { timeout_ms = timeout_ms > nap ? timeout_ms - nap : 0; }
+        spin = 0;
+    }
+
+    return r->slots[shm->taken++ & (SR_SHM_SLOTS - 1)];
+} /* -- sr_shm_next -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_shm_release(..)
+ * Scope:  Global
+ *
+ * Give every slot sr_shm_next returned back to the producer.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_shm_release(struct sr_shm* shm)
+{
+    struct sr_shm_ring* r = shm->in;
+
+    if (shm->taken == __atomic_load_n(&(r->tail), __ATOMIC_RELAXED))
+    { return; }
+
+    __atomic_store_n(&(r->tail), shm->taken, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(r->producer_waiting), __ATOMIC_SEQ_CST))
+    { shm_wake(&(r->tail)); }
+} /* -- sr_shm_release -- */
+
+/* Slots read but not yet released. */
+unsigned int sr_shm_unreleased(struct sr_shm* shm)
+{
+    return shm->taken - __atomic_load_n(&(shm->in->tail), __ATOMIC_RELAXED);
+} /* -- sr_shm_unreleased -- */
@@ -0,0 +1,96 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shm.h
+ *
+ * Description:
+ *
+ * Shared memory transport (-M path): instead of a TCP connection to a VNS
+ * server, the router and a local peer (loadgen -M) exchange VNS commands
+ * through two single producer, single consumer rings in a file both of
+ * them map.  The peer creates the file; the router attaches to it.
+ *
+ * Every slot holds one whole command exactly as it would cross the
+ * socket, VNS header and all, so VNSHWINFO, VNSPACKET and VNSCLOSE are
+ * handled by the same code either way.  A slot is written in place by
+ * its producer and read in place by its consumer:
+ *
+ *   p = sr_shm_reserve(shm);           p = sr_shm_next(shm, -1);
+ *   ... write a command at p ...       ... use the command at p ...
+ *   sr_shm_publish(shm);               sr_shm_release(shm);
+ *
+ * Reserved slots become visible on publish, and slots read become free
+ * again on release, each covering every slot since the last one, so both
+ * sides work in batches.  A side with nothing to do sleeps on a futex
+ * that the other side only wakes when it knows it is asleep.  The same
+ * handle must only be used by one producer and one consumer thread at a
+ * time.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_SHM_MAGIC    0x53524d31  /* "SRM1" */
+#define SR_SHM_SLOTS    1024        /* per ring, power of 2 */
+#define SR_SHM_SLOT_SZ  10240       /* largest VNS command is 10000 bytes */
+#define SR_SHM_ALIGN    64          /* == SR_CACHELINE in sr_worker.h */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_ring
+ *
+ * head is only written by the producer and tail only by the consumer,
+ * each with the flag the other side sets before it sleeps on it.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_ring
+{
+    uint32_t head __attribute__((aligned(SR_SHM_ALIGN)));
+    uint32_t producer_waiting;  /* for tail to move */
+    uint32_t tail __attribute__((aligned(SR_SHM_ALIGN)));
+    uint32_t consumer_waiting;  /* for head to move */
+    uint8_t slots[SR_SHM_SLOTS][SR_SHM_SLOT_SZ] __attribute__((aligned(SR_SHM_ALIGN)));
+};
+
+struct sr_shm_region
+{
+    uint32_t magic;
+    uint32_t slots, slot_sz;    /* checked on attach */
+    uint32_t attached;          /* the router has mapped the region */
+    uint32_t closed;            /* either side has let go */
+    struct sr_shm_ring to_router __attribute__((aligned(SR_SHM_ALIGN)));
+    struct sr_shm_ring from_router;
+};
+
+struct sr_shm
+{
+    struct sr_shm_region* region;
+    struct sr_shm_ring* in;     /* consumed by this side */
+    struct sr_shm_ring* out;    /* produced by this side */
+    uint32_t reserved;          /* out: next slot to hand out */
+    uint32_t space;             /* out: tail as last seen + SR_SHM_SLOTS */
+    uint32_t taken;             /* in: next slot to read */
+    uint32_t avail;             /* in: head as last seen */
+    int peer;                   /* created the region */
+};
+
+struct sr_shm* sr_shm_create(const char* path);
+struct sr_shm* sr_shm_attach(const char* path);
+void     sr_shm_close(struct sr_shm* shm);
+int      sr_shm_closed(struct sr_shm* shm);
+int      sr_shm_wait_attached(struct sr_shm* shm, int timeout_ms);
+
+uint8_t* sr_shm_reserve(struct sr_shm* shm);
+void     sr_shm_publish(struct sr_shm* shm);
+uint8_t* sr_shm_next(struct sr_shm* shm, int timeout_ms);
+void     sr_shm_release(struct sr_shm* shm);
+unsigned int sr_shm_unreleased(struct sr_shm* shm);
+
+#endif /* -- SR_SHM_H -- */
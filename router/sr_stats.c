@@ -0,0 +1,147 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Per-thread packet counters, see sr_stats.h.
+ *
+ * A slot (see sr_thread.h) is only ever written by the thread that owns
+ * it, so a counter is bumped with a relaxed load and store rather than a
+ * locked add; the relaxed atomics just keep the snapshot's concurrent
+ * reads well defined.  SR_THREAD_SHARED is the exception, and is bumped
+ * with real atomic adds.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "sr_stats.h"
+#include "sr_thread.h"
+#include "sr_worker.h"
+
+struct sr_stats_slot
+{
+    struct sr_stats c;
+} __attribute__((aligned(SR_CACHELINE)));
+
+static struct sr_stats_slot sr_stats_slots[SR_THREAD_SLOTS];
+static __thread struct sr_stats_slot* sr_stats_own;
+
+static const char* sr_drop_names[SR_DROP_NREASONS] =
+{ "", "runt", "ethertype", "IP version", "IP header length",
+  "IP total length", "IP checksum", "TTL expired", "no route",
+  "ARP timeout", "NAT miss", "no buffer", "queue full" };
+
+/* The calling thread's slot */
+static struct sr_stats_slot* stats_slot(void)
+{
+    if (!sr_stats_own)
+    { sr_stats_own = &sr_stats_slots[sr_thread_slot()]; }
+    return sr_stats_own;
+}
+
+static void stats_add(struct sr_stats_slot* s, unsigned long* c,
+                      unsigned long n)
+{
+    if (s == &sr_stats_slots[SR_THREAD_SHARED])
+    { __atomic_fetch_add(c, n, __ATOMIC_RELAXED); }
+    else
+    { __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED); }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_rx(..)
+ * Scope:  Global
+ *
+ * Count a frame of len bytes received on interface ifidx.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_rx(unsigned int ifidx, unsigned int len)
+{
+    struct sr_stats_slot* s;
+
+    if (ifidx >= SR_STATS_IFS)
+    { return; }
+
+    s = stats_slot();
+    stats_add(s, &(s->c.rx_pkts[ifidx]), 1);
+    stats_add(s, &(s->c.rx_bytes[ifidx]), len);
+} /* -- sr_stats_rx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_tx(..)
+ * Scope:  Global
+ *
+ * Count a frame of len bytes sent on interface ifidx.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_tx(unsigned int ifidx, unsigned int len)
+{
+    struct sr_stats_slot* s;
+
+    if (ifidx >= SR_STATS_IFS)
+    { return; }
+
+    s = stats_slot();
+    stats_add(s, &(s->c.tx_pkts[ifidx]), 1);
+    stats_add(s, &(s->c.tx_bytes[ifidx]), len);
+} /* -- sr_stats_tx -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_drop(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_drop(int reason)
+{
+    struct sr_stats_slot* s;
+
+    if (reason <= SR_DROP_NONE || reason >= SR_DROP_NREASONS)
+    { return; }
+
+    s = stats_slot();
+    stats_add(s, &(s->c.drops[reason]), 1);
+} /* -- sr_stats_drop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_snapshot(..)
+ * Scope:  Global
+ *
+ * Add up every thread's counters into out.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_stats_snapshot(struct sr_stats* out)
+{
+    const unsigned long* src;
+    unsigned long* dst;
+    unsigned int i, j, n;
+
+    memset(out, 0, sizeof(struct sr_stats));
+
+    n = sr_thread_nslots();
+
+    dst = (unsigned long*)out;
+    for (i = 0; i < n; i++)
+    {
+        src = (const unsigned long*)&(sr_stats_slots[i].c);
+        for (j = 0; j < sizeof(struct sr_stats) / sizeof(unsigned long); j++)
+        { dst[j] += __atomic_load_n(&src[j], __ATOMIC_RELAXED); }
+    }
+} /* -- sr_stats_snapshot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_stats_drop_name(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+const char* sr_stats_drop_name(int reason)
+{
+    if (reason <= SR_DROP_NONE || reason >= SR_DROP_NREASONS)
+    { return "none"; }
+    return sr_drop_names[reason];
+} /* -- sr_stats_drop_name -- */
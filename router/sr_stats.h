@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Packet counters: frames and bytes received and sent per interface, and
+ * frames dropped by reason.
+ *
+ * Every thread that counts gets a slot of its own the first time it does,
+ * padded to whole cache lines, and bumps its counters there with plain
+ * loads and stores, so counting takes no locks and no shared cache lines.
+ * sr_stats_snapshot adds the slots up; it may run on any thread at any
+ * time and sees each counter as of some moment during the call.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <stdio.h>
+
+#define SR_STATS_IFS     32     /* interfaces counted, by sr_if.idx; frames
+                                   on any beyond are only counted in drops */
+
+/* Reasons a frame is dropped */
+enum sr_drop_reason
+{
+    SR_DROP_NONE = 0,
+    SR_DROP_RUNT,           /* shorter than the headers it claims */
+    SR_DROP_ETHERTYPE,      /* neither IPv4 nor ARP */
+    SR_DROP_IP_VERSION,
+    SR_DROP_IP_HL,          /* header length under 20 bytes */
+    SR_DROP_IP_LEN,         /* total length disagrees with the frame */
+    SR_DROP_IP_CKSUM,
+    SR_DROP_TTL,            /* TTL expired in transit */
+    SR_DROP_NO_ROUTE,
+    SR_DROP_ARP_TIMEOUT,    /* next hop never answered ARP */
+    SR_DROP_NAT_MISS,       /* no mapping free, or too many SYNs waiting */
+    SR_DROP_NO_BUFFER,      /* out of packet buffers */
+    SR_DROP_QUEUE_FULL,     /* worker ring full (-w) */
+    SR_DROP_NREASONS
+};
+
+struct sr_stats
+{
+    unsigned long rx_pkts[SR_STATS_IFS];
+    unsigned long rx_bytes[SR_STATS_IFS];
+    unsigned long tx_pkts[SR_STATS_IFS];
+    unsigned long tx_bytes[SR_STATS_IFS];
+    unsigned long drops[SR_DROP_NREASONS];
+};
+
+void sr_stats_rx(unsigned int ifidx, unsigned int len);
+void sr_stats_tx(unsigned int ifidx, unsigned int len);
+void sr_stats_drop(int reason);
+void sr_stats_snapshot(struct sr_stats* out);
+const char* sr_stats_drop_name(int reason);
+
+#endif /* -- SR_STATS_H -- */
@@ -0,0 +1,85 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_thread.c
+ *
+ * Description:
+ *
+ * Per-thread slots, see sr_thread.h.
+ *
+ * Indices are handed out and given back under a lock, which is only taken
+ * the first time a thread asks and when it exits.  A thread's index is
+ * kept in a thread-specific key, stored plus one since a destructor only
+ * runs for non-null values, and given back by that destructor.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <pthread.h>
+
+#include "sr_thread.h"
+
+static pthread_mutex_t sr_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sr_thread_once = PTHREAD_ONCE_INIT;
+static pthread_key_t sr_thread_key;
+static unsigned char sr_thread_taken[SR_THREAD_SHARED];
+static unsigned int sr_thread_high;     /* highest index handed out + 1 */
+static __thread unsigned int sr_thread_own; /* index + 1, 0 until asked */
+
+static void thread_release(void* v)
+{
+    unsigned int i = (unsigned int)(unsigned long)v - 1;
+
+    pthread_mutex_lock(&sr_thread_lock);
+    sr_thread_taken[i] = 0;
+    pthread_mutex_unlock(&sr_thread_lock);
+}
+
+static void thread_key_init(void)
+{
+    pthread_key_create(&sr_thread_key, thread_release);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_thread_slot(..)
+ * Scope:  Global
+ *
+ * The calling thread's index, below SR_THREAD_SLOTS.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_thread_slot(void)
+{
+    unsigned int i;
+
+    if (sr_thread_own)
+    { return sr_thread_own - 1; }
+
+    pthread_once(&sr_thread_once, thread_key_init);
+
+    pthread_mutex_lock(&sr_thread_lock);
+    for (i = 0; i < SR_THREAD_SHARED && sr_thread_taken[i]; i++)
+    { }
+    if (i < SR_THREAD_SHARED)
+    {
+        sr_thread_taken[i] = 1;
+        pthread_setspecific(sr_thread_key, (void*)(unsigned long)(i + 1));
+    }
+    if (i >= sr_thread_high)
+    { __atomic_store_n(&sr_thread_high, i + 1, __ATOMIC_SEQ_CST); }
+    pthread_mutex_unlock(&sr_thread_lock);
+
+    sr_thread_own = i + 1;
+    return i;
+} /* -- sr_thread_slot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_thread_nslots(..)
+ * Scope:  Global
+ *
+ * One more than the highest index ever handed out: the slots below are
+ * the only ones that may have been used.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_thread_nslots(void)
+{
+    return __atomic_load_n(&sr_thread_high, __ATOMIC_SEQ_CST);
+} /* -- sr_thread_nslots -- */
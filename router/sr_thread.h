@@ -0,0 +1,30 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_thread.h
+ *
+ * Description:
+ *
+ * Per-thread slots for the modules that keep per-thread state the rest of
+ * the router adds up or scans (sr_rcu.c, sr_stats.c, sr_lat.c).  Each of
+ * them keeps an array of SR_THREAD_SLOTS entries and indexes it with
+ * sr_thread_slot(), so a thread has the same index in all of them.
+ *
+ * A thread is given the lowest free index the first time it asks, and the
+ * index is given back when the thread exits, so threads that come and go
+ * do not use the slots up.  What is in a slot is left as it is for the
+ * next thread to be given it.  Once SR_THREAD_SHARED slots are taken,
+ * further threads all get SR_THREAD_SHARED, the last slot, which is never
+ * anyone's own: whatever is kept there must be updated with atomic read-
+ * modify-writes.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_THREAD_H
+#define SR_THREAD_H
+
+#define SR_THREAD_SLOTS  128
+#define SR_THREAD_SHARED (SR_THREAD_SLOTS - 1)
+
+unsigned int sr_thread_slot(void);
+unsigned int sr_thread_nslots(void);
+
+#endif /* -- SR_THREAD_H -- */
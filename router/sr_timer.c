@@ -0,0 +1,174 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Hierarchical timing wheel, see sr_timer.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+
+#include "sr_timer.h"
+
+#define SR_TW_MASK (SR_TW_SLOTS - 1)
+
+static void list_init(struct sr_timer* head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_add(struct sr_timer* head, struct sr_timer* timer)
+{
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_twheel_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_twheel_init(struct sr_twheel* wheel, uint64_t now)
+{
+    int l, s;
+
+    /* -- REQUIRES -- */
+    assert(wheel);
+
+    wheel->now = now;
+    for(l = 0; l < SR_TW_LEVELS; l++)
+    {
+        for(s = 0; s < SR_TW_SLOTS; s++)
+        { list_init(&wheel->slots[l][s]); }
+    }
+} /* -- sr_twheel_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_cancel(..)
+ * Scope:  Global
+ *
+ * Take a timer off its wheel.  Harmless if it is not on one.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_cancel(struct sr_timer* timer)
+{
+    if(!sr_timer_pending(timer))
+    { return; }
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = 0;
+    timer->prev = 0;
+} /* -- sr_timer_cancel -- */
+
+/* Put a timer in the finest slot that will still see it in time.  A
+   timer due this very tick (from a cascade) goes in the level 0 slot that
+   is about to be processed. */
+static void twheel_place(struct sr_twheel* wheel, struct sr_timer* timer)
+{
+    uint64_t delta;
+    int l;
+
+    delta = timer->expires - wheel->now;
+
+    for(l = 0; l < SR_TW_LEVELS - 1; l++)
+    {
+        if(delta < ((uint64_t)1 << (SR_TW_BITS * (l + 1))))
+        { break; }
+    }
+
+    if(delta >= ((uint64_t)1 << (SR_TW_BITS * SR_TW_LEVELS)))
+    {
+        /* -- beyond the wheel: park in the last slot to come round -- */
+        list_add(&wheel->slots[l][((wheel->now >> (SR_TW_BITS * l)) - 1) &
+                                  SR_TW_MASK], timer);
+        return;
+    }
+
+    list_add(&wheel->slots[l][(timer->expires >> (SR_TW_BITS * l)) &
+                              SR_TW_MASK], timer);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_twheel_schedule(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_twheel_schedule(struct sr_twheel* wheel, struct sr_timer* timer,
+                        uint64_t expires)
+{
+    /* -- REQUIRES -- */
+    assert(wheel);
+    assert(timer);
+
+    sr_timer_cancel(timer);
+    timer->expires = (expires > wheel->now) ? expires : wheel->now + 1;
+    twheel_place(wheel, timer);
+} /* -- sr_twheel_schedule -- */
+
+/* Redistribute the timers of one coarse slot over the finer levels. */
+static void twheel_cascade(struct sr_twheel* wheel, int l)
+{
+    struct sr_timer* head;
+    struct sr_timer* timer;
+
+    head = &wheel->slots[l][(wheel->now >> (SR_TW_BITS * l)) & SR_TW_MASK];
+    while(head->next != head)
+    {
+        timer = head->next;
+        sr_timer_cancel(timer);
+        twheel_place(wheel, timer);
+    }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_twheel_advance(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_twheel_advance(struct sr_twheel* wheel, uint64_t now,
+                       sr_timer_fn fn, void* arg)
+{
+    struct sr_timer* head;
+    struct sr_timer* timer;
+    int l;
+
+    /* -- REQUIRES -- */
+    assert(wheel);
+    assert(fn);
+
+    while(wheel->now < now)
+    {
+        wheel->now++;
+
+        /* -- entering a new coarse slot: spread it over the finer ones -- */
+        for(l = 1; l < SR_TW_LEVELS; l++)
+        {
+            if((wheel->now & (((uint64_t)1 << (SR_TW_BITS * l)) - 1)) != 0)
+            { break; }
+            twheel_cascade(wheel, l);
+        }
+
+        head = &wheel->slots[0][wheel->now & SR_TW_MASK];
+        while(head->next != head)
+        {
+            timer = head->next;
+            sr_timer_cancel(timer);
+            if(timer->expires > wheel->now)
+            {
+                /* -- parked beyond the wheel, not due yet -- */
+                twheel_place(wheel, timer);
+                continue;
+            }
+            fn(timer, arg);
+        }
+    }
+} /* -- sr_twheel_advance -- */
@@ -0,0 +1,68 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ *
+ * Description:
+ *
+ * Hierarchical timing wheel.  Timers are embedded in the objects they
+ * expire, so scheduling, rescheduling and cancelling are O(1) list
+ * operations, and advancing the wheel only visits timers that are due
+ * (plus the occasional cascade of a coarse slot into finer ones).
+ *
+ * Time is counted in ticks of whatever unit the caller chooses.  Level l
+ * slots are SR_TW_SLOTS^l ticks wide, so SR_TW_LEVELS levels of 64 slots
+ * cover 64^4 ticks (194 days at one tick per second).  Timers further
+ * out are parked in the last slot and re-examined when it comes round.
+ *
+ * The wheel does no locking of its own.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TIMER_H
+#define SR_TIMER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TW_BITS   6
+#define SR_TW_SLOTS  (1 << SR_TW_BITS)
+#define SR_TW_LEVELS 4
+
+/* a timer not on the wheel has next == 0 */
+struct sr_timer
+{
+    struct sr_timer* next;
+    struct sr_timer* prev;
+    uint64_t expires;       /* tick at which the timer fires */
+};
+
+struct sr_twheel
+{
+    uint64_t now;           /* last tick processed */
+    struct sr_timer slots[SR_TW_LEVELS][SR_TW_SLOTS]; /* list heads */
+};
+
+typedef void (*sr_timer_fn)(struct sr_timer* timer, void* arg);
+
+void sr_twheel_init(struct sr_twheel* wheel, uint64_t now);
+
+/* (Re)arm timer to fire at tick expires; a tick already past fires on
+   the next advance. */
+void sr_twheel_schedule(struct sr_twheel* wheel, struct sr_timer* timer,
+                        uint64_t expires);
+
+void sr_timer_cancel(struct sr_timer* timer);
+
+#define sr_timer_pending(t) ((t)->next != 0)
+
+/* Process every tick up to and including now, calling fn for each timer
+   that is due.  Timers are off the wheel when fn runs, so fn may free or
+   reschedule them. */
+void sr_twheel_advance(struct sr_twheel* wheel, uint64_t now,
+                       sr_timer_fn fn, void* arg);
+
+#endif /* -- SR_TIMER_H -- */
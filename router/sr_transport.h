@@ -0,0 +1,33 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_transport.h
+ *
+ * Description:
+ *
+ * How VNS commands get between the router and whatever stands in for the
+ * wire.  The socket to a VNS server (sr_connect_to_server), the shared
+ * memory rings of -M (sr_connect_to_shm) and the Linux interfaces of -K
+ * (sr_connect_to_afpacket) each provide one, and set sr->transport to it;
+ * the rest of sr_vns_comm.c only goes through it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TRANSPORT_H
+#define SR_TRANSPORT_H
+
+#include <sys/uio.h>
+
+struct sr_instance;
+
+struct sr_transport
+{
+    const char* name;
+
+    /* next whole command, read in place and valid until the next call;
+       flushes the caller's batch before blocking, 0 once the session is over */
+    unsigned char* (*read)(struct sr_instance* , int* len);
+
+    /* write whole commands; called under sr->tx_wlock */
+    int (*write)(struct sr_instance* , struct iovec* , int niov);
+};
+
+#endif /* -- SR_TRANSPORT_H -- */
@@ -5,22 +5,46 @@
 #include "sr_utils.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_rcu.h"
+#include "sr_pool.h"
+#include "sr_cksum.h"
 
 
+/* Vectorized where the CPU allows, see sr_cksum.h */
 uint16_t cksum (const void *_data, int len) {
-  const uint8_t *data = _data;
-  uint32_t sum;
-
-  for (sum = 0;len >= 2; data += 2, len -= 2)
-    sum += data[0] << 8 | data[1];
-  if (len > 0)
-    sum += data[0] << 8;
-  while (sum > 0xffff)
-    sum = (sum >> 16) + (sum & 0xffff);
-  sum = htons (~sum);
+  return sr_cksum_impl(_data, len);
+}
+
+/* Incremental checksum update, RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m').
+   sum is the checksum field as it sits in the packet and from/to are the
+   old and new values of one 16-bit word it covers, also as they sit in the
+   packet; the one's complement sum doesn't care about byte order. */
+uint16_t cksum_adjust16(uint16_t sum, uint16_t from, uint16_t to) {
+  uint32_t acc;
+
+  acc = (uint16_t)~sum + (uint16_t)~from + (uint32_t)to;
+  acc = (acc >> 16) + (acc & 0xffff);
+  acc = (acc >> 16) + (acc & 0xffff);
+  sum = ~acc;
   return sum ? sum : 0xffff;
 }
 
+/* Same for a 32-bit field such as an address, as two 16-bit words. */
+uint16_t cksum_adjust32(uint16_t sum, uint32_t from, uint32_t to) {
+  sum = cksum_adjust16(sum, from >> 16, to >> 16);
+  return cksum_adjust16(sum, from & 0xffff, to & 0xffff);
+}
+
+/* Decrement the TTL and patch the header checksum to match */
+void ip_decrement_ttl(sr_ip_hdr_t *iphdr) {
+  uint16_t from = htons(iphdr->ip_ttl << 8 | iphdr->ip_p);
+
+  iphdr->ip_ttl--;
+  iphdr->ip_sum = cksum_adjust16(iphdr->ip_sum, from,
+                                 htons(iphdr->ip_ttl << 8 | iphdr->ip_p));
+}
+
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
@@ -185,49 +209,26 @@ void print_hdrs(uint8_t *buf, uint32_t length) {
   }
 }
 
-	/* Longest prefix match: the mask means how many bits to take into account
-	IP numbers are kept as 4 sequences of 8 bit values
-	Use NOT XOR to determine matching bits */
+/* Longest prefix match: the routing table is compiled into sr->fib as
+   entries are added (see sr_fib.h), so this is a bounded number of array
+   reads rather than a walk over every route. The FIB may be replaced at
+   any time (sr_rt_add), so it is only used inside an RCU read section;
+   interfaces are never freed, so the result outlives it. */
 struct sr_if* longestPrefixMatch(struct sr_instance *sr, uint32_t ip) {
-	struct sr_rt *curr_rt_entry = sr->routing_table;
-	struct sr_rt *longest_rt_entry = NULL;
-	int mask_bit_count, i, longestMaskCount = 0;
-
-	while (curr_rt_entry != NULL) {
-		/* Check mask, figure out how large match must be */
-		for (mask_bit_count = 0; mask_bit_count < 32; mask_bit_count++) {
-			if (!(((curr_rt_entry->mask.s_addr) << mask_bit_count) >> 31)) {
-				break;
-			}
-		}
-			
-		/* Take destination ip of entry and compare with input ip using mask */
-		for (i = 0; i < 32; i++) {
-			if (!(((ntohl(curr_rt_entry->dest.s_addr) << i) >> 31) == ((ntohl(ip) << i) >> 31))) {
-				break;
-			}
-		}
+	struct sr_rt *longest_rt_entry;
+	struct sr_if *iface = NULL;
 
-		if (i >= mask_bit_count) {
-			/* If mask entry's mask is greater than the previous entry's mask
-			  then it becomes the new longest entry */
-			if (i > longestMaskCount) {
-				longestMaskCount = i;
-				longest_rt_entry = curr_rt_entry;
-			}
-		}
-		curr_rt_entry = curr_rt_entry->next;
-	}
-	
-	if (!longest_rt_entry) {
-		return NULL;
+	sr_rcu_read_lock();
+	longest_rt_entry = sr_fib_lookup(__atomic_load_n(&(sr->fib), __ATOMIC_ACQUIRE), ntohl(ip));
+	if (longest_rt_entry) {
+		iface = longest_rt_entry->ifp;
 	}
-	
-	return sr_get_interface(sr, longest_rt_entry->interface);
+	sr_rcu_read_unlock();
 
+	return iface;
 }
 
-void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, const char *iface) {
+void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, struct sr_if *iface) {
 	uint8_t* ICMPpacket = 0;
 	unsigned int full_pkt_len = 0, new_pkt_hdr_len = 0;
 	unsigned int ethernetPlusIPheaderLength = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr);
@@ -236,7 +237,10 @@ void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned i
 	
 	if (type == 0) {
 		new_pkt_hdr_len = ethernetPlusIPheaderLength + sizeof(struct sr_icmp_hdr);
-		ICMPpacket = malloc(len);
+		ICMPpacket = sr_pktbuf_alloc(len);
+		if (ICMPpacket == NULL) {
+			return;
+		}
 		memcpy(ICMPpacket + new_pkt_hdr_len, packet + new_pkt_hdr_len, len - new_pkt_hdr_len);
 		full_pkt_len = len;
 		struct sr_icmp_hdr *ICMPheader = (struct sr_icmp_hdr*)(ICMPpacket + ethernetPlusIPheaderLength);
@@ -248,7 +252,10 @@ void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned i
 	} else {
 		new_pkt_hdr_len = ethernetPlusIPheaderLength + sizeof(struct sr_icmp_t3_hdr);
 		full_pkt_len = new_pkt_hdr_len;
-		ICMPpacket = malloc(full_pkt_len);
+		ICMPpacket = sr_pktbuf_alloc(full_pkt_len);
+		if (ICMPpacket == NULL) {
+			return;
+		}
 		struct sr_icmp_t3_hdr *ICMPheader = (struct sr_icmp_t3_hdr*)(ICMPpacket + ethernetPlusIPheaderLength);
 		ICMPheader->unused = 0;
 		ICMPheader->next_mtu = 68;
@@ -267,7 +274,7 @@ void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned i
 	struct sr_ip_hdr *IPheader = (struct sr_ip_hdr*)(ICMPpacket + sizeof(struct sr_ethernet_hdr));
 	memcpy(IPheader, packet + sizeof(struct sr_ethernet_hdr), sizeof(struct sr_ip_hdr));
 	tempDestIP = IPheader->ip_src;
-	IPheader->ip_src = (sr_get_interface(sr, iface))->ip;
+	IPheader->ip_src = iface->ip;
 	IPheader->ip_dst = tempDestIP;
 	IPheader->ip_ttl = 64;
 	IPheader->ip_len = ntohs(full_pkt_len - sizeof(struct sr_ethernet_hdr));
@@ -284,25 +291,31 @@ void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned i
 	
 	EthHeader->ether_type = ntohs(ethertype_ip);
 	
-	sr_send_packet(sr, ICMPpacket, full_pkt_len, iface);
+	sr_send_pktbuf(sr, ICMPpacket, full_pkt_len, iface);
 	
-	free(ICMPpacket);
+	sr_pktbuf_release(ICMPpacket);
 }
 
 uint32_t ip_behind_interface(struct sr_instance *sr, struct sr_if *if_ip) {
-	struct sr_rt* currentRTEntry = sr->routing_table;
+	struct sr_rt* currentRTEntry;
+	uint32_t ip = if_ip->ip;
 
+	sr_rcu_read_lock();
+	currentRTEntry = __atomic_load_n(&(sr->routing_table), __ATOMIC_ACQUIRE);
 	while (currentRTEntry) {
-		if(strncmp(currentRTEntry->interface, if_ip->name, sr_IFACE_NAMELEN) == 0){
-			return currentRTEntry->dest.s_addr;
+		if(currentRTEntry->ifp == if_ip){
+			ip = currentRTEntry->dest.s_addr;
+			break;
 		}
 		currentRTEntry = currentRTEntry->next;
 	}
-	return if_ip->ip;
+	sr_rcu_read_unlock();
+
+	return ip;
 }
 
 
-uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, const char *iface) {
+uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, struct sr_if *iface) {
 	uint8_t* ICMPpacket = 0;
 	unsigned int full_pkt_len = 0, new_pkt_hdr_len = 0;
 	unsigned int ethernetPlusIPheaderLength = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr);
@@ -311,7 +324,10 @@ uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned in
 	
 	if (type == 0) {
 		new_pkt_hdr_len = ethernetPlusIPheaderLength + sizeof(struct sr_icmp_hdr);
-		ICMPpacket = malloc(len);
+		ICMPpacket = sr_pktbuf_alloc(len);
+		if (ICMPpacket == NULL) {
+			return NULL;
+		}
 		memcpy(ICMPpacket + new_pkt_hdr_len, packet + new_pkt_hdr_len, len - new_pkt_hdr_len);
 		full_pkt_len = len;
 		struct sr_icmp_hdr *ICMPheader = (struct sr_icmp_hdr*)(ICMPpacket + ethernetPlusIPheaderLength);
@@ -323,7 +339,10 @@ uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned in
 	} else {
 		new_pkt_hdr_len = ethernetPlusIPheaderLength + sizeof(struct sr_icmp_t3_hdr);
 		full_pkt_len = new_pkt_hdr_len;
-		ICMPpacket = malloc(full_pkt_len);
+		ICMPpacket = sr_pktbuf_alloc(full_pkt_len);
+		if (ICMPpacket == NULL) {
+			return NULL;
+		}
 		struct sr_icmp_t3_hdr *ICMPheader = (struct sr_icmp_t3_hdr*)(ICMPpacket + ethernetPlusIPheaderLength);
 		ICMPheader->unused = 0;
 		ICMPheader->next_mtu = 68;
@@ -342,7 +361,7 @@ uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned in
 	struct sr_ip_hdr *IPheader = (struct sr_ip_hdr*)(ICMPpacket + sizeof(struct sr_ethernet_hdr));
 	memcpy(IPheader, packet + sizeof(struct sr_ethernet_hdr), sizeof(struct sr_ip_hdr));
 	tempDestIP = IPheader->ip_src;
-	IPheader->ip_src = (sr_get_interface(sr, iface))->ip;
+	IPheader->ip_src = iface->ip;
 	IPheader->ip_dst = tempDestIP;
 	IPheader->ip_ttl = 64;
 	IPheader->ip_len = ntohs(full_pkt_len - sizeof(struct sr_ethernet_hdr));
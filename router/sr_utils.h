@@ -31,6 +31,9 @@
 #include "sr_if.h"
 
 uint16_t cksum(const void *_data, int len);
+uint16_t cksum_adjust16(uint16_t sum, uint16_t from, uint16_t to);
+uint16_t cksum_adjust32(uint16_t sum, uint32_t from, uint32_t to);
+void ip_decrement_ttl(sr_ip_hdr_t *iphdr);
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
@@ -48,8 +51,9 @@ void print_hdr_arp(uint8_t *buf);
 void print_hdrs(uint8_t *buf, uint32_t length);
 
 struct sr_if* longestPrefixMatch(struct sr_instance *sr, uint32_t ip);
-void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, const char *iface);
+void create_send_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, struct sr_if *iface);
 uint32_t ip_behind_interface(struct sr_instance *sr, struct sr_if *if_ip);
-uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, const char *iface);
+/* Returns a pool buffer (release with sr_pktbuf_release), or NULL if none is free */
+uint8_t* create_icmpMessage(struct sr_instance *sr, uint8_t *packet, unsigned int len, uint8_t type, uint8_t code, struct sr_if *iface);
 
 #endif /* -- SR_UTILS_H -- */
@@ -32,24 +32,44 @@
 #include <errno.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
-#include "sr_dumper.h"
+#include "sr_capture.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_pool.h"
+#include "sr_log.h"
+#include "sr_stats.h"
+#include "sr_lat.h"
+#include "sr_worker.h"
 #include "sr_protocol.h"
+#include "sr_shm.h"
+#include "sr_transport.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
+static void sr_log_packet(struct sr_instance* , uint8_t* , int ,
+                          struct sr_if* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
-                                  char* interface  /* lent */);
+                                  struct sr_if* iface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static unsigned char* sr_read_command(struct sr_instance* , int* );
+static int sr_vns_write(struct sr_instance* , struct iovec* , int );
+static unsigned char* sr_shm_read(struct sr_instance* , int* );
+static int sr_shm_write(struct sr_instance* , struct iovec* , int );
+
+static const struct sr_transport sr_vns_transport =
+{ "vns", sr_read_command, sr_vns_write };
+static const struct sr_transport sr_shm_transport =
+{ "shm", sr_shm_read, sr_shm_write };
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -77,6 +97,8 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
                          char* server)
 {
     struct hostent *hp;
+    struct sockaddr_un local;
+    int is_local;
     c_open command;
     c_open_template ot;
     char* buf;
@@ -95,26 +117,59 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
     sr->sr_addr.sin_family = AF_INET;
     sr->sr_addr.sin_port = htons(port);
 
+    /* -- a server with a '/' in its name is a local (UNIX) socket -- */
+    is_local = strchr(server, '/') != 0;
+    if ( is_local )
+    {
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if ( strlen(server) >= sizeof(local.sun_path) )
+        {
+            fprintf(stderr,"Error: socket path too long: %s\n", server);
+            return -1;
+        }
+        strcpy(local.sun_path, server);
+    }
     /* grab hosts address from domain name */
-    if ((hp = gethostbyname(server))==0)
+    else if ((hp = gethostbyname(server))==0)
     {
         perror("gethostbyname:sr_client.c::sr_connect_to_server(..)");
         return -1;
     }
+    else
+    {
+        /* set server address */
+        memcpy(&(sr->sr_addr.sin_addr),hp->h_addr,hp->h_length);
+    }
+
+    /* receive buffer, allocated once for the life of the session */
+    if (sr->rxbuf == 0 && (sr->rxbuf = malloc(SR_RXBUF_SZ)) == 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_server)\n");
+        return -1;
+    }
+    sr->rx_head = sr->rx_tail = 0;
 
-    /* set server address */
-    memcpy(&(sr->sr_addr.sin_addr),hp->h_addr,hp->h_length);
+    /* transmit batch for the reader and the ARP sweeper */
+    if (sr->tx.buf == 0 && sr_txbatch_init(&(sr->tx)) != 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_server)\n");
+        return -1;
+    }
+    sr->transport = &sr_vns_transport;
 
     /* create socket */
-    if ((sr->sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    if ((sr->sockfd = socket(is_local ? AF_UNIX : AF_INET, SOCK_STREAM, 0)) < 0)
     {
         perror("socket(..):sr_client.c::sr_connect_to_server(..)");
         return -1;
     }
 
     /* attempt to connect to the server */
-    if (connect(sr->sockfd, (struct sockaddr *)&(sr->sr_addr),
-                sizeof(sr->sr_addr)) < 0)
+    if ((is_local ?
+         connect(sr->sockfd, (struct sockaddr *)&local, sizeof(local)) :
+         connect(sr->sockfd, (struct sockaddr *)&(sr->sr_addr),
+                 sizeof(sr->sr_addr))) < 0)
     {
         perror("connect(..):sr_client.c::sr_connect_to_server(..)");
         close(sr->sockfd);
@@ -162,6 +217,34 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
     return 0;
 } /* -- sr_connect_to_server -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_connect_to_shm()
+ * Scope: Global
+ *
+ * Attach to the shared memory rings a local peer created at path (-M),
+ * in place of a VNS server.  There is no handshake: the peer starts
+ * with a VNSHWINFO, which the main loop handles as usual.
+ *
+ *---------------------------------------------------------------------------*/
+int sr_connect_to_shm(struct sr_instance* sr, const char* path)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(path);
+
+    if (sr->tx.buf == 0 && sr_txbatch_init(&(sr->tx)) != 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_shm)\n");
+        return -1;
+    }
+
+    if ((sr->shm = sr_shm_attach(path)) == 0)
+    { return -1; }
+    sr->transport = &sr_shm_transport;
+
+    return 0;
+} /* -- sr_connect_to_shm -- */
+
 
 
 /*-----------------------------------------------------------------------------
@@ -331,81 +414,162 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
     return sr_read_from_server_expect(sr, 0);
 }
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_command(..)
+ * Scope: Local
+ *
+ * Read side of the VNS transport: return the next complete VNS command
+ * from the receive buffer, refilling it from the socket as needed.  Each recv() pulls in as many framed
+ * commands as the kernel has queued, and commands are handed out in place,
+ * so nothing is allocated or copied per command.  The returned command is
+ * only valid until the next call.
+ *
+ *---------------------------------------------------------------------------*/
+
+static unsigned char* sr_read_command(struct sr_instance* sr, int* len_out)
 {
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    unsigned int avail;
+    uint32_t len_nbo;
+    int len = 0, ret;
+    unsigned char* cmd;
 
-    /* REQUIRES */
-    assert(sr);
+    while(1)
+    {
+        avail = sr->rx_tail - sr->rx_head;
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+        if ( avail >= 4 )
+        {
+            memcpy(&len_nbo, sr->rxbuf + sr->rx_head, 4);
+            len = ntohl(len_nbo);
 
-    bytes_read = 0;
+            if ( len > 10000 || len < 8 )
+            {
+                fprintf(stderr,"Error: command length to large %d\n",len);
+                close(sr->sockfd);
+                return 0;
+            }
+
+            if ( avail >= (unsigned int)len )
+            {
+                cmd = sr->rxbuf + sr->rx_head;
+                sr->rx_head += len;
+                *len_out = len;
+                return cmd;
+            }
+        }
+
+        /* -- about to block: send what the commands so far produced, which
+              also releases frames forwarded in place before compaction -- */
+        if ( sr_flush_packets(sr) != 0 )
+        { return 0; }
+
+        /* -- need more bytes; make room for a whole command at the end -- */
+        if ( avail == 0 )
+        { sr->rx_head = sr->rx_tail = 0; }
+        else if ( sr->rx_head + 10000 > SR_RXBUF_SZ )
+        {
+            memmove(sr->rxbuf, sr->rxbuf + sr->rx_head, avail);
+            sr->rx_head = 0;
+            sr->rx_tail = avail;
+        }
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
-    {
         do
         { /* -- just in case SIGALRM breaks recv -- */
             errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
+            if((ret = recv(sr->sockfd, sr->rxbuf + sr->rx_tail,
+                            SR_RXBUF_SZ - sr->rx_tail, 0)) == -1)
             {
                 if ( errno == EINTR )
                 { continue; }
 
                 perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
+                return 0;
             }
-            bytes_read += ret;
         } while ( errno == EINTR); /* be mindful of signals */
 
+        if ( ret == 0 )
+        {
+            fprintf(stderr,"Error: connection to server closed\n");
+            close(sr->sockfd);
+            return 0;
+        }
+
+        sr->rx_tail += ret;
     }
+} /* -- sr_read_command -- */
 
-    len = ntohl(len);
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_read(..)
+ * Scope: Local
+ *
+ * Read side of the shared memory transport: the next command, in the
+ * slot the peer wrote it to.  Slots are handed back only after a flush,
+ * since frames forwarded in place still point into them, and at least
+ * every quarter ring so the peer never waits on a busy router.
+ *
+ *---------------------------------------------------------------------------*/
 
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
+static unsigned char* sr_shm_read(struct sr_instance* sr, int* len_out)
+{
+    unsigned char* cmd;
+    uint32_t len_nbo;
+    int len;
 
-    if((buf = malloc(len)) == 0)
+    if ( sr_shm_unreleased(sr->shm) >= SR_SHM_SLOTS / 4 )
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
+        if ( sr_flush_packets(sr) != 0 )
+        { return 0; }
+        sr_shm_release(sr->shm);
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    if ( (cmd = sr_shm_next(sr->shm, 0)) == 0 )
+    {
+        /* -- about to block, same as sr_read_command -- */
+        if ( sr_flush_packets(sr) != 0 )
+        { return 0; }
+        sr_shm_release(sr->shm);
 
-    bytes_read = 0;
+        if ( (cmd = sr_shm_next(sr->shm, -1)) == 0 )
+        {
+            fprintf(stderr,"Error: shared memory peer went away\n");
+            return 0;
+        }
+    }
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    memcpy(&len_nbo, cmd, 4);
+    len = ntohl(len_nbo);
+    if ( len > 10000 || len < 8 )
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        fprintf(stderr,"Error: command length to large %d\n",len);
+        return 0;
     }
 
+    *len_out = len;
+    return cmd;
+} /* -- sr_shm_read -- */
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    int command, len;
+    unsigned char *buf = 0;
+    c_packet_ethernet_header* sr_pkt = 0;
+    struct sr_if* iface = 0;
+    int ret = 0;
+    sr_lat_t t_frame = 0, t_handle = 0;
+    struct sr_ethernet_hdr* e_hdr = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->transport);
+
+    /*---------------------------------------------------------------------------
+      Read a command from the server
+      -------------------------------------------------------------------------*/
+
+    if((buf = sr->transport->read(sr, &len)) == 0)
+    { return -1; }
+    SR_LAT_BEGIN(t_frame);
+
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
     command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
@@ -426,24 +590,54 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
+            /* -- resolve the receiving interface once, by name -- */
+            iface = sr_get_interface(sr, (char*)(buf + sizeof(c_base)));
+            if ( iface == 0 )
+            {
+                sr_log(SR_LOG_WARN, "packet received on unknown interface %.16s\n",
+                       (char*)(buf + sizeof(c_base)));
+                break;
+            }
+            sr_stats_rx(iface->idx, len - sizeof(c_packet_ethernet_header) +
+                        sizeof(struct sr_ethernet_hdr));
+
             /* -- check if it is an ARP to another router if so drop   -- */
             if ( sr_arp_req_not_for_us(sr,
                     (buf+sizeof(c_packet_header)),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
+                    iface) )
             { break; }
 
             /* -- log packet -- */
             sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header),
+                    iface, SR_CAP_IN);
+
+            /* -- pass to router, student's code should take over here;
+                  ARP is handled right here rather than queued behind
+                  data frames, since every frame waiting on a reply that
+                  is dropped waits for the next retry -- */
+            SR_LAT_END(SR_LAT_FRAME, t_frame);
+            e_hdr = (struct sr_ethernet_hdr*)(buf + sizeof(c_packet_header));
+            if ( sr->nworkers > 0 && e_hdr->ether_type != htons(ethertype_arp) )
+            {
+                sr_worker_dispatch(sr,
+                        (buf+sizeof(c_packet_header)),
+                        len - sizeof(c_packet_ethernet_header) +
+                        sizeof(struct sr_ethernet_hdr),
+                        iface);
+            }
+            else
+            {
+                SR_LAT_BEGIN(t_handle);
+                sr_handlepacket(sr,
+                        (buf+sizeof(c_packet_header)),
+                        len - sizeof(c_packet_ethernet_header) +
+                        sizeof(struct sr_ethernet_hdr),
+                        iface);
+                SR_LAT_END(SR_LAT_HANDLE, t_handle);
+            }
 
             break;
 
@@ -454,8 +648,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
 
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -469,6 +661,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
+            sr_rt_resolve_interfaces(sr);
             if(sr_verify_routing_table(sr) != 0)
             {
                 fprintf(stderr,"Routing table not consistent with hardware\n");
@@ -501,8 +694,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
 }/* -- sr_read_from_server -- */
 
@@ -517,26 +708,23 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 static int
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+                                struct sr_if* iface /* borrowed */ )
 {
     struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
     assert(sr);
     assert(buf);
-    assert(name);
 
     ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
 
     if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
+        sr_log(SR_LOG_WARN, "no outgoing interface\n");
         return 0;
     }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
+        sr_log(SR_LOG_WARN, "source address does not match interface %s\n", iface->name);
         return 0;
     }
 
@@ -550,6 +738,254 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
 
 } /* -- sr_ether_addrs_match_interface -- */
 
+/* the in place path writes a c_packet_header into the caller's headroom,
+   which for sr_send_pktbuf is the pool's */
+typedef char sr_headroom_check[(SR_PKT_HEADROOM >= sizeof(c_packet_header)) ? 1 : -1];
+typedef char sr_pool_headroom_check[(SR_POOL_HEADROOM >= SR_PKT_HEADROOM) ? 1 : -1];
+
+/* batch used by the sr_send_* functions on this thread, 0 means sr->tx */
+static __thread struct sr_txbatch* sr_tx_bound;
+
+static struct sr_txbatch* sr_tx_batch(struct sr_instance* sr)
+{
+    return sr_tx_bound ? sr_tx_bound : &(sr->tx);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txbatch_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_txbatch_init(struct sr_txbatch* tx)
+{
+    /* REQUIRES */
+    assert(tx);
+
+    memset(tx, 0, sizeof(struct sr_txbatch));
+    pthread_mutex_init(&(tx->lock), 0);
+    if ( (tx->buf = malloc(SR_TXBUF_SZ)) == 0 )
+    { return -1; }
+
+    return 0;
+} /* -- sr_txbatch_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_txbatch_free(..)
+ * Scope: Global
+ *
+ * Free a batch that has been flushed.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_txbatch_free(struct sr_txbatch* tx)
+{
+    /* REQUIRES */
+    assert(tx);
+    assert(tx->niov == 0);
+
+    free(tx->buf);
+    tx->buf = 0;
+    pthread_mutex_destroy(&(tx->lock));
+} /* -- sr_txbatch_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_bind(..)
+ * Scope: Global
+ *
+ * Make the calling thread queue its frames on tx instead of sr->tx.  Used
+ * by forwarding workers so they never contend for a batch.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_tx_bind(struct sr_txbatch* tx)
+{
+    sr_tx_bound = tx;
+} /* -- sr_tx_bind -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_write(..)
+ * Scope: Local
+ *
+ * Write side of the VNS transport: writev() until every byte is out,
+ * resuming after short writes.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_write(struct sr_instance* sr, struct iovec* iov, int niov)
+{
+    ssize_t ret;
+
+    while ( niov > 0 )
+    {
+        ret = writev(sr->sockfd, iov, niov);
+        if ( ret < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            perror("writev(..):sr_vns_comm.c::sr_flush_packets");
+            return -1;
+        }
+
+        /* -- skip over whatever made it out, resume mid-iovec if short -- */
+        while ( niov > 0 && (size_t)ret >= iov->iov_len )
+        {
+            ret -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if ( niov > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+} /* -- sr_vns_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_write(..)
+ * Scope: Local
+ *
+ * Write side of the shared memory transport: copy each command into a
+ * slot of its own, then publish them all at once.  An iovec holds one
+ * or more whole commands, never part of one.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_write(struct sr_instance* sr, struct iovec* iov, int niov)
+{
+    const uint8_t* p;
+    size_t left;
+    uint32_t len_nbo;
+    unsigned int len;
+    uint8_t* slot;
+
+    for ( ; niov > 0; iov++, niov-- )
+    {
+        p = (const uint8_t*)iov->iov_base;
+        left = iov->iov_len;
+        while ( left >= sizeof(c_base) )
+        {
+            memcpy(&len_nbo, p, 4);
+            len = ntohl(len_nbo);
+            assert(len >= sizeof(c_base) && len <= left);
+
+            if ( len > SR_SHM_SLOT_SZ )
+            { sr_log(SR_LOG_WARN, "packet too large to send (%u)\n", len); }
+            else if ( (slot = sr_shm_reserve(sr->shm)) != 0 )
+            { memcpy(slot, p, len); }
+            else
+            {
+                fprintf(stderr,"Error: shared memory peer went away\n");
+                return -1;
+            }
+
+            p += len;
+            left -= len;
+        }
+    }
+
+    sr_shm_publish(sr->shm);
+    return 0;
+} /* -- sr_shm_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_write_locked(..)
+ * Scope: Local
+ *
+ * Write every queued frame to the server, through sr->transport, and
+ * empty the batch.  tx->lock must be held.  Batches of different
+ * threads share the transport, so the writes themselves are serialized
+ * on sr->tx_wlock to keep frames from interleaving.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_tx_write_locked(struct sr_instance* sr, struct sr_txbatch* tx)
+{
+    int niov, rc;
+    sr_lat_t t = 0;
+
+    SR_LAT_BEGIN(t);
+    pthread_mutex_lock(&(sr->tx_wlock));
+    rc = sr->transport->write(sr, tx->iov, tx->niov);
+    pthread_mutex_unlock(&(sr->tx_wlock));
+    SR_LAT_END(SR_LAT_FLUSH, t);
+
+    /* -- the batch is done with any pool buffers it was holding -- */
+    for ( niov = 0; niov < tx->niov; niov++ )
+    {
+        if ( tx->hold[niov] )
+        {
+            sr_pktbuf_release(tx->hold[niov]);
+            tx->hold[niov] = 0;
+        }
+    }
+
+    tx->niov = 0;
+    tx->used = 0;
+    return rc;
+} /* -- sr_tx_write_locked -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flush_packets(..)
+ * Scope: Global
+ *
+ * Push all frames the calling thread queued with the sr_send_* functions
+ * to the server.
+ * Called before the receive path blocks and by the ARP sweeper after
+ * each pass, so frames never sit in the batch while the router is idle.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flush_packets(struct sr_instance* sr /* borrowed */)
+{
+    struct sr_txbatch* tx;
+    int rc = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    tx = sr_tx_batch(sr);
+    pthread_mutex_lock(&(tx->lock));
+    if ( tx->niov > 0 )
+    { rc = sr_tx_write_locked(sr, tx); }
+    pthread_mutex_unlock(&(tx->lock));
+
+    return rc;
+} /* -- sr_flush_packets -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_check(..)
+ * Scope: Local
+ *
+ * Sanity checks and logging shared by both send paths.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_tx_check(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       struct sr_if* iface)
+{
+	/*Buf already has an ethernet header*/
+    /* don't waste my time ... */
+    if ( len < sizeof(struct sr_ethernet_hdr) ){
+        sr_log(SR_LOG_WARN, "packet too short to send (%u)\n", len);
+        return -1;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr,buf,len,iface,SR_CAP_OUT);
+
+    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
+        sr_log(SR_LOG_WARN, "problem with ethernet header, frame not sent\n");
+        return -1;
+    }
+    sr_stats_tx(iface->idx, len);
+
+    return 0;
+} /* -- sr_tx_check -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_send_packet(..)
  * Scope: Global
@@ -557,83 +993,177 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
  * Send a packet (ethernet header included!) of length 'len' to the server
  * to be injected onto the wire.
  *
+ * The frame is copied, behind its VNS header, into the transmit batch so
+ * the caller may reuse buf as soon as this returns.  The batch goes out
+ * in one writev() on sr_flush_packets() or when it fills up.
+ *
  *---------------------------------------------------------------------------*/
 
 int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          uint8_t* buf /* borrowed */ ,
                          unsigned int len,
-                         const char* iface /* borrowed */)
+                         struct sr_if* iface /* borrowed */)
 {
+    struct sr_txbatch* tx;
     c_packet_header *sr_pkt;
+    struct iovec* last;
     unsigned int total_len =  len + (sizeof(c_packet_header));
+    int rc = 0;
 
     /* REQUIRES */
     assert(sr);
     assert(buf);
     assert(iface);
 
-	/*Buf already has an ethernet header*/
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
+    tx = sr_tx_batch(sr);
+    assert(tx->buf);
+
+    if ( sr_tx_check(sr, buf, len, iface) != 0 )
+    { return -1; }
+
+    if ( total_len > SR_TXBUF_SZ )
+    {
+        sr_log(SR_LOG_WARN, "packet too large to send (%u)\n", len);
         return -1;
     }
 
+    pthread_mutex_lock(&(tx->lock));
+
+    if ( tx->used + total_len > SR_TXBUF_SZ || tx->niov == SR_TX_IOV )
+    { rc = sr_tx_write_locked(sr, tx); }
+
     /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
+    sr_pkt = (c_packet_header *)(tx->buf + tx->used);
     sr_pkt->mLen  = htonl(total_len);
     sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
+    strncpy(sr_pkt->mInterfaceName,iface->name,16);
     memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
             buf,len);
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
-
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1;
-    }
-
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+    /* -- frames copied back to back share one iovec -- */
+    last = tx->niov ? &(tx->iov[tx->niov - 1]) : 0;
+    if ( last && (uint8_t*)last->iov_base + last->iov_len == (uint8_t*)sr_pkt )
+    { last->iov_len += total_len; }
+    else
+    {
+        tx->iov[tx->niov].iov_base = sr_pkt;
+        tx->iov[tx->niov].iov_len = total_len;
+        tx->hold[tx->niov] = 0;
+        tx->niov++;
     }
+    tx->used += total_len;
 
-    free(sr_pkt);
+    pthread_mutex_unlock(&(tx->lock));
 
-    return 0;
+    return rc;
 } /* -- sr_send_packet -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
+ * Method: sr_tx_queue_inplace(..)
  * Scope: Local
  *
+ * Write the VNS header into the headroom in front of buf and queue the
+ * frame by reference.  If hold is set the batch keeps a pool reference
+ * to buf until it has been written.
+ *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+static int sr_tx_queue_inplace(struct sr_instance* sr, uint8_t* buf,
+                               unsigned int len, struct sr_if* iface,
+                               int hold)
 {
-    struct pcap_pkthdr h;
-    int size;
+    struct sr_txbatch* tx;
+    c_packet_header *sr_pkt;
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+    int rc = 0;
 
     /* REQUIRES */
     assert(sr);
+    assert(buf);
+    assert(iface);
 
-    if(!sr->logfile)
-    {return; }
+    if ( sr_tx_check(sr, buf, len, iface) != 0 )
+    { return -1; }
+
+    sr_pkt = (c_packet_header *)(buf - sizeof(c_packet_header));
+    sr_pkt->mLen  = htonl(total_len);
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface->name,16);
+
+    tx = sr_tx_batch(sr);
+    pthread_mutex_lock(&(tx->lock));
+
+    if ( tx->niov == SR_TX_IOV )
+    { rc = sr_tx_write_locked(sr, tx); }
+
+    if ( hold )
+    { sr_pktbuf_hold(buf); }
+
+    tx->iov[tx->niov].iov_base = sr_pkt;
+    tx->iov[tx->niov].iov_len = total_len;
+    tx->hold[tx->niov] = hold ? buf : 0;
+    tx->niov++;
+
+    pthread_mutex_unlock(&(tx->lock));
+
+    return rc;
+} /* -- sr_tx_queue_inplace -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_inplace(..)
+ * Scope: Global
+ *
+ * Zero copy variant of sr_send_packet.  The VNS header is written into the
+ * SR_PKT_HEADROOM bytes in front of buf and the frame is referenced, not
+ * copied, by the transmit batch.  The caller must own that headroom and
+ * keep buf intact until the next sr_flush_packets().  Frames handed to
+ * sr_handlepacket by sr_read_from_server meet both requirements.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_inplace(struct sr_instance* sr /* borrowed */,
+                           uint8_t* buf /* borrowed until flush */,
+                           unsigned int len,
+                           struct sr_if* iface /* borrowed */)
+{
+    return sr_tx_queue_inplace(sr, buf, len, iface, 0);
+} /* -- sr_send_packet_inplace -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_pktbuf(..)
+ * Scope: Global
+ *
+ * Send a frame held in a pool buffer (see sr_pool.h) without copying it.
+ * The transmit batch takes its own reference, so the caller releases its
+ * reference as usual and must not modify buf afterwards.
+ *
+ *---------------------------------------------------------------------------*/
 
-    size = min(PACKET_DUMP_SIZE, len);
+int sr_send_pktbuf(struct sr_instance* sr /* borrowed */,
+                   uint8_t* buf /* pool buffer */,
+                   unsigned int len,
+                   struct sr_if* iface /* borrowed */)
+{
+    return sr_tx_queue_inplace(sr, buf, len, iface, 1);
+} /* -- sr_send_pktbuf -- */
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                   struct sr_if* iface, int dir)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->capture)
+    {return; }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- only copied here, written out by the capture thread -- */
+    sr_capture_packet(sr->capture, buf, len, iface->idx, dir);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -645,9 +1175,8 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 int  sr_arp_req_not_for_us(struct sr_instance* sr,
                            uint8_t * packet /* lent */,
                            unsigned int len,
-                           char* interface  /* lent */)
+                           struct sr_if* iface  /* lent */)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 
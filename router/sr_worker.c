@@ -0,0 +1,290 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.c
+ *
+ * Description:
+ *
+ * Flow hashed dispatch of received frames to forwarding worker threads,
+ * see sr_worker.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <netinet/in.h>
+
+#include "sr_worker.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_pool.h"
+#include "sr_lat.h"
+#include "sr_stats.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_flow_hash(..)
+ * Scope:  Global
+ *
+ * Hash of the addresses (and ports, or ICMP id) of a frame.  ARP is
+ * hashed on the sender so a neighbour's ARP traffic stays in order.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_flow_hash(const uint8_t* frame, unsigned int len)
+{
+    const struct sr_ethernet_hdr* e_hdr = (const struct sr_ethernet_hdr*)frame;
+    const struct sr_ip_hdr* ip_hdr;
+    const struct sr_arp_hdr* a_hdr;
+    const uint8_t* l4;
+    unsigned int hl;
+    uint32_t h = 0;
+
+    if ( len < sizeof(struct sr_ethernet_hdr) )
+    { return 0; }
+
+    if ( e_hdr->ether_type == htons(ethertype_ip) &&
+         len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) )
+    {
+        ip_hdr = (const struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+        h = ip_hdr->ip_src ^ ip_hdr->ip_dst ^ ip_hdr->ip_p;
+
+        /* -- only the first fragment carries the transport header -- */
+        hl = ip_hdr->ip_hl * 4;
+        l4 = (const uint8_t*)ip_hdr + hl;
+        if ( (ip_hdr->ip_off & htons(IP_OFFMASK)) == 0 &&
+             len >= sizeof(struct sr_ethernet_hdr) + hl + 8 )
+        {
+            if ( ip_hdr->ip_p == ip_protocol_icmp )
+            { h ^= (uint32_t)l4[4] << 8 | l4[5]; }  /* echo id */
+            else
+            { h ^= (uint32_t)l4[0] << 24 | l4[1] << 16 | l4[2] << 8 | l4[3]; }
+        }
+    }
+    else if ( e_hdr->ether_type == htons(ethertype_arp) &&
+              len >= sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    {
+        a_hdr = (const struct sr_arp_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+        h = a_hdr->ar_sip;
+    }
+    else
+    {
+        memcpy(&h, e_hdr->ether_shost + 2, sizeof(h));
+    }
+
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+} /* -- sr_flow_hash -- */
+
+/* Hand frames back once the batch that may reference them is written. */
+static void worker_flush(struct sr_worker* w, struct sr_rxdesc* done,
+                         unsigned int n)
+{
+    unsigned int i;
+
+    sr_flush_packets(w->sr);
+    for ( i = 0; i < n; i++ )
+    { sr_pktbuf_release(done[i].buf); }
+}
+
+static void* worker_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_rxdesc done[SR_WORKER_BURST];
+    unsigned int head, tail, n;
+    sr_lat_t t = 0;
+
+    sr_tx_bind(&(w->tx));
+
+    for ( ;; )
+    {
+        head = w->head;
+        tail = __atomic_load_n(&(w->tail), __ATOMIC_ACQUIRE);
+
+        if ( head == tail )
+        {
+            /* -- idle: sleep until the reader queues something -- */
+            pthread_mutex_lock(&(w->lock));
+            __atomic_store_n(&(w->sleeping), 1, __ATOMIC_SEQ_CST);
+            while ( !w->stop &&
+                    __atomic_load_n(&(w->tail), __ATOMIC_SEQ_CST) == head )
+            { pthread_cond_wait(&(w->wake), &(w->lock)); }
+            __atomic_store_n(&(w->sleeping), 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&(w->lock));
+
+            if ( w->stop && __atomic_load_n(&(w->tail), __ATOMIC_ACQUIRE) == head )
+            { break; }
+            continue;
+        }
+
+        for ( n = 0; head != tail && n < SR_WORKER_BURST; n++, head++ )
+        {
+            done[n] = w->ring[head & (SR_WORKER_RING - 1)];
+            SR_LAT_END(SR_LAT_QUEUE, done[n].queued);
+            SR_LAT_BEGIN(t);
+            sr_handlepacket(w->sr, done[n].buf, done[n].len, done[n].iface);
+            SR_LAT_END(SR_LAT_HANDLE, t);
+        }
+        __atomic_store_n(&(w->head), head, __ATOMIC_RELEASE);
+
+        worker_flush(w, done, n);
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_worker_dispatch(..)
+ * Scope:  Global
+ *
+ * Queue a received frame to the worker owning its flow.  Called by the
+ * reader only.  The frame is copied, so the caller's buffer is free to
+ * be reused as soon as this returns.  Frames are dropped (and counted)
+ * if the worker has fallen SR_WORKER_RING frames behind.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_worker_dispatch(struct sr_instance* sr, uint8_t* frame,
+                       unsigned int len, struct sr_if* iface)
+{
+    struct sr_worker* w;
+    struct sr_rxdesc* d;
+    uint8_t* buf;
+    unsigned int tail;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(sr->nworkers > 0);
+
+    w = &(sr->workers[sr_flow_hash(frame, len) % sr->nworkers]);
+
+    tail = w->tail;
+    if ( tail - __atomic_load_n(&(w->head), __ATOMIC_ACQUIRE) >= SR_WORKER_RING )
+    {
+        w->drops++;
+        sr_stats_drop(SR_DROP_QUEUE_FULL);
+        return -1;
+    }
+    if ( (buf = sr_pktbuf_alloc(len)) == 0 )
+    {
+        w->drops++;
+        sr_stats_drop(SR_DROP_NO_BUFFER);
+        return -1;
+    }
+
+    memcpy(buf, frame, len);
+    d = &(w->ring[tail & (SR_WORKER_RING - 1)]);
+    d->buf = buf;
+    d->len = len;
+    d->iface = iface;
+    SR_LAT_BEGIN(d->queued);
+
+    __atomic_store_n(&(w->tail), tail + 1, __ATOMIC_SEQ_CST);
+
+    if ( __atomic_load_n(&(w->sleeping), __ATOMIC_SEQ_CST) )
+    {
+        pthread_mutex_lock(&(w->lock));
+        pthread_cond_signal(&(w->wake));
+        pthread_mutex_unlock(&(w->lock));
+    }
+
+    return 0;
+} /* -- sr_worker_dispatch -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_workers_start(..)
+ * Scope:  Global
+ *
+ * Start n forwarding workers.  Must be called before frames are read.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_workers_start(struct sr_instance* sr, unsigned int n)
+{
+    struct sr_worker* w;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(sr->nworkers == 0);
+
+    if ( n == 0 )
+    { return 0; }
+    if ( n > SR_WORKERS_MAX )
+    { n = SR_WORKERS_MAX; }
+
+    if ( posix_memalign((void**)&(sr->workers), SR_CACHELINE,
+                        n * sizeof(struct sr_worker)) != 0 )
+    {
+        sr->workers = 0;
+        return -1;
+    }
+    memset(sr->workers, 0, n * sizeof(struct sr_worker));
+
+    for ( i = 0; i < n; i++ )
+    {
+        w = &(sr->workers[i]);
+        w->sr = sr;
+        w->id = i;
+        pthread_mutex_init(&(w->lock), 0);
+        pthread_cond_init(&(w->wake), 0);
+        if ( sr_txbatch_init(&(w->tx)) != 0 ||
+             pthread_create(&(w->thread), 0, worker_main, w) != 0 )
+        {
+            sr_txbatch_free(&(w->tx));
+            break;
+        }
+        sr->nworkers++;
+    }
+
+    if ( sr->nworkers != n )
+    {
+        sr_workers_stop(sr);
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_workers_start -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_workers_stop(..)
+ * Scope:  Global
+ *
+ * Let every worker finish what is queued to it, then join them.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_workers_stop(struct sr_instance* sr)
+{
+    struct sr_worker* w;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        w = &(sr->workers[i]);
+        pthread_mutex_lock(&(w->lock));
+        w->stop = 1;
+        pthread_cond_signal(&(w->wake));
+        pthread_mutex_unlock(&(w->lock));
+    }
+
+    for ( i = 0; i < sr->nworkers; i++ )
+    {
+        w = &(sr->workers[i]);
+        pthread_join(w->thread, 0);
+        if ( w->drops )
+        { fprintf(stderr, "worker %u dropped %lu frames\n", i, w->drops); }
+        sr_txbatch_free(&(w->tx));
+        pthread_cond_destroy(&(w->wake));
+        pthread_mutex_destroy(&(w->lock));
+    }
+
+    free(sr->workers);
+    sr->workers = 0;
+    sr->nworkers = 0;
+} /* -- sr_workers_stop -- */
@@ -0,0 +1,81 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_worker.h
+ *
+ * Description:
+ *
+ * Forwarding worker threads.  With -w N the thread reading from the server
+ * only frames VNS messages; every received frame is copied into a pool
+ * buffer and handed to one of N workers, chosen by a hash of the flow so
+ * that packets of one flow are always handled, and sent, in order.  Each
+ * worker runs sr_handlepacket and has its own transmit batch.  ARP frames
+ * are the exception: the reader handles those itself, so that a reply is
+ * never lost to a full ring.
+ *
+ * A worker keeps the frames it has handled until it has flushed its
+ * batch, which is what sr_send_packet_inplace requires of its caller.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_WORKER_H
+#define SR_WORKER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_router.h"
+
+#define SR_WORKERS_MAX  64
+#define SR_WORKER_RING  1024      /* frames queued per worker, power of 2 */
+#define SR_WORKER_BURST SR_TX_IOV /* frames handled between flushes */
+
+#define SR_CACHELINE 64
+
+struct sr_rxdesc
+{
+    uint8_t* buf;           /* pool buffer, see sr_pool.h */
+    unsigned int len;
+    struct sr_if* iface;
+    uint64_t queued;        /* sr_lat_now() when queued, if -P */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_worker
+ *
+ * ring is a single producer (reader thread) single consumer (worker) queue.
+ * head is only written by the worker; tail and drops only by the reader.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_worker
+{
+    struct sr_instance* sr;
+    unsigned int id;
+    pthread_t thread;
+
+    unsigned int head __attribute__((aligned(SR_CACHELINE)));
+    unsigned int tail __attribute__((aligned(SR_CACHELINE)));
+    unsigned long drops;    /* ring full or no buffer, written by the reader */
+    int sleeping;
+    int stop;
+
+    pthread_mutex_t lock;   /* only used to sleep and wake */
+    pthread_cond_t wake;
+
+    struct sr_rxdesc ring[SR_WORKER_RING] __attribute__((aligned(SR_CACHELINE)));
+    struct sr_txbatch tx;
+};
+
+int  sr_workers_start(struct sr_instance* sr, unsigned int n);
+void sr_workers_stop(struct sr_instance* sr);
+int  sr_worker_dispatch(struct sr_instance* sr, uint8_t* frame,
+                        unsigned int len, struct sr_if* iface);
+uint32_t sr_flow_hash(const uint8_t* frame, unsigned int len);
+
+#endif /* -- SR_WORKER_H -- */
@@ -0,0 +1,750 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.c
+ *
+ * Description:
+ *
+ * AF_XDP transport (-K ... -x), see sr_xdp.h.
+ *
+ * Every UMEM frame is in exactly one place: the free pool, a fill ring,
+ * an RX ring, held by the reader, a TX ring or a completion ring.  The
+ * pool, and the sent flags that move a held frame to a TX ring, are
+ * under pool_lock, which both the reader and the writers take.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_afpacket.h"
+#include "sr_xdp.h"
+#include "sr_transport.h"
+#include "vnscommand.h"
+
+#if defined(_LINUX_) && defined(XDP_SHARED_UMEM)
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+struct xdp_ring
+{
+    uint32_t* producer;
+    uint32_t* consumer;
+    void* descs;            /* struct xdp_desc or uint64_t address */
+    uint32_t cached;        /* our end: producer or consumer */
+    void* map;
+    size_t maplen;
+};
+
+struct sr_xdp_if
+{
+    char name[IFNAMSIZ];
+    int ifindex;
+    int fd;                 /* AF_XDP socket */
+    int map_fd, prog_fd, link_fd;
+    struct xdp_ring rx, tx, fill, comp;
+    unsigned int queued;    /* on tx since the last kick */
+    unsigned long tx_drops;
+};
+
+struct sr_xdp
+{
+    struct sr_xdp_if ifs[SR_AFPACKET_MAX_IFS];
+    unsigned int nifs;
+    unsigned int cur;       /* interface read from last */
+    struct pollfd pfd[SR_AFPACKET_MAX_IFS];
+
+    uint8_t* umem;
+    size_t umem_sz;
+    unsigned int nframes;
+
+    pthread_mutex_t pool_lock;
+    uint64_t* pool;         /* free frames */
+    unsigned int npool;
+    uint8_t* sent;          /* per frame: held frame now on a TX ring */
+
+    uint64_t held[SR_XDP_HELD]; /* read since the last recycle */
+    unsigned int nheld;
+
+    int hwinfo_pending;
+    c_hwinfo hwinfo;        /* first command read */
+};
+
+#define XDP_FRAME(addr) ((addr) & ~(uint64_t)(SR_XDP_FRAME_SZ - 1))
+#define XDP_KICK_STALLS 64  /* kicks in a row that send nothing */
+
+static uint64_t xdp_ptr(const void* p)
+{
+    return (uint64_t)(unsigned long)p;
+}
+
+static int xdp_bpf(int cmd, union bpf_attr* attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*---------------------------------------------------------------------
+ * Method: xdp_load(..)
+ * Scope:  Local
+ *
+ * Create xi's XSKMAP and load the program that redirects to it:
+ *
+ *   r2 = ctx->rx_queue_index
+ *   r1 = map
+ *   r3 = XDP_PASS              (what to do if the queue has no socket)
+ *   return bpf_redirect_map(r1, r2, r3)
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_load(struct sr_xdp_if* xi)
+{
+    struct bpf_insn prog[6];
+    union bpf_attr attr;
+    static char log[16384];
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = 4;
+    attr.value_size = 4;
+    attr.max_entries = 64;
+    if ((xi->map_fd = xdp_bpf(BPF_MAP_CREATE, &attr)) < 0)
+    {
+        perror("bpf(BPF_MAP_CREATE)");
+        return -1;
+    }
+
+    memset(prog, 0, sizeof(prog));
+    prog[0].code = BPF_LDX | BPF_MEM | BPF_W;
+    prog[0].dst_reg = BPF_REG_2;
+    prog[0].src_reg = BPF_REG_1;
+    prog[0].off = offsetof(struct xdp_md, rx_queue_index);
+    prog[1].code = BPF_LD | BPF_DW | BPF_IMM;   /* two slots */
+    prog[1].dst_reg = BPF_REG_1;
+    prog[1].src_reg = BPF_PSEUDO_MAP_FD;
+    prog[1].imm = xi->map_fd;
+    prog[3].code = BPF_ALU64 | BPF_MOV | BPF_K;
+    prog[3].dst_reg = BPF_REG_3;
+    prog[3].imm = XDP_PASS;
+    prog[4].code = BPF_JMP | BPF_CALL;
+    prog[4].imm = BPF_FUNC_redirect_map;
+    prog[5].code = BPF_JMP | BPF_EXIT;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.insns = xdp_ptr(prog);
+    attr.license = xdp_ptr("GPL");
+    attr.log_buf = xdp_ptr(log);
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    if ((xi->prog_fd = xdp_bpf(BPF_PROG_LOAD, &attr)) < 0)
+    {
+        perror("bpf(BPF_PROG_LOAD)");
+        fprintf(stderr, "%s", log);
+        return -1;
+    }
+
+    return 0;
+} /* -- xdp_load -- */
+
+static int xdp_map_ring(int fd, struct xdp_ring_offset* off, off_t pgoff,
+                        size_t desc_sz, struct xdp_ring* r)
+{
+    r->maplen = off->desc + SR_XDP_RING * desc_sz;
+    r->map = mmap(0, r->maplen, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED)
+    {
+        r->map = 0;
+        perror("mmap(..):sr_xdp.c");
+        return -1;
+    }
+    r->producer = (uint32_t*)((uint8_t*)r->map + off->producer);
+    r->consumer = (uint32_t*)((uint8_t*)r->map + off->consumer);
+    r->descs = (uint8_t*)r->map + off->desc;
+    r->cached = 0;
+    return 0;
+} /* -- xdp_map_ring -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_open_if(..)
+ * Scope:  Local
+ *
+ * Open xi's socket, registering the UMEM if owner is 0 and sharing
+ * owner's otherwise, and point its XDP program at it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int xdp_open_if(struct sr_xdp* x, struct sr_xdp_if* xi,
+                       struct sr_xdp_if* owner)
+{
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    union bpf_attr attr;
+    socklen_t optlen;
+    int v, key = 0;
+
+    if (xdp_load(xi) != 0)
+    { return -1; }
+
+    if ((xi->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0)
+    {
+        perror("socket(AF_XDP)");
+        return -1;
+    }
+
+    if (!owner)
+    {
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = xdp_ptr(x->umem);
+        reg.len = x->umem_sz;
+        reg.chunk_size = SR_XDP_FRAME_SZ;
+        reg.headroom = SR_PKT_HEADROOM;
+        if (setsockopt(xi->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0)
+        {
+            perror("XDP_UMEM_REG");
+            return -1;
+        }
+    }
+
+    v = SR_XDP_RING;
+    if (setsockopt(xi->fd, SOL_XDP, XDP_UMEM_FILL_RING, &v, sizeof(v)) != 0 ||
+        setsockopt(xi->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &v, sizeof(v)) != 0 ||
+        setsockopt(xi->fd, SOL_XDP, XDP_RX_RING, &v, sizeof(v)) != 0 ||
+        setsockopt(xi->fd, SOL_XDP, XDP_TX_RING, &v, sizeof(v)) != 0)
+    {
+        perror("XDP rings");
+        return -1;
+    }
+
+    optlen = sizeof(off);
+    if (getsockopt(xi->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0 ||
+        xdp_map_ring(xi->fd, &off.rx, XDP_PGOFF_RX_RING,
+                     sizeof(struct xdp_desc), &(xi->rx)) != 0 ||
+        xdp_map_ring(xi->fd, &off.tx, XDP_PGOFF_TX_RING,
+                     sizeof(struct xdp_desc), &(xi->tx)) != 0 ||
+        xdp_map_ring(xi->fd, &off.fr, XDP_UMEM_PGOFF_FILL_RING,
+                     sizeof(uint64_t), &(xi->fill)) != 0 ||
+        xdp_map_ring(xi->fd, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING,
+                     sizeof(uint64_t), &(xi->comp)) != 0)
+    {
+        perror("XDP_MMAP_OFFSETS");
+        return -1;
+    }
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xi->ifindex;
+    sxdp.sxdp_queue_id = 0;
+    if (owner)
+    {
+        sxdp.sxdp_flags = XDP_SHARED_UMEM;
+        sxdp.sxdp_shared_umem_fd = owner->fd;
+    }
+    else
+    { sxdp.sxdp_flags = XDP_COPY; }
+    if (bind(xi->fd, (struct sockaddr*)&sxdp, sizeof(sxdp)) != 0)
+    {
+        perror(xi->name);
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xi->map_fd;
+    attr.key = xdp_ptr(&key);
+    attr.value = xdp_ptr(&(xi->fd));
+    if (xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) != 0)
+    {
+        perror("bpf(BPF_MAP_UPDATE_ELEM)");
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xi->prog_fd;
+    attr.link_create.target_ifindex = xi->ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    if ((xi->link_fd = xdp_bpf(BPF_LINK_CREATE, &attr)) < 0)
+    {
+        perror("bpf(BPF_LINK_CREATE)");
+        return -1;
+    }
+
+    return 0;
+} /* -- xdp_open_if -- */
+
+/* Put free frames on every fill ring.  pool_lock must be held. */
+static void xdp_refill(struct sr_xdp* x)
+{
+    struct sr_xdp_if* xi;
+    uint64_t* fq;
+    unsigned int i, n;
+
+    for (i = 0; i < x->nifs && x->npool > 0; i++)
+    {
+        xi = &(x->ifs[i]);
+        fq = (uint64_t*)xi->fill.descs;
+        n = SR_XDP_RING - (xi->fill.cached -
+                           __atomic_load_n(xi->fill.consumer, __ATOMIC_ACQUIRE));
+        if (n == 0)
+        { continue; }
+        while (n-- > 0 && x->npool > 0)
+        { fq[xi->fill.cached++ & (SR_XDP_RING - 1)] = x->pool[--x->npool]; }
+        __atomic_store_n(xi->fill.producer, xi->fill.cached, __ATOMIC_RELEASE);
+    }
+} /* -- xdp_refill -- */
+
+/* Take back frames the kernel has sent.  pool_lock must be held. */
+static void xdp_reap(struct sr_xdp* x, struct sr_xdp_if* xi)
+{
+    uint64_t* cq = (uint64_t*)xi->comp.descs;
+    uint32_t prod;
+
+    prod = __atomic_load_n(xi->comp.producer, __ATOMIC_ACQUIRE);
+    if (prod == xi->comp.cached)
+    { return; }
+    while (xi->comp.cached != prod)
+    { x->pool[x->npool++] = XDP_FRAME(cq[xi->comp.cached++ & (SR_XDP_RING - 1)]); }
+    __atomic_store_n(xi->comp.consumer, xi->comp.cached, __ATOMIC_RELEASE);
+} /* -- xdp_reap -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_kick(..)
+ * Scope:  Local
+ *
+ * Have the kernel send everything on xi's TX ring.  In copy mode each
+ * sendto() only sends a small batch and answers EAGAIN for the rest, so
+ * keep at it until the ring is empty, or until the kernel stops taking
+ * frames altogether.  pool_lock must be held.
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_kick(struct sr_xdp* x, struct sr_xdp_if* xi)
+{
+    uint32_t cons;
+    unsigned int stalls = 0;
+
+    __atomic_store_n(xi->tx.producer, xi->tx.cached, __ATOMIC_RELEASE);
+    xi->queued = 0;
+
+    while ((cons = __atomic_load_n(xi->tx.consumer, __ATOMIC_ACQUIRE)) != xi->tx.cached)
+    {
+        if (sendto(xi->fd, 0, 0, MSG_DONTWAIT, 0, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+        { break; }
+        xdp_reap(x, xi);
+        if (__atomic_load_n(xi->tx.consumer, __ATOMIC_ACQUIRE) == cons &&
+            ++stalls == XDP_KICK_STALLS)
+        { break; }
+    }
+} /* -- xdp_kick -- */
+
+/*---------------------------------------------------------------------
+ * Method: xdp_recycle(..)
+ * Scope:  Local
+ *
+ * Frames read since the last call go back to the pool, unless they were
+ * forwarded in place, and the fill rings are topped up.  Frames read may
+ * be referenced by the reader's batch, so it must have been flushed.
+ *
+ *---------------------------------------------------------------------*/
+
+static void xdp_recycle(struct sr_xdp* x)
+{
+    unsigned int i, idx;
+
+    pthread_mutex_lock(&(x->pool_lock));
+    for (i = 0; i < x->nheld; i++)
+    {
+        idx = x->held[i] / SR_XDP_FRAME_SZ;
+        if (x->sent[idx])
+        { x->sent[idx] = 0; }
+        else
+        { x->pool[x->npool++] = x->held[i]; }
+    }
+    x->nheld = 0;
+    xdp_refill(x);
+    pthread_mutex_unlock(&(x->pool_lock));
+} /* -- xdp_recycle -- */
+
+/* The next frame received on xi, as a VNSPACKET command, or 0. */
+static unsigned char* xdp_next(struct sr_xdp* x, struct sr_xdp_if* xi, int* len_out)
+{
+    struct xdp_desc* d;
+    c_packet_header* ph;
+    uint64_t addr;
+    uint32_t len;
+
+    while (xi->rx.cached != __atomic_load_n(xi->rx.producer, __ATOMIC_ACQUIRE))
+    {
+        if (x->nheld == SR_XDP_HELD)
+        { return 0; }
+
+        d = &(((struct xdp_desc*)xi->rx.descs)[xi->rx.cached & (SR_XDP_RING - 1)]);
+        addr = d->addr;
+        len = d->len;
+        __atomic_store_n(xi->rx.consumer, ++xi->rx.cached, __ATOMIC_RELEASE);
+
+        x->held[x->nheld++] = XDP_FRAME(addr);
+        if (addr - XDP_FRAME(addr) < SR_PKT_HEADROOM)
+        { continue; }
+
+        ph = (c_packet_header*)(x->umem + addr - sizeof(c_packet_header));
+        ph->mLen = htonl(sizeof(c_packet_header) + len);
+        ph->mType = htonl(VNSPACKET);
+        memcpy(ph->mInterfaceName, xi->name, sizeof(ph->mInterfaceName));
+
+        *len_out = sizeof(c_packet_header) + len;
+        return (unsigned char*)ph;
+    }
+    return 0;
+} /* -- xdp_next -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_read(..)
+ * Scope:  Local
+ *
+ * Read side of the transport: the VNSHWINFO built from the kernel's
+ * interfaces first, then frames from every interface's RX ring in turn.
+ * Frames read are recycled every SR_XDP_HELD frames and before waiting
+ * in poll(), each time after a flush, and TX rings left with frames on
+ * them are kicked again before poll() too.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned char* sr_xdp_read(struct sr_instance* sr, int* len_out)
+{
+    struct sr_xdp* x = sr->xdp;
+    unsigned char* cmd;
+    unsigned int i;
+
+    if (x->hwinfo_pending)
+    {
+        x->hwinfo_pending = 0;
+        *len_out = ntohl(x->hwinfo.mLen);
+        return (unsigned char*)&(x->hwinfo);
+    }
+
+    for (;;)
+    {
+        if (x->nheld < SR_XDP_HELD)
+        {
+            for (i = 0; i < x->nifs; i++)
+            {
+                if ((cmd = xdp_next(x, &(x->ifs[x->cur]), len_out)) != 0)
+                { return cmd; }
+                x->cur = (x->cur + 1) % x->nifs;
+            }
+        }
+
+        /* -- out of frames to hold, or about to block -- */
+        if (sr_flush_packets(sr) != 0)
+        { return 0; }
+        xdp_recycle(x);
+        x->cur = (x->cur + 1) % x->nifs;
+
+        for (i = 0; i < x->nifs; i++)
+        {
+            if (x->ifs[i].rx.cached !=
+                __atomic_load_n(x->ifs[i].rx.producer, __ATOMIC_ACQUIRE))
+            { break; }
+        }
+        if (i < x->nifs)
+        { continue; }
+
+        /* -- nothing may wait on a TX ring while we sleep -- */
+        pthread_mutex_lock(&(x->pool_lock));
+        for (i = 0; i < x->nifs; i++)
+        {
+            if (x->ifs[i].tx.cached !=
+                __atomic_load_n(x->ifs[i].tx.consumer, __ATOMIC_ACQUIRE))
+            { xdp_kick(x, &(x->ifs[i])); }
+        }
+        pthread_mutex_unlock(&(x->pool_lock));
+
+        if (poll(x->pfd, x->nifs, -1) < 0 && errno != EINTR)
+        {
+            perror("poll(..):sr_xdp.c");
+            return 0;
+        }
+    }
+} /* -- sr_xdp_read -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_write(..)
+ * Scope:  Local
+ *
+ * Write side of the transport: put the frame of every VNSPACKET on the
+ * TX ring of the interface it names, by address if it is in UMEM and
+ * copied into a free frame if not, then kick the kernel.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_xdp_write(struct sr_instance* sr, struct iovec* iov, int niov)
+{
+    struct sr_xdp* x = sr->xdp;
+    struct sr_xdp_if* xi;
+    struct xdp_desc* d;
+    c_packet_header* ph;
+    uint8_t* p;
+    uint8_t* frame;
+    uint64_t addr;
+    size_t left;
+    unsigned int len, flen, i, tries;
+
+    pthread_mutex_lock(&(x->pool_lock));
+    for (i = 0; i < x->nifs; i++)
+    { xdp_reap(x, &(x->ifs[i])); }
+
+    for ( ; niov > 0; iov++, niov--)
+    {
+        p = (uint8_t*)iov->iov_base;
+        left = iov->iov_len;
+        while (left >= sizeof(c_packet_header))
+        {
+            ph = (c_packet_header*)p;
+            len = ntohl(ph->mLen);
+            assert(len >= sizeof(c_packet_header) && len <= left);
+            p += len;
+            left -= len;
+
+            for (i = 0; i < x->nifs; i++)
+            {
+                if (strncmp(x->ifs[i].name, ph->mInterfaceName,
+                            sizeof(ph->mInterfaceName)) == 0)
+                { break; }
+            }
+            if (i == x->nifs || ntohl(ph->mType) != VNSPACKET)
+            { continue; }
+            xi = &(x->ifs[i]);
+            frame = (uint8_t*)ph + sizeof(c_packet_header);
+            flen = len - sizeof(c_packet_header);
+
+            /* -- room on the TX ring, sending what is there if need be -- */
+            for (tries = 0; xi->tx.cached - __atomic_load_n(xi->tx.consumer,
+                            __ATOMIC_ACQUIRE) == SR_XDP_RING && tries < 64; tries++)
+            {
+                xdp_kick(x, xi);
+            }
+            if (tries == 64)
+            {
+                xi->tx_drops++;
+                continue;
+            }
+
+            if (frame >= x->umem && frame < x->umem + x->umem_sz)
+            {
+                /* -- read from UMEM and forwarded in place: just move it -- */
+                addr = frame - x->umem;
+                x->sent[addr / SR_XDP_FRAME_SZ] = 1;
+            }
+            else if (x->npool > 0 && flen <= SR_XDP_FRAME_SZ - SR_PKT_HEADROOM)
+            {
+                addr = x->pool[--x->npool] + SR_PKT_HEADROOM;
+                memcpy(x->umem + addr, frame, flen);
+            }
+            else
+            {
+                xi->tx_drops++;
+                continue;
+            }
+
+            d = &(((struct xdp_desc*)xi->tx.descs)[xi->tx.cached++ & (SR_XDP_RING - 1)]);
+            d->addr = addr;
+            d->len = flen;
+            d->options = 0;
+            xi->queued++;
+        }
+    }
+
+    for (i = 0; i < x->nifs; i++)
+    {
+        xi = &(x->ifs[i]);
+        if (xi->queued > 0)
+        { xdp_kick(x, xi); }
+        xdp_reap(x, xi);
+    }
+    pthread_mutex_unlock(&(x->pool_lock));
+
+    return 0;
+} /* -- sr_xdp_write -- */
+
+static const struct sr_transport sr_xdp_transport =
+{ "xdp", sr_xdp_read, sr_xdp_write };
+
+/*---------------------------------------------------------------------
+ * Method: sr_connect_to_xdp(..)
+ * Scope:  Global
+ *
+ * Open the Linux interfaces given as name[=ip] with AF_XDP sockets over
+ * one UMEM and make them sr's transport.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_connect_to_xdp(struct sr_instance* sr, char** ifs, unsigned int nifs)
+{
+    struct sr_xdp* x;
+    struct sr_xdp_if* xi;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(ifs);
+
+    if (nifs == 0 || nifs > SR_AFPACKET_MAX_IFS)
+    { return -1; }
+
+    if (sr->tx.buf == 0 && sr_txbatch_init(&(sr->tx)) != 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_xdp)\n");
+        return -1;
+    }
+    if ((x = (struct sr_xdp*)calloc(1, sizeof(struct sr_xdp))) == 0)
+    {
+        fprintf(stderr,"Error: out of memory (sr_connect_to_xdp)\n");
+        return -1;
+    }
+    for (i = 0; i < SR_AFPACKET_MAX_IFS; i++)
+    {
+        x->ifs[i].fd = x->ifs[i].map_fd = -1;
+        x->ifs[i].prog_fd = x->ifs[i].link_fd = -1;
+    }
+    pthread_mutex_init(&(x->pool_lock), 0);
+    sr->xdp = x;
+
+    /* -- enough frames to fill every fill ring and as many again in flight -- */
+    x->nframes = nifs * SR_XDP_RING * 2;
+    x->umem_sz = (size_t)x->nframes * SR_XDP_FRAME_SZ;
+    x->umem = (uint8_t*)mmap(0, x->umem_sz, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    x->pool = (uint64_t*)malloc(x->nframes * sizeof(uint64_t));
+    x->sent = (uint8_t*)calloc(x->nframes, 1);
+    if (x->umem == MAP_FAILED || !x->pool || !x->sent)
+    {
+        if (x->umem == MAP_FAILED)
+        { x->umem = 0; }
+        fprintf(stderr,"Error: out of memory (sr_connect_to_xdp)\n");
+        return -1;
+    }
+    for (i = 0; i < x->nframes; i++)
+    { x->pool[x->npool++] = (uint64_t)i * SR_XDP_FRAME_SZ; }
+
+    for (i = 0; i < nifs; i++)
+    {
+        xi = &(x->ifs[i]);
+        x->nifs++;
+
+        xi->ifindex = sr_afpacket_lookup(ifs[i], xi->name, &(x->hwinfo.mHWInfo[3 * i]));
+        if (xi->ifindex < 0 || xdp_open_if(x, xi, i ? &(x->ifs[0]) : 0) != 0)
+        { return -1; }
+        x->pfd[i].fd = xi->fd;
+        x->pfd[i].events = POLLIN;
+    }
+
+    pthread_mutex_lock(&(x->pool_lock));
+    xdp_refill(x);
+    pthread_mutex_unlock(&(x->pool_lock));
+
+    x->hwinfo.mLen = htonl(8 + 3 * nifs * sizeof(c_hw_entry));
+    x->hwinfo.mType = htonl(VNSHWINFO);
+    x->hwinfo_pending = 1;
+    sr->transport = &sr_xdp_transport;
+
+    return 0;
+} /* -- sr_connect_to_xdp -- */
+
+static void xdp_unmap_ring(struct xdp_ring* r)
+{
+    if (r->map)
+    { munmap(r->map, r->maplen); }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_xdp_close(..)
+ * Scope:  Global
+ *
+ * Closing the links detaches the XDP programs.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_xdp_close(struct sr_instance* sr)
+{
+    struct sr_xdp* x;
+    struct sr_xdp_if* xi;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if ((x = sr->xdp) == 0)
+    { return; }
+
+    for (i = 0; i < x->nifs; i++)
+    {
+        xi = &(x->ifs[i]);
+        if (xi->tx_drops)
+        { fprintf(stderr, "%s: %lu frames not sent\n", xi->name, xi->tx_drops); }
+        if (xi->link_fd >= 0)
+        { close(xi->link_fd); }
+        xdp_unmap_ring(&(xi->rx));
+        xdp_unmap_ring(&(xi->tx));
+        xdp_unmap_ring(&(xi->fill));
+        xdp_unmap_ring(&(xi->comp));
+        if (xi->fd >= 0)
+        { close(xi->fd); }
+        if (xi->prog_fd >= 0)
+        { close(xi->prog_fd); }
+        if (xi->map_fd >= 0)
+        { close(xi->map_fd); }
+    }
+
+    if (x->umem)
+    { munmap(x->umem, x->umem_sz); }
+    free(x->pool);
+    free(x->sent);
+    pthread_mutex_destroy(&(x->pool_lock));
+    free(x);
+    sr->xdp = 0;
+} /* -- sr_xdp_close -- */
+
+#else /* -- no AF_XDP -- */
+
+int sr_connect_to_xdp(struct sr_instance* sr, char** ifs, unsigned int nifs)
+{
+    (void)sr;
+    (void)ifs;
+    (void)nifs;
+    fprintf(stderr, "-x needs Linux with AF_XDP\n");
+    return -1;
+} /* -- sr_connect_to_xdp -- */
+
+void sr_xdp_close(struct sr_instance* sr)
+{
+    (void)sr;
+} /* -- sr_xdp_close -- */
+
+#endif /* _LINUX_ && XDP_SHARED_UMEM */
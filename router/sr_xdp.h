@@ -0,0 +1,43 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_xdp.h
+ *
+ * Description:
+ *
+ * AF_XDP transport (-K ifname[=ip] ... -x): the same Linux interfaces as
+ * sr_afpacket.h, but frames arrive in and leave from UMEM, one region of
+ * frames shared by the AF_XDP sockets of every interface.  Interfaces are
+ * looked up the same way, so everything said there about addresses and
+ * checksum offload applies here too.
+ *
+ * An XDP program per interface, loaded with bpf(2) from a handful of
+ * hand assembled instructions, redirects every frame on queue 0 to the
+ * interface's socket, and lets the kernel have frames on other queues.
+ * It is attached in generic (SKB) mode through a BPF link, so it works
+ * on veth and goes away with the router; sockets bind in copy mode to
+ * match.  Needs Linux 5.10 or later for UMEM shared between devices.
+ *
+ *   ./sr -K eth1=10.0.1.1 -K eth2=172.64.3.1 -x -r rtable
+ *
+ * Frames are read in place, with a VNS packet header written into the
+ * SR_PKT_HEADROOM bytes UMEM leaves in front of them.  A frame forwarded
+ * in place goes on the outgoing interface's TX ring as it is, and only
+ * comes back for reuse once the kernel completes it; every other frame
+ * read goes back on a fill ring after the next flush.  Frames the router
+ * builds or copies (ICMP, ARP, queued frames) are copied into a free
+ * UMEM frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_XDP_H
+#define SR_XDP_H
+
+#define SR_XDP_FRAME_SZ 2048    /* UMEM frame, power of 2 */
+#define SR_XDP_RING     1024    /* entries in every ring, power of 2 */
+#define SR_XDP_HELD     256     /* frames read between recycling */
+
+struct sr_instance;
+
+int  sr_connect_to_xdp(struct sr_instance* sr, char** ifs, unsigned int nifs);
+void sr_xdp_close(struct sr_instance* sr);
+
+#endif /* -- SR_XDP_H -- */